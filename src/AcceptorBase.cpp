@@ -82,17 +82,23 @@ AcceptorBase::~AcceptorBase()
 
 void AcceptorBase::cleanup()
 {
+    auto loop = loop_.lock();
+    if (loop && loop->inSameThread()) {
+        loop->removeReadyIO(this);
+    }
     if(INVALID_FD != fd_) {
         SOCKET_FD fd = fd_;
         fd_ = INVALID_FD;
-        ::shutdown(fd, 2);
-        unregisterFd(fd, true);
+        if (owns_fd_) {
+            ::shutdown(fd, 2);
+        }
+        unregisterFd(fd, owns_fd_);
     }
 }
 
-KMError AcceptorBase::listen(const std::string &host, uint16_t port)
+KMError AcceptorBase::listen(const std::string &host, uint16_t port, uint32_t flags)
 {
-    KUMA_INFOXTRACE("startListen, host="<<host<<", port="<<port);
+    KUMA_INFOXTRACE("startListen, host="<<host<<", port="<<port<<", flags="<<flags);
     if (INVALID_FD != fd_) {
         return KMError::INVALID_STATE;
     }
@@ -109,29 +115,57 @@ KMError AcceptorBase::listen(const std::string &host, uint16_t port)
         KUMA_ERRXTRACE("startListen, socket failed, err="<<getLastError());
         return KMError::FAILED;
     }
-    setSocketOption();
+    setSocketOption(flags);
     int addr_len = km_get_addr_length(ss_addr);
     int ret = ::bind(fd_, (struct sockaddr*)&ss_addr, addr_len);
     if(ret < 0) {
         KUMA_ERRXTRACE("startListen, bind failed, err="<<getLastError());
+        closeFd(fd_);
+        fd_ = INVALID_FD;
         return KMError::FAILED;
     }
-    if(::listen(fd_, 128) != 0) {
+    if(::listen(fd_, backlog_) != 0) {
         closeFd(fd_);
         fd_ = INVALID_FD;
         KUMA_ERRXTRACE("startListen, socket listen fail, err="<<getLastError());
         return KMError::FAILED;
     }
+    flags_ = flags;
+    owns_fd_ = true;
     closed_ = false;
     registerFd(fd_);
     return KMError::NOERR;
 }
 
+KMError AcceptorBase::attach(SOCKET_FD listen_fd, uint32_t flags)
+{
+    KUMA_INFOXTRACE("attach, listen_fd="<<listen_fd<<", flags="<<flags);
+    if (INVALID_FD != fd_) {
+        return KMError::INVALID_STATE;
+    }
+    if (INVALID_FD == listen_fd) {
+        return KMError::INVALID_PARAM;
+    }
+    fd_ = listen_fd;
+    flags_ = flags;
+    owns_fd_ = false;
+    closed_ = false;
+    if (!registerFd(fd_)) {
+        fd_ = INVALID_FD;
+        return KMError::FAILED;
+    }
+    return KMError::NOERR;
+}
+
 bool AcceptorBase::registerFd(SOCKET_FD fd)
 {
     auto loop = loop_.lock();
     if (loop && fd != INVALID_FD) {
-        if (loop->registerFd(fd, KUMA_EV_NETWORK, [this](KMEvent ev, void *ol, size_t sz) { ioReady(ev, ol, sz); }) == KMError::NOERR) {
+        KMEvent events = KUMA_EV_NETWORK;
+        if (flags_ & LISTEN_FLAG_EXCLUSIVE) {
+            events |= KUMA_EV_EXCLUSIVE;
+        }
+        if (loop->registerFd(fd, events, [this](KMEvent ev, void *ol, size_t sz) { ioReady(ev, ol, sz); }) == KMError::NOERR) {
             registered_ = true;
         }
     }
@@ -154,7 +188,7 @@ void AcceptorBase::unregisterFd(SOCKET_FD fd, bool close_fd)
     }
 }
 
-void AcceptorBase::setSocketOption()
+void AcceptorBase::setSocketOption(uint32_t flags)
 {
     if(INVALID_FD == fd_) {
         return ;
@@ -169,6 +203,16 @@ void AcceptorBase::setSocketOption()
     
     int opt_val = 1;
     setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, (char*)&opt_val, sizeof(int));
+    
+    if (flags & LISTEN_FLAG_REUSE_PORT) {
+#ifdef SO_REUSEPORT
+        if (setsockopt(fd_, SOL_SOCKET, SO_REUSEPORT, (char*)&opt_val, sizeof(int)) != 0) {
+            KUMA_WARNXTRACE("setSocketOption, failed to set SO_REUSEPORT, err="<<getLastError());
+        }
+#else
+        KUMA_WARNXTRACE("setSocketOption, SO_REUSEPORT is not supported");
+#endif
+    }
 }
 
 KMError AcceptorBase::close()
@@ -190,43 +234,70 @@ void AcceptorBase::onAccept()
 {
     SOCKET_FD fd = INVALID_FD;
     auto loop = loop_.lock();
+    uint32_t accepted = 0;
     while(!closed_ && !loop->stopped()) {
-        fd = ::accept(fd_, NULL, NULL);
+        if (accept_batch_ > 0 && accepted >= accept_batch_) {
+            // the rest connections are accepted in next iteration, edge-triggered poll will not report them again.
+            // the shared poll reports them again after re-arming the fd
+            if (!loop->isPollShared() && loop->inSameThread()) {
+                loop->appendReadyIO(this);
+            }
+            return ;
+        }
+        sockaddr_storage ss_addr;
+        socklen_t ss_len = sizeof(ss_addr);
+#ifdef KUMA_OS_LINUX
+        // the peer address is returned by accept, the fd is ready to be attached
+        fd = ::accept4(fd_, (struct sockaddr*)&ss_addr, &ss_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        fd = ::accept(fd_, (struct sockaddr*)&ss_addr, &ss_len);
+#endif
         if(INVALID_FD == fd) {
             if (EINTR == errno) {
                 continue;
             }
             return ;
         }
-        onAccept(fd);
+        ++accepted;
+        onAccept(fd, (struct sockaddr*)&ss_addr, ss_len);
     }
 }
 
 void AcceptorBase::onAccept(SOCKET_FD fd)
 {
-    char peer_ip[128] = { 0 };
-    uint16_t peer_port = 0;
-
     sockaddr_storage ss_addr = { 0 };
-#if defined(KUMA_OS_LINUX) || defined(KUMA_OS_MAC)
     socklen_t ss_len = sizeof(ss_addr);
-#else
-    int ss_len = sizeof(ss_addr);
-#endif
     int ret = getpeername(fd, (struct sockaddr*)&ss_addr, &ss_len);
-    if (ret == 0) {
-        km_get_sock_addr((struct sockaddr*)&ss_addr, sizeof(ss_addr), peer_ip, sizeof(peer_ip), &peer_port);
-    }
-    else {
+    if (ret != 0) {
         KUMA_WARNXTRACE("onAccept, getpeername failed, err=" << getLastError());
+        ss_len = sizeof(ss_addr);
     }
+    onAccept(fd, (struct sockaddr*)&ss_addr, ss_len);
+}
 
-    KUMA_INFOXTRACE("onAccept, fd=" << fd << ", peer_ip=" << peer_ip << ", peer_port=" << peer_port);
+void AcceptorBase::onAccept(SOCKET_FD fd, const sockaddr *addr, socklen_t addr_len)
+{
+    if (addr_accept_cb_) {
+        if (!addr_accept_cb_(fd, addr, addr_len)) {
+            closeFd(fd);
+        }
+        return ;
+    }
+    
+    char peer_ip[128] = { 0 };
+    uint16_t peer_port = 0;
+    km_get_sock_addr(addr, addr_len, peer_ip, sizeof(peer_ip), &peer_port);
+    KUMA_DBGXTRACE("onAccept, fd=" << fd << ", peer_ip=" << peer_ip << ", peer_port=" << peer_port);
     if (!accept_cb_ || !accept_cb_(fd, peer_ip, peer_port)) {
         closeFd(fd);
     }
 }
 
+void AcceptorBase::onReadyIO()
+{
+    AcceptorBase::onAccept();
+}
+
 void AcceptorBase::onClose(KMError err)
 {
     KUMA_INFOXTRACE("onClose, err="<<int(err));
@@ -27,21 +27,29 @@
 #include "evdefs.h"
 #include "util/kmobject.h"
 #include "EventLoopImpl.h"
+
+#include <atomic>
 KUMA_NS_BEGIN
 
-class AcceptorBase : public KMObject
+class AcceptorBase : public KMObject, public ReadyIO
 {
 public:
     using AcceptCallback = TcpListener::AcceptCallback;
+    using AcceptAddrCallback = TcpListener::AcceptAddrCallback;
     using ErrorCallback = TcpListener::ErrorCallback;
     
     AcceptorBase(const EventLoopPtr &loop);
     virtual ~AcceptorBase();
     
-    virtual KMError listen(const std::string &host, uint16_t port);
+    virtual KMError listen(const std::string &host, uint16_t port, uint32_t flags = 0);
+    // accept on the listen fd owned by other acceptor, the owner should be closed last
+    KMError attach(SOCKET_FD listen_fd, uint32_t flags);
     virtual KMError close();
     
     void setAcceptCallback(AcceptCallback cb) { accept_cb_ = std::move(cb); }
+    void setAcceptAddrCallback(AcceptAddrCallback cb) { addr_accept_cb_ = std::move(cb); }
+    void setBacklog(int backlog) { backlog_ = backlog; }
+    void setAcceptBatch(uint32_t max_accepts) { accept_batch_ = max_accepts; }
     void setErrorCallback(ErrorCallback cb) { error_cb_ = std::move(cb); }
     
     SOCKET_FD getFd() const { return fd_; }
@@ -52,9 +60,11 @@ protected:
     virtual void unregisterFd(SOCKET_FD fd, bool close_fd);
 
 protected:
-    void setSocketOption();
+    void setSocketOption(uint32_t flags);
     virtual void onAccept();
     void onAccept(SOCKET_FD fd);
+    void onAccept(SOCKET_FD fd, const sockaddr *addr, socklen_t addr_len);
+    void onReadyIO() override;
     void onClose(KMError err);
     void cleanup();
     virtual void ioReady(KMEvent events, void* ol, size_t io_size);
@@ -63,8 +73,11 @@ protected:
     SOCKET_FD           fd_{ INVALID_FD };
     EventLoopWeakPtr    loop_;
     bool                registered_{ false };
+    bool                owns_fd_{ true };
     uint32_t            flags_{ 0 };
-    bool                closed_{ false };
+    std::atomic<bool>   closed_{ false }; // may be closed on other thread
+    int                 backlog_{ 128 };
+    uint32_t            accept_batch_{ 0 }; // max fds accepted per wakeup, 0 for no limit
 #ifdef KUMA_OS_WIN
     ADDRESS_FAMILY
 #else
@@ -73,6 +86,7 @@ protected:
                         ss_family_ = AF_INET;
     
     AcceptCallback      accept_cb_;
+    AcceptAddrCallback  addr_accept_cb_;
     ErrorCallback       error_cb_;
 };
 
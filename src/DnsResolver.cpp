@@ -230,12 +230,16 @@ void DnsResolver::addRecord(const DnsRecord &dr)
 }
 
 KMError DnsResolver::getAddress(const std::string &host, sockaddr_storage &addr)
+{
+    return getAddress(host, addr, steady_clock::now());
+}
+
+KMError DnsResolver::getAddress(const std::string &host, sockaddr_storage &addr, steady_clock::time_point now)
 {
     LockGuard g(s_records_locker);
     auto it = s_dns_records.find(host);
     if (it != s_dns_records.end()) {
-        auto current = steady_clock::now();
-        auto diff_ms = duration_cast<milliseconds>(current - it->second.time).count();
+        auto diff_ms = duration_cast<milliseconds>(now - it->second.time).count();
         if (diff_ms < record_expires_intrval_ms) {
             memcpy(&addr, &it->second.addr, sizeof(addr));
             return KMError::NOERR;
@@ -34,6 +34,7 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <chrono>
 
 #if defined(KUMA_OS_WIN)
 # include <Ws2tcpip.h>
@@ -76,6 +77,7 @@ public:
     
     static DnsResolver& get();
     KMError getAddress(const std::string &host, sockaddr_storage &addr);
+    KMError getAddress(const std::string &host, sockaddr_storage &addr, std::chrono::steady_clock::time_point now);
     Token resolve(const std::string &host, uint16_t port, ResolveCallback cb);
     KMError resolve(const std::string &host, uint16_t port, sockaddr_storage &addr);
     void cancel(const std::string &host, const Token &t);
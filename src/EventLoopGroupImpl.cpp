@@ -0,0 +1,142 @@
+/* Copyright (c) 2014, Fengping Bao <jamol@live.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "kmconf.h"
+
+#include "EventLoopGroupImpl.h"
+#include "util/util.h"
+#include "util/kmtrace.h"
+
+#include <future>
+
+using namespace kuma;
+
+EventLoopGroup::Impl::Impl(PollType poll_type)
+: poll_type_(poll_type)
+{
+    KM_SetObjKey("EventLoopGroup");
+}
+
+EventLoopGroup::Impl::~Impl()
+{
+    stop();
+}
+
+bool EventLoopGroup::Impl::init(int count, bool pin_cpu)
+{
+    if (!loops_.empty()) {
+        return false;
+    }
+    int cores = static_cast<int>(std::thread::hardware_concurrency());
+    if (cores <= 0) {
+        cores = 1;
+    }
+    if (count <= 0) {
+        count = cores;
+    }
+    KUMA_INFOXTRACE("init, count="<<count<<", pin_cpu="<<pin_cpu<<", cores="<<cores);
+    for (int i = 0; i < count; ++i) {
+        std::unique_ptr<EventLoop> loop(new EventLoop(poll_type_));
+        auto *ploop = loop.get();
+        std::promise<bool> ready;
+        auto ready_future = ready.get_future();
+        int cpu = pin_cpu ? i % cores : -1;
+        try {
+            threads_.emplace_back([this, ploop, cpu, &ready] {
+                if (cpu >= 0 && !set_thread_affinity(cpu)) {
+                    KUMA_WARNXTRACE("init, failed to pin loop thread to cpu "<<cpu);
+                }
+                if (!ploop->init()) {
+                    ready.set_value(false);
+                    return;
+                }
+                ready.set_value(true);
+                ploop->loop();
+            });
+        } catch (...) {
+            KUMA_ERRXTRACE("init, failed to create loop thread");
+            stop();
+            return false;
+        }
+        loops_.emplace_back(std::move(loop));
+        if (!ready_future.get()) {
+            KUMA_ERRXTRACE("init, failed to init EventLoop "<<i);
+            stop();
+            return false;
+        }
+    }
+    return true;
+}
+
+void EventLoopGroup::Impl::stop()
+{
+    for (auto &loop : loops_) {
+        loop->stop();
+    }
+    for (auto &thr : threads_) {
+        if (thr.joinable()) {
+            try {
+                thr.join();
+            } catch (...) {
+                KUMA_ERRXTRACE("stop, failed to join loop thread");
+            }
+        }
+    }
+    threads_.clear();
+    loops_.clear();
+}
+
+EventLoop* EventLoopGroup::Impl::getLoop(int index) const
+{
+    if (index < 0 || index >= size()) {
+        return nullptr;
+    }
+    return loops_[index].get();
+}
+
+EventLoop* EventLoopGroup::Impl::getNextLoop()
+{
+    if (loops_.empty()) {
+        return nullptr;
+    }
+    auto index = next_loop_.fetch_add(1, std::memory_order_relaxed) % loops_.size();
+    return loops_[index].get();
+}
+
+EventLoop* EventLoopGroup::Impl::getLeastLoadedLoop()
+{
+    if (loops_.empty()) {
+        return nullptr;
+    }
+    // start from the next loop in round-robin, so the ties are spread
+    auto start = next_loop_.fetch_add(1, std::memory_order_relaxed) % loops_.size();
+    EventLoop *least = nullptr;
+    uint32_t least_load = 0;
+    for (size_t i = 0; i < loops_.size(); ++i) {
+        auto *loop = loops_[(start + i) % loops_.size()].get();
+        auto load = loop->getLoad();
+        if (!least || load < least_load) {
+            least = loop;
+            least_load = load;
+        }
+    }
+    return least;
+}
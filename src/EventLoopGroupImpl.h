@@ -0,0 +1,59 @@
+/* Copyright (c) 2014, Fengping Bao <jamol@live.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __EventLoopGroupImpl_H__
+#define __EventLoopGroupImpl_H__
+
+#include "kmdefs.h"
+#include "kmapi.h"
+#include "util/kmobject.h"
+
+#include <thread>
+#include <vector>
+#include <memory>
+#include <atomic>
+
+KUMA_NS_BEGIN
+
+class EventLoopGroup::Impl : public KMObject
+{
+public:
+    Impl(PollType poll_type);
+    ~Impl();
+    
+    bool init(int count, bool pin_cpu);
+    void stop();
+    
+    int size() const { return static_cast<int>(loops_.size()); }
+    EventLoop* getLoop(int index) const;
+    EventLoop* getNextLoop();
+    EventLoop* getLeastLoadedLoop();
+    
+private:
+    PollType                                poll_type_;
+    std::vector<std::unique_ptr<EventLoop>> loops_;
+    std::vector<std::thread>                threads_;
+    std::atomic<unsigned>                   next_loop_{ 0 };
+};
+
+KUMA_NS_END
+
+#endif
@@ -25,20 +25,31 @@
 #include "util/kmtrace.h"
 #include <thread>
 #include <condition_variable>
+#include <chrono>
+#include <algorithm>
 
 KUMA_NS_BEGIN
 
 IOPoll* createIOPoll(PollType poll_type);
+IOPoll* createSharedEPoll();
+
+// the loop that the current IO thread belongs to
+static thread_local EventLoop::Impl* tls_io_loop = nullptr;
 
 EventLoop::Impl::Impl(PollType poll_type)
 : poll_(createIOPoll(poll_type))
 , timer_mgr_(new TimerManager(this))
 {
     KM_SetObjKey("EventLoop");
+    task_lanes_[static_cast<int>(TaskPriority::IDLE)].budget = 64;
 }
 
 EventLoop::Impl::~Impl()
 {
+    if (!io_threads_.empty()) {
+        stop_loop_ = true;
+        joinIOThreads();
+    }
     while (pending_objects_) {
         auto obj = pending_objects_;
         pending_objects_ = pending_objects_->next_;
@@ -48,6 +59,20 @@ EventLoop::Impl::~Impl()
     while (obs_queue_.dequeue(cb)) {
         cb(LoopActivity::EXIT);
     }
+    for (auto &lane : task_lanes_) {
+        while (auto node = lane.queue.dequeue()) {
+            node->release();
+        }
+        while (lane.pending_head) {
+            auto node = lane.pending_head;
+            lane.pending_head = static_cast<TaskNodePtr>(node->mpsc_next_.load(std::memory_order_relaxed));
+            node->release();
+        }
+        lane.pending_tail = nullptr;
+    }
+    if (cb_tracker_) {
+        LoopWatchdog::instance().removeTracker(cb_tracker_.get());
+    }
     if(poll_) {
         delete poll_;
         poll_ = nullptr;
@@ -61,9 +86,57 @@ bool EventLoop::Impl::init()
     }
     stop_loop_ = false;
     thread_id_ = std::this_thread::get_id();
+    for (uint32_t i = 0; i < io_thread_count_; ++i) {
+        ++io_threads_running_;
+        io_threads_.emplace_back([this] { runIOThread(); });
+    }
     return true;
 }
 
+void EventLoop::Impl::runIOThread()
+{
+    tls_io_loop = this;
+    while (!stop_loop_) {
+        if (poll_->waitShared(-1) != KMError::NOERR) {
+            break;
+        }
+    }
+    --io_threads_running_;
+}
+
+void EventLoop::Impl::joinIOThreads()
+{
+    poll_->wakeupShared();
+    // the IO threads may be waiting for the tasks they posted by sync
+    while (io_threads_running_ > 0) {
+        processTasks(false);
+        std::this_thread::yield();
+    }
+    for (auto &t : io_threads_) {
+        t.join();
+    }
+    io_threads_.clear();
+}
+
+void EventLoop::Impl::waitIOCallback(SOCKET_FD fd)
+{
+    // the callback of fd may be still running on an IO thread, the fd and the object
+    // behind the callback are released after it returns
+    while (true) {
+        auto tid = poll_->callbackThread(fd);
+        if (tid == std::thread::id() || tid == std::this_thread::get_id()) {
+            break;
+        }
+        {
+            LockGuard g(sync_mutex_);
+            if (std::find(sync_io_threads_.begin(), sync_io_threads_.end(), tid) != sync_io_threads_.end()) {
+                break; // it is waiting for this thread
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
 PollType EventLoop::Impl::getPollType() const
 {
     if(poll_) {
@@ -80,19 +153,45 @@ bool EventLoop::Impl::isPollLT() const
     return false;
 }
 
-KMError EventLoop::Impl::registerFd(SOCKET_FD fd, uint32_t events, IOCallback cb)
+static bool set_sock_busy_poll(SOCKET_FD fd, uint32_t busy_poll_us)
 {
+#if defined(KUMA_OS_LINUX) && defined(SO_BUSY_POLL)
+    int opt_val = busy_poll_us;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, (char*)&opt_val, sizeof(opt_val)) != 0 && errno != ENOTSOCK) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+KMError EventLoop::Impl::registerFd(SOCKET_FD fd, uint32_t events, PollCallback cb)
+{
+    auto sock_busy_poll_us = sock_busy_poll_us_.load(std::memory_order_relaxed);
+    if (sock_busy_poll_us > 0 && !set_sock_busy_poll(fd, sock_busy_poll_us)) {
+        // EPERM without CAP_NET_ADMIN if the value is above net.core.busy_poll,
+        // it fails the same way on every socket
+        auto err = getLastError();
+        if (sock_busy_poll_us_.compare_exchange_strong(sock_busy_poll_us, 0, std::memory_order_relaxed)) {
+            KUMA_WARNXTRACE("registerFd, failed to set SO_BUSY_POLL, disabled, err="<<err);
+        }
+    }
     if(inSameThread()) {
         return poll_->registerFd(fd, events, std::move(cb));
     }
     return async([=, cb=std::move(cb)] () mutable {
-        auto ret = poll_->registerFd(fd, events, cb);
+        auto ret = poll_->registerFd(fd, events, std::move(cb));
         if(ret != KMError::NOERR) {
             return ;
         }
     });
 }
 
+void EventLoop::Impl::runExclusive(SOCKET_FD fd, KMFunction<void(void)> task)
+{
+    KUMA_ASSERT(inSameThread());
+    poll_->runExclusive(fd, std::move(task));
+}
+
 KMError EventLoop::Impl::updateFd(SOCKET_FD fd, uint32_t events)
 {
     if(inSameThread()) {
@@ -110,6 +209,9 @@ KMError EventLoop::Impl::unregisterFd(SOCKET_FD fd, bool close_fd)
 {
     if(inSameThread()) {
         auto ret = poll_->unregisterFd(fd);
+        if (!io_threads_.empty()) {
+            waitIOCallback(fd);
+        }
         if(close_fd) {
             closeFd(fd);
         }
@@ -117,6 +219,9 @@ KMError EventLoop::Impl::unregisterFd(SOCKET_FD fd, bool close_fd)
     } else {
         auto ret = sync([=] {
             poll_->unregisterFd(fd);
+            if (!io_threads_.empty()) {
+                waitIOCallback(fd);
+            }
             if(close_fd) {
                 closeFd(fd);
             }
@@ -186,40 +291,299 @@ void EventLoop::Impl::removePendingObject(PendingObject *obj)
     }
 }
 
-void EventLoop::Impl::processTasks()
+void EventLoop::Impl::appendReadyIO(ReadyIO *io)
+{
+    KUMA_ASSERT(inSameThread());
+    if (io->queued_) {
+        return;
+    }
+    io->queued_ = true;
+    io->next_ = nullptr;
+    io->prev_ = ready_tail_;
+    if (ready_tail_) {
+        ready_tail_->next_ = io;
+    } else {
+        ready_head_ = io;
+    }
+    ready_tail_ = io;
+}
+
+void EventLoop::Impl::removeReadyIO(ReadyIO *io)
+{
+    KUMA_ASSERT(inSameThread());
+    if (!io->queued_) {
+        return;
+    }
+    io->queued_ = false;
+    if (io == ready_last_) {
+        ready_last_ = io->prev_; // the sources before it are not processed yet
+    }
+    if (io->prev_) {
+        io->prev_->next_ = io->next_;
+    } else {
+        ready_head_ = io->next_;
+    }
+    if (io->next_) {
+        io->next_->prev_ = io->prev_;
+    } else {
+        ready_tail_ = io->prev_;
+    }
+    io->next_ = io->prev_ = nullptr;
+}
+
+void EventLoop::Impl::processReadyIO()
+{
+    // the sources deferred again are appended after the last one, they run in next iteration
+    ready_last_ = ready_tail_;
+    while (ready_last_) {
+        auto *io = ready_head_;
+        removeReadyIO(io);
+        ++stats_.read_deferred;
+        io->onReadyIO();
+    }
+}
+
+void EventLoop::Impl::appendFlushIO(FlushIO *io)
+{
+    KUMA_ASSERT(inSameThread());
+    if (io->flush_queued_) {
+        return;
+    }
+    io->flush_queued_ = true;
+    io->flush_next_ = nullptr;
+    io->flush_prev_ = flush_tail_;
+    if (flush_tail_) {
+        flush_tail_->flush_next_ = io;
+    } else {
+        flush_head_ = io;
+    }
+    flush_tail_ = io;
+}
+
+void EventLoop::Impl::removeFlushIO(FlushIO *io)
+{
+    KUMA_ASSERT(inSameThread());
+    if (!io->flush_queued_) {
+        return;
+    }
+    io->flush_queued_ = false;
+    if (io->flush_prev_) {
+        io->flush_prev_->flush_next_ = io->flush_next_;
+    } else {
+        flush_head_ = io->flush_next_;
+    }
+    if (io->flush_next_) {
+        io->flush_next_->flush_prev_ = io->flush_prev_;
+    } else {
+        flush_tail_ = io->flush_prev_;
+    }
+    io->flush_next_ = io->flush_prev_ = nullptr;
+}
+
+void EventLoop::Impl::processFlushIO()
 {
-    TaskQueue tq;
-    std::unique_lock<LockType> ul(task_mutex_);
-    task_queue_.swap(tq);
+    // the sources queued by the flush callbacks are flushed in this round too
+    while (flush_head_) {
+        auto *io = flush_head_;
+        removeFlushIO(io);
+        ++stats_.flush_count;
+        io->onFlush();
+    }
+}
+
+size_t EventLoop::Impl::processTasks(bool with_budget)
+{
+    size_t count = 0;
+    for (auto &lane : task_lanes_) {
+        count += processLane(lane, with_budget);
+    }
+    return count;
+}
+
+size_t EventLoop::Impl::processLane(TaskLane &lane, bool with_budget)
+{
+    // only run the tasks queued before this point, the tasks posted by
+    // running tasks will be executed in next round
+    size_t count = 0;
+    while (auto node = lane.queue.dequeue()) {
+        ++count;
+        node->mpsc_next_.store(nullptr, std::memory_order_relaxed);
+        if (lane.pending_tail) {
+            lane.pending_tail->mpsc_next_.store(node, std::memory_order_relaxed);
+        } else {
+            lane.pending_head = node;
+        }
+        lane.pending_tail = node;
+    }
     
-    while (auto node = tq.front_node()) {
-        tq.pop_front();
-        auto &task_slot = node->element();
-        task_slot.state = TaskSlot::State::RUNNING;
-        ul.unlock();
-        {// execute the task
-            LockGuard g(task_run_mutex_);
-            if (task_slot.state != TaskSlot::State::INACTIVE) {
+    auto &urgent_lane = task_lanes_[static_cast<int>(TaskPriority::URGENT)];
+    uint32_t budget = with_budget ? lane.budget : 0;
+    uint32_t executed = 0;
+    while (lane.pending_head && (0 == budget || executed < budget)) {
+        auto node = lane.pending_head;
+        lane.pending_head = static_cast<TaskNodePtr>(node->mpsc_next_.load(std::memory_order_relaxed));
+        if (!lane.pending_head) {
+            lane.pending_tail = nullptr;
+        }
+        ++executed;
+        auto &task_slot = node->slot;
+        auto state = TaskSlot::State::ACTIVE;
+        if (task_slot.state.compare_exchange_strong(state, TaskSlot::State::RUNNING,
+                                                    std::memory_order_acq_rel)) {
+            if (tracker_) {
+                tracker_->enter(CallbackTracker::Type::TASK, 0);
+                task_slot();
+                tracker_->leave();
+            } else {
                 task_slot();
-                task_slot.state = TaskSlot::State::INACTIVE;
             }
+            task_slot.task = nullptr;
+            task_slot.state.store(TaskSlot::State::INACTIVE, std::memory_order_release);
+        }
+        node->release();
+        if (&lane != &urgent_lane && !urgent_lane.queue.empty()) {
+            // the urgent tasks should not wait for the lower lane to be drained
+            count += processLane(urgent_lane, with_budget);
         }
-        ul.lock();
-        if (task_slot.token) {
-            task_slot.token->removeTaskNode(node);
+    }
+    return count;
+}
+
+bool EventLoop::Impl::hasPendingTasks() const
+{
+    for (auto &lane : task_lanes_) {
+        if (lane.pending_head || !lane.queue.empty()) {
+            return true;
         }
     }
+    return false;
+}
+
+bool EventLoop::Impl::busyPoll(uint32_t max_wait_ms)
+{
+    if (0 == busy_poll_cur_us_ || 0 == max_wait_ms) {
+        return false;
+    }
+    using namespace std::chrono;
+    uint64_t spin_us = busy_poll_cur_us_;
+    if (max_wait_ms != (uint32_t)-1 && spin_us > max_wait_ms * 1000ULL) {
+        spin_us = max_wait_ms * 1000ULL;
+    }
+    // the loop is awake while spinning, so posting tasks will not write the notifier
+    auto start = steady_clock::now();
+    auto deadline = start + microseconds(spin_us);
+    auto now = start;
+    bool hit = false;
+    do {
+        poll_->wait(0);
+        unsigned long remain_ms = 0;
+        if (poll_->lastEventCount() > 0 ||
+            timer_mgr_->checkExpire(&remain_ms) > 0 ||
+            hasPendingTasks()) {
+            hit = true;
+        }
+        now = steady_clock::now();
+    } while (!hit && now < deadline && !stop_loop_);
+    ++stats_.spin_count;
+    stats_.spin_time_ns += duration_cast<nanoseconds>(now - start).count();
+    if (hit) {
+        ++stats_.spin_hits;
+        busy_poll_cur_us_ = busy_poll_us_;
+    } else {
+        busy_poll_cur_us_ >>= 1;
+    }
+    return hit;
 }
 
 void EventLoop::Impl::loopOnce(uint32_t max_wait_ms)
 {
-    processTasks();
+    using namespace std::chrono;
+    auto iter_start = steady_clock::now();
+    now_ = iter_start;
+    in_loop_once_ = true;
+    auto task_count = processTasks();
+    if (ready_head_) {
+        processReadyIO();
+    }
+    auto timer_start = steady_clock::now();
+    now_ = timer_start;
+    auto task_time = timer_start - iter_start;
+    ++stats_.iterations;
+    stats_.task_time_ns += duration_cast<nanoseconds>(task_time).count();
+    if (task_count > stats_.max_tasks_per_iteration) {
+        stats_.max_tasks_per_iteration = task_count;
+    }
+    if (busy_poll_us_ > 0 && !ready_head_) {
+        if (busyPoll(max_wait_ms)) {
+            // the tasks found by spinning will be executed in next round
+            if (flush_head_) {
+                processFlushIO();
+            }
+            stats_.iteration_latency.record(duration_cast<nanoseconds>(task_time).count());
+            updateLoad(timer_start, task_time);
+            in_loop_once_ = false;
+            return;
+        }
+        timer_start = steady_clock::now();
+        now_ = timer_start;
+    }
+    // from now on, the tasks or timers from other threads need to wake up the loop
+    wakeup_state_.store(SLEEPING, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
     unsigned long wait_ms = max_wait_ms;
     timer_mgr_->checkExpire(&wait_ms);
     if(wait_ms > max_wait_ms) {
         wait_ms = max_wait_ms;
     }
+    if (flush_head_) {
+        // the output queued by tasks and timers
+        processFlushIO();
+    }
+    if (hasPendingTasks() || ready_head_) {
+        wait_ms = 0; // tasks are posted while the loop is awake, or tasks or IO deferred by budget
+    }
+    auto wait_start = steady_clock::now();
     poll_->wait((uint32_t)wait_ms);
+    auto wait_end = poll_->lastWaitReturned();
+    if (flush_head_) {
+        // the output queued by IO callbacks
+        processFlushIO();
+    }
+    auto iter_end = steady_clock::now();
+    wakeup_state_.store(AWAKE, std::memory_order_relaxed);
+    in_loop_once_ = false;
+    
+    auto wait_time = wait_end - wait_start;
+    auto timer_time = wait_start - timer_start;
+    auto io_time = iter_end - wait_end;
+    stats_.wait_time_ns += duration_cast<nanoseconds>(wait_time).count();
+    stats_.timer_time_ns += duration_cast<nanoseconds>(timer_time).count();
+    stats_.io_time_ns += duration_cast<nanoseconds>(io_time).count();
+    stats_.iteration_latency.record(duration_cast<nanoseconds>(task_time + timer_time + io_time).count());
+    updateLoad(iter_end, task_time + timer_time + io_time);
+    if (busy_poll_us_ > 0 && wait_ms > 0) {
+        ++stats_.sleep_count;
+        stats_.sleep_time_ns += duration_cast<nanoseconds>(wait_time).count();
+        if (poll_->lastEventCount() > 0 && wait_time < microseconds(busy_poll_us_)) {
+            // spinning with full budget would have caught this event
+            busy_poll_cur_us_ = busy_poll_us_;
+        }
+    }
+}
+
+void EventLoop::Impl::updateLoad(std::chrono::steady_clock::time_point now, std::chrono::steady_clock::duration busy_time)
+{
+    using namespace std::chrono;
+    static const auto kLoadWindow = milliseconds(100);
+    load_busy_ += busy_time;
+    auto elapsed = now - load_start_;
+    if (elapsed < kLoadWindow) {
+        return;
+    }
+    auto load = load_busy_ * 1000 / elapsed;
+    load_.store(static_cast<uint32_t>(std::min<decltype(load)>(load, 1000)), std::memory_order_relaxed);
+    load_start_ = now;
+    load_busy_ = steady_clock::duration::zero();
 }
 
 void EventLoop::Impl::loop(uint32_t max_wait_ms)
@@ -227,7 +591,15 @@ void EventLoop::Impl::loop(uint32_t max_wait_ms)
     while (!stop_loop_) {
         loopOnce(max_wait_ms);
     }
-    processTasks();
+    processTasks(false);
+    if (!io_threads_.empty()) {
+        joinIOThreads();
+    }
+    // the sources with input left are not run any more, the off-thread
+    // removal after loop stopped relies on the list being empty
+    while (ready_head_) {
+        removeReadyIO(ready_head_);
+    }
     
     while (pending_objects_) {
         auto obj = pending_objects_;
@@ -246,7 +618,109 @@ void EventLoop::Impl::loop(uint32_t max_wait_ms)
 
 void EventLoop::Impl::notify()
 {
-    poll_->notify();
+    // only the first notification after loop begins to sleep writes the notifier
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int state = SLEEPING;
+    if (!inSameThread() &&
+        wakeup_state_.load(std::memory_order_relaxed) == SLEEPING &&
+        wakeup_state_.compare_exchange_strong(state, NOTIFIED, std::memory_order_relaxed)) {
+        poll_->notify();
+        notify_issued_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        notify_elided_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+EventLoop::Stats EventLoop::Impl::getStats() const
+{
+    EventLoop::Stats stats = stats_;
+    stats.fd_count = poll_->registeredFdCount();
+    stats.notify_issued = notify_issued_.load(std::memory_order_relaxed);
+    stats.notify_elided = notify_elided_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void EventLoop::Impl::setBusyPoll(uint32_t spin_us, uint32_t sock_busy_poll_us)
+{
+    KUMA_INFOXTRACE("setBusyPoll, spin_us="<<spin_us<<", sock_busy_poll_us="<<sock_busy_poll_us);
+    busy_poll_us_ = spin_us;
+    busy_poll_cur_us_ = spin_us;
+    sock_busy_poll_us_.store(sock_busy_poll_us, std::memory_order_relaxed);
+}
+
+void EventLoop::Impl::setWatchdog(uint32_t threshold_ms)
+{
+    KUMA_INFOXTRACE("setWatchdog, threshold_ms="<<threshold_ms);
+    if (threshold_ms > 0) {
+        if (!cb_tracker_) {
+            cb_tracker_.reset(new CallbackTracker(getObjKey()));
+        }
+        cb_tracker_->setThreshold(threshold_ms);
+        tracker_ = cb_tracker_.get();
+        poll_->setCallbackTracker(tracker_);
+        LoopWatchdog::instance().addTracker(tracker_);
+    } else if (tracker_) {
+        // keep cb_tracker_ alive, since this may be called in a tracked callback
+        LoopWatchdog::instance().removeTracker(tracker_);
+        poll_->setCallbackTracker(nullptr);
+        tracker_ = nullptr;
+    }
+}
+
+void EventLoop::Impl::setTaskBudget(TaskPriority priority, uint32_t max_tasks)
+{
+    KUMA_INFOXTRACE("setTaskBudget, priority="<<static_cast<int>(priority)<<", max_tasks="<<max_tasks);
+    if (priority == TaskPriority::NORMAL || priority == TaskPriority::IDLE) {
+        task_lanes_[static_cast<int>(priority)].budget = max_tasks;
+    }
+}
+
+void EventLoop::Impl::setPollBatch(uint32_t min_events, uint32_t max_events)
+{
+    KUMA_INFOXTRACE("setPollBatch, min_events="<<min_events<<", max_events="<<max_events);
+    if (0 == min_events || max_events < min_events) {
+        return;
+    }
+    poll_->setEventBatch(min_events, max_events);
+}
+
+KMError EventLoop::Impl::setIOThreads(uint32_t io_threads)
+{
+    KUMA_INFOXTRACE("setIOThreads, io_threads="<<io_threads);
+    if (thread_id_ != std::thread::id()) {
+        return KMError::INVALID_STATE; // loop is initialized
+    }
+#ifdef KUMA_OS_LINUX
+    if (poll_->getType() != PollType::EPOLL) {
+        return KMError::NOT_SUPPORTED;
+    }
+    if (io_threads > 0 && 0 == io_thread_count_) {
+        delete poll_;
+        poll_ = createSharedEPoll();
+        poll_->setCallbackTracker(tracker_);
+    }
+    io_thread_count_ = io_threads;
+    return KMError::NOERR;
+#else
+    return io_threads > 0 ? KMError::NOT_SUPPORTED : KMError::NOERR;
+#endif
+}
+
+std::chrono::steady_clock::time_point EventLoop::Impl::now() const
+{
+    if (!inSameThread() || !in_loop_once_) {
+        // the cached clock may be stale between loop iterations
+        return std::chrono::steady_clock::now();
+    }
+    // IO callbacks are dispatched inside IOPoll wait, take the later sample
+    auto wait_returned = poll_->lastWaitReturned();
+    return wait_returned > now_ ? wait_returned : now_;
+}
+
+uint64_t EventLoop::Impl::nowMs() const
+{
+    using namespace std::chrono;
+    return (uint64_t)duration_cast<milliseconds>(now().time_since_epoch()).count();
 }
 
 void EventLoop::Impl::stop()
@@ -254,22 +728,52 @@ void EventLoop::Impl::stop()
     KUMA_INFOXTRACE("stop");
     stop_loop_ = true;
     poll_->notify();
+    poll_->wakeupShared();
 }
 
-KMError EventLoop::Impl::appendTask(Task task, EventLoopToken *token)
+KMError EventLoop::Impl::appendTask(Task task, EventLoopToken *token, TaskPriority priority)
 {
     if (token && token->eventLoop().get() != this) {
         return KMError::INVALID_PARAM;
     }
-    auto node = std::make_shared<TaskQueue::DLNode>(std::move(task), token);
-    LockGuard g(task_mutex_);
     if (stop_loop_) {
         return KMError::INVALID_STATE;
     }
-    task_queue_.enqueue(node);
+    auto node = new TaskNode(std::move(task), token != nullptr);
     if (token) {
-        token->appendTaskNode(node);
+        token->appendTaskNodes(node, 1);
     }
+    task_lanes_[static_cast<int>(priority)].queue.enqueue(node);
+    return KMError::NOERR;
+}
+
+KMError EventLoop::Impl::appendTasks(std::vector<Task> &tasks, EventLoopToken *token)
+{
+    if (token && token->eventLoop().get() != this) {
+        return KMError::INVALID_PARAM;
+    }
+    if (stop_loop_) {
+        return KMError::INVALID_STATE;
+    }
+    if (tasks.empty()) {
+        return KMError::NOERR;
+    }
+    TaskNodePtr first = nullptr;
+    TaskNodePtr last = nullptr;
+    for (auto &task : tasks) {
+        auto node = new TaskNode(std::move(task), token != nullptr);
+        if (last) {
+            last->mpsc_next_.store(node, std::memory_order_relaxed);
+        } else {
+            first = node;
+        }
+        last = node;
+    }
+    if (token) {
+        token->appendTaskNodes(first, tasks.size());
+    }
+    tasks.clear();
+    task_lanes_[static_cast<int>(TaskPriority::NORMAL)].queue.enqueue(first, last);
     return KMError::NOERR;
 }
 
@@ -278,23 +782,26 @@ KMError EventLoop::Impl::removeTask(EventLoopToken *token)
     if (!token || token->eventLoop().get() != this) {
         return KMError::INVALID_PARAM;
     }
-    bool is_running = false;
+    std::vector<TaskNodePtr> task_nodes;
     {
-        LockGuard g(task_mutex_);
-        for (auto &node : token->task_nodes_) {
-            auto &task_slot = node->element();
-            if (task_slot.state == TaskSlot::State::RUNNING) {
-                is_running = true;
-                task_slot.state = TaskSlot::State::INACTIVE;
+        std::lock_guard<std::mutex> g(token->task_mutex_);
+        task_nodes.swap(token->task_nodes_);
+    }
+    bool wait_running = !inSameThread();
+    for (auto node : task_nodes) {
+        auto &task_slot = node->slot;
+        auto state = TaskSlot::State::ACTIVE;
+        if (task_slot.state.compare_exchange_strong(state, TaskSlot::State::INACTIVE,
+                                                    std::memory_order_acq_rel)) {
+            // the loop never touches an inactive task, release its captures now
+            task_slot.task = nullptr;
+        } else if (state == TaskSlot::State::RUNNING && wait_running) {
+            // wait for end of running
+            while (task_slot.state.load(std::memory_order_acquire) == TaskSlot::State::RUNNING) {
+                std::this_thread::yield();
             }
-            task_queue_.remove(node);
         }
-        token->task_nodes_.clear();
-    }
-    if (is_running && !inSameThread()) {
-        // wait for end of running
-        task_run_mutex_.lock();
-        task_run_mutex_.unlock();
+        node->release();
     }
     return KMError::NOERR;
 }
@@ -314,33 +821,54 @@ KMError EventLoop::Impl::sync(Task task)
             cv.notify_one(); // the waiting thread may block again since m is not released
             lk.unlock();
         });
+        bool io_thread = tls_io_loop == this;
+        if (io_thread) {
+            LockGuard g(sync_mutex_);
+            sync_io_threads_.push_back(std::this_thread::get_id());
+        }
         auto ret = post(std::move(task_sync));
+        if (ret == KMError::NOERR) {
+            std::unique_lock<std::mutex> lk(m);
+            cv.wait(lk, [&ready] { return ready; });
+        }
+        if (io_thread) {
+            LockGuard g(sync_mutex_);
+            sync_io_threads_.erase(std::find(sync_io_threads_.begin(), sync_io_threads_.end(), std::this_thread::get_id()));
+        }
         if (ret != KMError::NOERR) {
             return ret;
         }
-        std::unique_lock<std::mutex> lk(m);
-        cv.wait(lk, [&ready] { return ready; });
     }
     return KMError::NOERR;
 }
 
-KMError EventLoop::Impl::async(Task task, EventLoopToken *token)
+KMError EventLoop::Impl::async(Task task, EventLoopToken *token, TaskPriority priority)
 {
     if(inSameThread()) {
         task();
         return KMError::NOERR;
     } else {
-        return post(std::move(task), token);
+        return post(std::move(task), token, priority);
     }
 }
 
-KMError EventLoop::Impl::post(Task task, EventLoopToken *token)
+KMError EventLoop::Impl::post(Task task, EventLoopToken *token, TaskPriority priority)
 {
-    auto ret = appendTask(std::move(task), token);
+    auto ret = appendTask(std::move(task), token, priority);
     if (ret != KMError::NOERR) {
         return ret;
     }
-    poll_->notify();
+    notify();
+    return KMError::NOERR;
+}
+
+KMError EventLoop::Impl::post(std::vector<Task> &&tasks, EventLoopToken *token)
+{
+    auto ret = appendTasks(tasks, token);
+    if (ret != KMError::NOERR) {
+        return ret;
+    }
+    notify();
     return KMError::NOERR;
 }
 
@@ -366,18 +894,25 @@ EventLoopPtr EventLoop::Token::Impl::eventLoop()
     return loop_.lock();
 }
 
-void EventLoop::Token::Impl::appendTaskNode(TaskNodePtr &node)
-{
-    task_nodes_.emplace_back(node);
-}
-
-void EventLoop::Token::Impl::removeTaskNode(TaskNodePtr &node)
+void EventLoop::Token::Impl::appendTaskNodes(TaskNodePtr first, size_t count)
 {
-    for (auto it = task_nodes_.begin(); it != task_nodes_.end(); ++it) {
-        if (*it == node) {
-            task_nodes_.erase(it);
-            break;
-        }
+    std::lock_guard<std::mutex> g(task_mutex_);
+    if (task_nodes_.size() + count > task_nodes_.capacity()) {
+        // drop the nodes of completed or cancelled tasks before growing
+        auto it = std::remove_if(task_nodes_.begin(), task_nodes_.end(), [] (TaskNodePtr n) {
+            if (n->slot.state.load(std::memory_order_acquire) == TaskSlot::State::INACTIVE) {
+                n->release();
+                return true;
+            }
+            return false;
+        });
+        task_nodes_.erase(it, task_nodes_.end());
+    }
+    // the nodes are linked by mpsc_next_ before being queued
+    auto node = first;
+    for (size_t i = 0; i < count && node; ++i) {
+        task_nodes_.emplace_back(node);
+        node = static_cast<TaskNodePtr>(node->mpsc_next_.load(std::memory_order_relaxed));
     }
 }
 
@@ -399,6 +934,10 @@ void EventLoop::Token::Impl::reset()
         }
         loop_.reset();
     } else {
+        std::lock_guard<std::mutex> g(task_mutex_);
+        for (auto node : task_nodes_) {
+            node->release();
+        }
         task_nodes_.clear();
     }
 }
@@ -410,6 +949,7 @@ IOPoll* createVPoll();
 IOPoll* createKQueue();
 IOPoll* createSelectPoll();
 IOPoll* createIocpPoll();
+IOPoll* createIoUring(); // nullptr if io_uring is not supported
 
 #ifdef KUMA_OS_WIN
 # include <MSWSock.h>
@@ -460,6 +1000,13 @@ IOPoll* createIOPoll(PollType poll_type)
 #else
             return createDefaultIOPoll();
 #endif
+        case PollType::IO_URING:
+#ifdef KUMA_OS_LINUX
+            if (auto poll = createIoUring()) {
+                return poll;
+            }
+#endif
+            return createDefaultIOPoll();
         default:
             return createDefaultIOPoll();
     }
@@ -26,6 +26,7 @@
 #include "evdefs.h"
 #include "util/kmqueue.h"
 #include "TimerManager.h"
+#include "LoopWatchdog.h"
 #include "util/kmobject.h"
 
 #ifdef KUMA_OS_WIN
@@ -34,6 +35,9 @@
 #include <stdint.h>
 #include <thread>
 #include <list>
+#include <vector>
+#include <atomic>
+#include <mutex>
 
 KUMA_NS_BEGIN
 
@@ -49,20 +53,43 @@ public:
         RUNNING,
         INACTIVE,
     };
-    TaskSlot(EventLoop::Task &&t, EventLoopToken *token)
-    : task(std::move(t)), token(token) {}
+    TaskSlot(EventLoop::MoveTask &&t)
+    : task(std::move(t)) {}
     void operator() ()
     {
         if (task) {
             task();
         }
     }
-    EventLoop::Task task;
-    State state = State::ACTIVE;
-    EventLoopToken* token;
+    EventLoop::MoveTask task;
+    std::atomic<State> state{ State::ACTIVE };
 };
-using TaskQueue = DLQueue<TaskSlot>;
-using TaskNodePtr = TaskQueue::NodePtr;
+
+/**
+ * TaskNode is linked into the lock-free task queue. it is reference counted since
+ * the node is shared by the task queue and the token that the task is scheduled with
+ */
+class TaskNode final : public MPSCNode
+{
+public:
+    TaskNode(EventLoop::MoveTask &&t, bool with_token)
+    : slot(std::move(t)), ref_count_(with_token ? 2 : 1) {}
+    
+    void release()
+    {
+        if (ref_count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+    
+    TaskSlot slot;
+    
+private:
+    ~TaskNode() = default;
+    std::atomic<int> ref_count_;
+};
+using TaskQueue = MPSCQueue<TaskNode>;
+using TaskNodePtr = TaskNode*;
 
 enum class LoopActivity {
     EXIT,
@@ -87,17 +114,55 @@ public:
     PendingObject* prev_ = nullptr;
 };
 
+/**
+ * ReadyIO is the source that stopped reading at read budget with input left. it is
+ * resumed in next iteration without waiting for IO event, since edge-triggered poll
+ * will not report the input again
+ */
+class ReadyIO
+{
+public:
+    virtual ~ReadyIO() {}
+    virtual void onReadyIO() = 0;
+    
+public:
+    ReadyIO* next_ = nullptr;
+    ReadyIO* prev_ = nullptr;
+    bool queued_ = false;
+};
+
+/**
+ * FlushIO is the source that queued output in current iteration, it is flushed once
+ * after the tasks, timers and IO callbacks of the iteration, see EventLoop::setWriteCoalescing
+ */
+class FlushIO
+{
+public:
+    virtual ~FlushIO() {}
+    virtual void onFlush() = 0;
+    
+public:
+    FlushIO* flush_next_ = nullptr;
+    FlushIO* flush_prev_ = nullptr;
+    bool flush_queued_ = false;
+};
+
 class EventLoop::Impl final : public KMObject
 {
 public:
+    using Task = EventLoop::MoveTask;
+    
     Impl(PollType poll_type = PollType::NONE);
     ~Impl();
 
 public:
     bool init();
-    KMError registerFd(SOCKET_FD fd, uint32_t events, IOCallback cb);
+    KMError registerFd(SOCKET_FD fd, uint32_t events, PollCallback cb);
     KMError updateFd(SOCKET_FD fd, uint32_t events);
     KMError unregisterFd(SOCKET_FD fd, bool close_fd);
+    // run the timer work of fd on loop thread exclusively with its IO callback, which
+    // may be running on IO thread. see IOPoll::runExclusive
+    void runExclusive(SOCKET_FD fd, KMFunction<void(void)> task);
     TimerManagerPtr getTimerMgr() { return timer_mgr_; }
     
     PollType getPollType() const;
@@ -109,35 +174,106 @@ public:
 public:
     bool inSameThread() const { return std::this_thread::get_id() == thread_id_; }
     std::thread::id threadId() const { return thread_id_; }
-    KMError appendTask(Task task, EventLoopToken *token);
+    KMError appendTask(Task task, EventLoopToken *token, TaskPriority priority=TaskPriority::NORMAL);
+    KMError appendTasks(std::vector<Task> &tasks, EventLoopToken *token);
     KMError removeTask(EventLoopToken *token);
     KMError sync(Task task);
-    KMError async(Task task, EventLoopToken *token=nullptr);
-    KMError post(Task task, EventLoopToken *token=nullptr);
+    KMError async(Task task, EventLoopToken *token=nullptr, TaskPriority priority=TaskPriority::NORMAL);
+    KMError post(Task task, EventLoopToken *token=nullptr, TaskPriority priority=TaskPriority::NORMAL);
+    KMError post(std::vector<Task> &&tasks, EventLoopToken *token=nullptr);
     void loopOnce(uint32_t max_wait_ms);
     void loop(uint32_t max_wait_ms = -1);
     void notify();
     void stop();
     bool stopped() const { return stop_loop_; }
+    // the fds are re-armed after each callback, see setIOThreads
+    bool isPollShared() const { return io_thread_count_ > 0; }
+    void setBusyPoll(uint32_t spin_us, uint32_t sock_busy_poll_us);
+    void setWatchdog(uint32_t threshold_ms);
+    void setTaskBudget(TaskPriority priority, uint32_t max_tasks);
+    void setPollBatch(uint32_t min_events, uint32_t max_events);
+    KMError setIOThreads(uint32_t io_threads);
+    void setReadBudget(uint32_t max_bytes) { read_budget_ = max_bytes; }
+    uint32_t readBudget() const { return read_budget_; }
+    std::chrono::steady_clock::time_point now() const;
+    uint64_t nowMs() const;
+    CallbackTracker* callbackTracker() const { return tracker_; } // nullptr if watchdog is disabled
+    EventLoop::Stats getStats() const;
+    uint32_t getLoad() const { return load_.load(std::memory_order_relaxed); }
 
     void appendPendingObject(PendingObject *obj);
     void removePendingObject(PendingObject *obj);
+    
+    void appendReadyIO(ReadyIO *io);
+    void removeReadyIO(ReadyIO *io);
+    void appendFlushIO(FlushIO *io);
+    void removeFlushIO(FlushIO *io);
+    void setWriteCoalescing(bool enable) { write_coalescing_ = enable; }
+    bool writeCoalescing() const { return write_coalescing_; }
 
 protected:
-    void processTasks();
+    /**
+     * TaskLane holds the tasks of one priority. the tasks dequeued but not executed
+     * because of budget are kept in pending list in order, it is accessed on loop thread only
+     */
+    struct TaskLane {
+        TaskQueue       queue;
+        TaskNodePtr     pending_head = nullptr;
+        TaskNodePtr     pending_tail = nullptr;
+        uint32_t        budget = 0; // max tasks executed per iteration, 0 for no limit
+    };
+    
+    size_t processTasks(bool with_budget = true);
+    size_t processLane(TaskLane &lane, bool with_budget);
+    bool hasPendingTasks() const;
+    void runIOThread();
+    void joinIOThreads();
+    void waitIOCallback(SOCKET_FD fd);
+    void processReadyIO();
+    void processFlushIO();
+    bool busyPoll(uint32_t max_wait_ms);
+    void updateLoad(std::chrono::steady_clock::time_point now, std::chrono::steady_clock::duration busy_time);
     
 protected:
     using ObserverQueue = DLQueue<ObserverCallback>;
     using LockType = std::mutex;
     using LockGuard = std::lock_guard<LockType>;
     
+    enum WakeupState {
+        AWAKE,      // loop is running, it will check tasks and timers before waiting
+        SLEEPING,   // loop is about to wait or waiting in IOPoll
+        NOTIFIED,   // loop is waiting and a wakeup is pending
+    };
+    
     IOPoll*             poll_;
-    bool                stop_loop_{ false };
+    std::atomic<bool>   stop_loop_{ false };
     std::thread::id     thread_id_;
     
-    TaskQueue           task_queue_;
-    LockType            task_mutex_;
-    LockType            task_run_mutex_;
+    static const int kLaneCount = 3;
+    TaskLane            task_lanes_[kLaneCount]; // indexed by TaskPriority
+    
+    std::atomic<int>    wakeup_state_{ AWAKE };
+    std::atomic<uint64_t> notify_issued_{ 0 };
+    std::atomic<uint64_t> notify_elided_{ 0 };
+    
+    // updated on loop thread only, no atomic operation on the hot path
+    EventLoop::Stats    stats_;
+    // the clock sampled by loopOnce, the time that IOPoll wait returned is kept in poll_
+    std::chrono::steady_clock::time_point now_;
+    bool                in_loop_once_ = false; // the cached clock is valid only in loopOnce
+    
+    // busy time in permille of the last sample window, it is read by other threads
+    std::atomic<uint32_t> load_{ 0 };
+    std::chrono::steady_clock::time_point load_start_;
+    std::chrono::steady_clock::duration load_busy_{ 0 };
+    
+    uint32_t            busy_poll_us_ = 0; // max spin time of each iteration
+    uint32_t            busy_poll_cur_us_ = 0; // current spin time, backs off when idle
+    std::atomic<uint32_t> sock_busy_poll_us_{ 0 };
+    
+    // the callbacks are tracked only when watchdog is enabled
+    CallbackTracker*    tracker_ = nullptr;
+    std::unique_ptr<CallbackTracker> cb_tracker_;
     
     ObserverQueue       obs_queue_;
     LockType            obs_mutex_;
@@ -145,6 +281,25 @@ protected:
     TimerManagerPtr     timer_mgr_;
 
     PendingObject*      pending_objects_ = nullptr;
+    
+    // FIFO of the sources deferred by read budget, accessed on loop thread only
+    ReadyIO*            ready_head_ = nullptr;
+    ReadyIO*            ready_tail_ = nullptr;
+    ReadyIO*            ready_last_ = nullptr; // the last one processed in current iteration
+    uint32_t            read_budget_ = 0; // max bytes read from a socket per wakeup, 0 for no limit
+    
+    // the sources that queued output in current iteration, accessed on loop thread only
+    FlushIO*            flush_head_ = nullptr;
+    FlushIO*            flush_tail_ = nullptr;
+    bool                write_coalescing_ = false;
+    
+    // the threads that dispatch IO events of the shared poll, see setIOThreads
+    uint32_t            io_thread_count_ = 0;
+    std::vector<std::thread> io_threads_;
+    std::atomic<uint32_t> io_threads_running_{ 0 };
+    // the IO threads blocked in sync, their callbacks are not waited by unregisterFd
+    LockType            sync_mutex_;
+    std::vector<std::thread::id> sync_io_threads_;
 };
 using EventLoopPtr = std::shared_ptr<EventLoop::Impl>;
 using EventLoopWeakPtr = std::weak_ptr<EventLoop::Impl>;
@@ -158,8 +313,7 @@ public:
     void eventLoop(const EventLoopPtr &loop);
     EventLoopPtr eventLoop();
     
-    void appendTaskNode(TaskNodePtr &node);
-    void removeTaskNode(TaskNodePtr &node);
+    void appendTaskNodes(TaskNodePtr first, size_t count);
     
     bool expired();
     void reset();
@@ -168,8 +322,9 @@ protected:
     friend class EventLoop::Impl;
     EventLoopWeakPtr loop_;
     
-    // task_nodes_ is protected by EventLoop task_mutex_
-    std::list<TaskNodePtr> task_nodes_;
+    // the nodes of tasks scheduled with this token, each holds one reference
+    std::mutex task_mutex_;
+    std::vector<TaskNodePtr> task_nodes_;
     
     bool observed = false;
     ObserverToken obs_token_;
@@ -0,0 +1,177 @@
+/* Copyright (c) 2014, Fengping Bao <jamol@live.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "kmconf.h"
+
+#ifdef KUMA_OS_LINUX
+# include <unistd.h>
+# include <time.h>
+# include <sys/timerfd.h>
+#endif
+
+#include "HighResTimerImpl.h"
+#include "util/kmtrace.h"
+
+using namespace kuma;
+
+#ifdef KUMA_OS_LINUX
+
+HighResTimer::Impl::Impl(const EventLoopPtr &loop)
+: loop_(loop)
+{
+    KM_SetObjKey("HighResTimer");
+    loop_token_.eventLoop(loop);
+    timer_fd_ = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (INVALID_FD == timer_fd_) {
+        KUMA_ERRXTRACE("HighResTimer, timerfd_create failed, err="<<errno);
+        return;
+    }
+    auto ret = loop->registerFd(timer_fd_, KUMA_EV_READ, [this] (KMEvent, void*, size_t) {
+        onTimerEvent();
+    });
+    if (ret != KMError::NOERR) {
+        KUMA_ERRXTRACE("HighResTimer, failed to register timerfd, err="<<int(ret));
+        closeFd(timer_fd_);
+        timer_fd_ = INVALID_FD;
+    }
+}
+
+HighResTimer::Impl::~Impl()
+{
+    loop_token_.reset();
+    if (INVALID_FD == timer_fd_) {
+        return;
+    }
+    cancel();
+    auto loop = loop_.lock();
+    if (!loop || loop->unregisterFd(timer_fd_, true) != KMError::NOERR) {
+        closeFd(timer_fd_);
+    }
+    timer_fd_ = INVALID_FD;
+}
+
+bool HighResTimer::Impl::schedule(uint32_t delay_us, TimerMode mode, TimerCallback cb)
+{
+    if (INVALID_FD == timer_fd_) {
+        return false;
+    }
+    auto loop = loop_.lock();
+    if (!loop) {
+        return false;
+    }
+    if (loop->inSameThread()) {
+        return schedule_i(delay_us, mode, std::move(cb));
+    }
+    auto ret = loop->async([this, delay_us, mode, cb=std::move(cb)] () mutable {
+        schedule_i(delay_us, mode, std::move(cb));
+    }, &loop_token_);
+    return ret == KMError::NOERR;
+}
+
+void HighResTimer::Impl::cancel()
+{
+    if (INVALID_FD == timer_fd_) {
+        return;
+    }
+    auto loop = loop_.lock();
+    if (loop && !loop->inSameThread()) {
+        // wait for the running callback to return
+        if (loop->sync([this] { cancel_i(); }) == KMError::NOERR) {
+            return;
+        }
+    }
+    cancel_i();
+}
+
+bool HighResTimer::Impl::schedule_i(uint32_t delay_us, TimerMode mode, TimerCallback cb)
+{
+    struct itimerspec its = {};
+    its.it_value.tv_sec = delay_us / 1000000;
+    its.it_value.tv_nsec = (delay_us % 1000000) * 1000;
+    if (0 == delay_us) {
+        its.it_value.tv_nsec = 1; // zero it_value disarms the timer
+    }
+    repeating_ = mode == TimerMode::REPEATING;
+    if (repeating_) {
+        its.it_interval = its.it_value;
+    }
+    ++seq_;
+    cb_ = std::move(cb);
+    if (::timerfd_settime(timer_fd_, 0, &its, nullptr) != 0) {
+        KUMA_ERRXTRACE("schedule, timerfd_settime failed, err="<<errno);
+        cb_ = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void HighResTimer::Impl::cancel_i()
+{
+    ++seq_;
+    struct itimerspec its = {};
+    ::timerfd_settime(timer_fd_, 0, &its, nullptr);
+    cb_ = nullptr;
+}
+
+void HighResTimer::Impl::onTimerEvent()
+{
+    uint64_t expirations = 0;
+    if (::read(timer_fd_, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return; // stale event, the timer was rescheduled or canceled
+    }
+    if (!cb_) {
+        return;
+    }
+    // the callback may reschedule, cancel or destroy this timer
+    auto seq = seq_;
+    TimerCallback cb(std::move(cb_));
+    DESTROY_DETECTOR_SETUP();
+    cb();
+    DESTROY_DETECTOR_CHECK_VOID();
+    if (repeating_ && seq == seq_) {
+        cb_ = std::move(cb);
+    }
+}
+
+#else // KUMA_OS_LINUX
+
+HighResTimer::Impl::Impl(const EventLoopPtr &loop)
+: timer_(loop->getTimerMgr())
+{
+    KM_SetObjKey("HighResTimer");
+}
+
+HighResTimer::Impl::~Impl()
+{
+    
+}
+
+bool HighResTimer::Impl::schedule(uint32_t delay_us, TimerMode mode, TimerCallback cb)
+{
+    return timer_.schedule((delay_us + 999) / 1000, 0, mode, std::move(cb));
+}
+
+void HighResTimer::Impl::cancel()
+{
+    timer_.cancel();
+}
+
+#endif // KUMA_OS_LINUX
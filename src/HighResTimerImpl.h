@@ -0,0 +1,67 @@
+/* Copyright (c) 2014, Fengping Bao <jamol@live.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __HighResTimerImpl_H__
+#define __HighResTimerImpl_H__
+
+#include "kmdefs.h"
+#include "kmapi.h"
+#include "evdefs.h"
+#include "EventLoopImpl.h"
+#include "TimerManager.h"
+#include "util/kmobject.h"
+#include "util/DestroyDetector.h"
+
+KUMA_NS_BEGIN
+
+class HighResTimer::Impl : public KMObject, public DestroyDetector
+{
+public:
+    using TimerCallback = HighResTimer::TimerCallback;
+    
+    Impl(const EventLoopPtr &loop);
+    ~Impl();
+    
+    bool schedule(uint32_t delay_us, TimerMode mode, TimerCallback cb);
+    void cancel();
+    
+#ifdef KUMA_OS_LINUX
+private:
+    bool schedule_i(uint32_t delay_us, TimerMode mode, TimerCallback cb);
+    void cancel_i();
+    void onTimerEvent();
+    
+private:
+    EventLoopWeakPtr    loop_;
+    SOCKET_FD           timer_fd_ = INVALID_FD;
+    TimerCallback       cb_;
+    bool                repeating_ = false;
+    uint32_t            seq_ = 0; // increased on every schedule and cancel
+    EventLoopToken      loop_token_;
+#else
+private:
+    Timer::Impl         timer_;
+#endif
+};
+
+KUMA_NS_END
+
+#endif
@@ -0,0 +1,137 @@
+/* Copyright (c) 2014, Fengping Bao <jamol@live.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "kmconf.h"
+
+#include "LoopWatchdog.h"
+#include "util/kmtrace.h"
+
+#include <algorithm>
+
+using namespace kuma;
+
+CallbackTracker::CallbackTracker(const std::string &loop_key)
+{
+    objKey_ = loop_key;
+}
+
+void CallbackTracker::setThreshold(uint32_t threshold_ms)
+{
+    threshold_ms_.store(threshold_ms, std::memory_order_relaxed);
+    threshold_ns_.store(threshold_ms > 0 ? int64_t(threshold_ms) * 1000000 : INT64_MAX,
+                        std::memory_order_relaxed);
+}
+
+void CallbackTracker::check(int64_t now_ns)
+{
+    auto start_ns = start_ns_.load(std::memory_order_acquire);
+    if (0 == start_ns || start_ns == reported_start_ns_) {
+        return;
+    }
+    auto elapsed_ns = now_ns - start_ns;
+    if (elapsed_ns < threshold_ns_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    auto type = type_.load(std::memory_order_relaxed);
+    auto id = id_.load(std::memory_order_relaxed);
+    if (start_ns_.load(std::memory_order_acquire) != start_ns) {
+        return; // the callback has completed
+    }
+    reported_start_ns_ = start_ns;
+    report("callback is blocking the loop", type, id, elapsed_ns);
+}
+
+void CallbackTracker::report(const char *msg, Type type, intptr_t id, int64_t elapsed_ns)
+{
+    auto elapsed_ms = elapsed_ns / 1000000;
+    switch (type) {
+        case Type::IO:
+            KUMA_WARNXTRACE(msg<<", IO, fd="<<id<<", elapsed="<<elapsed_ms<<"ms");
+            break;
+        case Type::TASK:
+            KUMA_WARNXTRACE(msg<<", task, elapsed="<<elapsed_ms<<"ms");
+            break;
+        case Type::TIMER:
+            KUMA_WARNXTRACE(msg<<", timer="<<(void*)id<<", elapsed="<<elapsed_ms<<"ms");
+            break;
+        default:
+            break;
+    }
+}
+
+LoopWatchdog::~LoopWatchdog()
+{
+    {
+        std::lock_guard<std::mutex> g(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_one();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+LoopWatchdog& LoopWatchdog::instance()
+{
+    static LoopWatchdog s_watchdog;
+    return s_watchdog;
+}
+
+void LoopWatchdog::addTracker(CallbackTracker *tracker)
+{
+    std::lock_guard<std::mutex> g(mutex_);
+    if (std::find(trackers_.begin(), trackers_.end(), tracker) == trackers_.end()) {
+        trackers_.push_back(tracker);
+    }
+    if (!thread_.joinable()) {
+        thread_ = std::thread([this] { run(); });
+    }
+    cv_.notify_one();
+}
+
+void LoopWatchdog::removeTracker(CallbackTracker *tracker)
+{
+    // the tracker will not be accessed after this call since check runs with lock held
+    std::lock_guard<std::mutex> g(mutex_);
+    trackers_.erase(std::remove(trackers_.begin(), trackers_.end(), tracker), trackers_.end());
+}
+
+void LoopWatchdog::run()
+{
+    std::unique_lock<std::mutex> lk(mutex_);
+    while (!stop_) {
+        if (trackers_.empty()) {
+            cv_.wait(lk, [this] { return stop_ || !trackers_.empty(); });
+            continue;
+        }
+        // check 4 times in the minimum threshold, but not more than once per millisecond
+        uint32_t interval_ms = UINT32_MAX;
+        for (auto tracker : trackers_) {
+            interval_ms = std::min(interval_ms, tracker->getThreshold() / 4);
+        }
+        interval_ms = std::max<uint32_t>(interval_ms, 1);
+        cv_.wait_for(lk, std::chrono::milliseconds(interval_ms));
+        auto now_ns = CallbackTracker::nowNs();
+        for (auto tracker : trackers_) {
+            tracker->check(now_ns);
+        }
+    }
+}
@@ -0,0 +1,125 @@
+/* Copyright (c) 2014, Fengping Bao <jamol@live.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __LoopWatchdog_H__
+#define __LoopWatchdog_H__
+
+#include "kmdefs.h"
+#include "util/kmobject.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+KUMA_NS_BEGIN
+
+/**
+ * CallbackTracker records the callback that is running on the loop, it is written by
+ * loop thread and read by the watchdog thread. the loop only touches it when watchdog
+ * is enabled
+ */
+class CallbackTracker : public KMObject
+{
+public:
+    enum class Type : int {
+        IDLE,
+        IO,
+        TASK,
+        TIMER
+    };
+    
+    CallbackTracker(const std::string &loop_key);
+    
+    void setThreshold(uint32_t threshold_ms);
+    uint32_t getThreshold() const { return threshold_ms_.load(std::memory_order_relaxed); }
+    
+    void enter(Type type, intptr_t id)
+    {
+        type_.store(type, std::memory_order_relaxed);
+        id_.store(id, std::memory_order_relaxed);
+        start_ns_.store(nowNs(), std::memory_order_release);
+    }
+    
+    void leave()
+    {
+        auto start_ns = start_ns_.load(std::memory_order_relaxed);
+        start_ns_.store(0, std::memory_order_relaxed);
+        auto elapsed_ns = nowNs() - start_ns;
+        if (elapsed_ns >= threshold_ns_.load(std::memory_order_relaxed)) {
+            report("slow callback", type_.load(std::memory_order_relaxed),
+                   id_.load(std::memory_order_relaxed), elapsed_ns);
+        }
+    }
+    
+    // called on watchdog thread
+    void check(int64_t now_ns);
+    
+    static int64_t nowNs()
+    {
+        using namespace std::chrono;
+        return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+    
+protected:
+    void report(const char *msg, Type type, intptr_t id, int64_t elapsed_ns);
+    
+protected:
+    std::atomic<int64_t>    start_ns_{ 0 }; // 0 if no callback is running
+    std::atomic<Type>       type_{ Type::IDLE };
+    std::atomic<intptr_t>   id_{ 0 }; // fd of IO callback, or timer
+    std::atomic<uint32_t>   threshold_ms_{ 0 };
+    std::atomic<int64_t>    threshold_ns_{ INT64_MAX };
+    int64_t                 reported_start_ns_{ 0 }; // accessed on watchdog thread only
+};
+
+/**
+ * LoopWatchdog runs a thread to check the callbacks running on the loops,
+ * and reports the callback that is still running after the threshold
+ */
+class LoopWatchdog
+{
+public:
+    ~LoopWatchdog();
+    
+    static LoopWatchdog& instance();
+    
+    void addTracker(CallbackTracker *tracker);
+    void removeTracker(CallbackTracker *tracker);
+    
+protected:
+    LoopWatchdog() = default;
+    void run();
+    
+protected:
+    std::mutex                      mutex_;
+    std::condition_variable         cv_;
+    std::vector<CallbackTracker*>   trackers_;
+    std::thread                     thread_;
+    bool                            stop_{ false };
+};
+
+KUMA_NS_END
+
+#endif
@@ -21,6 +21,7 @@
 
 #include "SocketBase.h"
 #include "util/kmtrace.h"
+#include "util/util.h"
 
 #if defined(KUMA_OS_WIN)
 # include <Ws2tcpip.h>
@@ -42,6 +43,10 @@
 # ifdef KUMA_OS_ANDROID
 #  include <sys/uio.h>
 # endif
+# include <sys/sendfile.h>
+# ifdef KUMA_HAS_ZEROCOPY
+#  include <linux/errqueue.h>
+# endif
 #elif defined(KUMA_OS_MAC)
 # include <string.h>
 # include <pthread.h>
@@ -61,6 +66,8 @@
 # error "UNSUPPORTED OS"
 #endif
 
+#include <algorithm>
+
 using namespace kuma;
 
 SocketBase::SocketBase(const EventLoopPtr &loop)
@@ -88,8 +95,21 @@ void SocketBase::cleanup()
         SOCKET_FD fd = fd_;
         fd_ = INVALID_FD;
         shutdown(fd, 2);
+#ifdef KUMA_HAS_ZEROCOPY
+        if (!zc_sends_.empty()) {
+            reapZeroCopy(fd);
+        } else {
+            unregisterFd(fd, true);
+        }
+#else
         unregisterFd(fd, true);
+#endif
     }
+#ifdef KUMA_HAS_ZEROCOPY
+    zc_sends_.clear();
+    zc_next_id_ = 0;
+    zc_enabled_ = false;
+#endif
 }
 
 SOCKET_FD SocketBase::createFd(int addr_family)
@@ -137,13 +157,15 @@ KMError SocketBase::connect(const std::string &host, uint16_t port, EventCallbac
     }
     connect_cb_ = std::move(cb);
     if (timeout_ms > 0 && timeout_ms != uint32_t(-1)) {
-        timer_.schedule(timeout_ms, TimerMode::ONE_SHOT, [this]() {
-            onConnect(KMError::TIMEOUT);
+        timer_.schedule(timeout_ms, 0, TimerMode::ONE_SHOT, [this]() {
+            onConnectTimeout();
         });
     }
     if (!km_is_ip_address(host.c_str())) {
         sockaddr_storage ss_addr = { 0 };
-        if (DnsResolver::get().getAddress(host, ss_addr) == KMError::NOERR) {
+        auto loop = eventLoop();
+        auto now = loop ? loop->now() : std::chrono::steady_clock::now();
+        if (DnsResolver::get().getAddress(host, ss_addr, now) == KMError::NOERR) {
             return connect_i(ss_addr, timeout_ms);
         }
         setState(RESOLVING);
@@ -220,7 +242,7 @@ KMError SocketBase::connect_i(const sockaddr_storage &ss_addr, uint32_t timeout_
     return KMError::NOERR;
 }
 
-KMError SocketBase::attachFd(SOCKET_FD fd)
+KMError SocketBase::attachFd(SOCKET_FD fd, uint32_t flags)
 {
     if (getState() != State::IDLE) {
         KUMA_ERRXTRACE("attachFd, invalid state, fd="<<fd<<", state=" << getState());
@@ -229,7 +251,7 @@ KMError SocketBase::attachFd(SOCKET_FD fd)
     KUMA_INFOXTRACE("attachFd, fd=" << fd << ", state=" << getState());
 
     fd_ = fd;
-    setSocketOption();
+    setSocketOption(flags);
     setState(State::OPEN);
     registerFd(fd_);
     return KMError::NOERR;
@@ -246,6 +268,28 @@ KMError SocketBase::detachFd(SOCKET_FD &fd)
     return KMError::NOERR;
 }
 
+KMError SocketBase::migrate(const EventLoopPtr &loop)
+{
+    if (!isReady()) {
+        return KMError::INVALID_STATE;
+    }
+    KUMA_INFOXTRACE("migrate, fd=" << fd_);
+    // the timer is only used by connecting, it stays with the previous loop
+    timer_.cancel();
+    unregisterFd(fd_, false);
+    loop_ = loop;
+    return KMError::NOERR;
+}
+
+KMError SocketBase::onMigrated()
+{
+    // on the thread of new loop, the fd is reported ready again if there is input or send space
+    if (!isReady()) {
+        return KMError::INVALID_STATE;
+    }
+    return registerFd(fd_) ? KMError::NOERR : KMError::FAILED;
+}
+
 bool SocketBase::registerFd(SOCKET_FD fd)
 {
     auto loop = loop_.lock();
@@ -366,6 +410,22 @@ int SocketBase::send(const iovec* iovs, int count)
 
 int SocketBase::send(const KMBuffer &buf)
 {
+#ifdef KUMA_HAS_ZEROCOPY
+    if (zc_threshold_ > 0 && isReady() && buf.chainLength() >= zc_threshold_ && buf.isShared()) {
+        if (!zc_enabled_) {
+            int opt_val = 1;
+            if (setsockopt(fd_, SOL_SOCKET, SO_ZEROCOPY, &opt_val, sizeof(opt_val)) == 0) {
+                zc_enabled_ = true;
+            } else {
+                KUMA_WARNXTRACE("send, failed to set SO_ZEROCOPY, err=" << getLastError());
+                zc_threshold_ = 0;
+            }
+        }
+        if (zc_enabled_) {
+            return sendZeroCopy(buf);
+        }
+    }
+#endif
     IOVEC iovs;
     buf.fillIov(iovs);
     if (iovs.empty()) {
@@ -374,6 +434,262 @@ int SocketBase::send(const KMBuffer &buf)
     return send(&iovs[0], static_cast<int>(iovs.size()));
 }
 
+#if defined(KUMA_OS_LINUX) || defined(KUMA_OS_MAC)
+// the errors of sendfile caused by file_fd, the socket is still good
+static bool is_file_error(int err)
+{
+    switch (err) {
+        case EBADF:
+        case EINVAL:
+        case EIO:
+        case EOVERFLOW:
+        case ESPIPE:
+        case ENXIO:
+        case ENOMEM:
+            return true;
+        default:
+            return false;
+    }
+}
+#endif
+
+int SocketBase::sendFile(int file_fd, int64_t offset, size_t length)
+{
+    if (!isReady()) {
+        KUMA_WARNXTRACE("sendFile, invalid state=" << getState());
+        return 0;
+    }
+    if (0 == length) {
+        return 0;
+    }
+    // the return value is int
+    length = std::min<size_t>(length, 0x7ffff000);
+
+    int ret = 0;
+#if defined(KUMA_OS_LINUX)
+    off_t off = static_cast<off_t>(offset);
+    ret = (int)::sendfile(fd_, file_fd, &off, length);
+#elif defined(KUMA_OS_MAC)
+    off_t bytes_sent = static_cast<off_t>(length);
+    ret = ::sendfile(file_fd, fd_, static_cast<off_t>(offset), &bytes_sent, NULL, 0);
+    if (0 == ret || (EAGAIN == getLastError() && bytes_sent > 0)) {
+        ret = static_cast<int>(bytes_sent);
+    }
+#else
+    // no sendfile, read the file in blocks
+    const size_t kFileBlockSize = 64*1024;
+    KMBuffer buf(std::min(length, kFileBlockSize));
+    int nread = read_file(file_fd, buf.writePtr(), buf.space(), offset);
+    if (nread <= 0) {
+        KUMA_ERRXTRACE("sendFile, failed to read file, offset=" << offset << ", err=" << errno);
+        return -1;
+    }
+    buf.bytesWritten(nread);
+    return send(buf.readPtr(), nread);
+#endif
+    if (0 == ret) {
+        // sendfile returns 0 at the end of file, the socket is still good
+        KUMA_ERRXTRACE("sendFile, reached end of file, offset=" << offset);
+        return -1;
+    }
+    else if (ret < 0) {
+        if (EAGAIN == getLastError() || EWOULDBLOCK == getLastError()) {
+            ret = 0;
+        }
+        else if (is_file_error(getLastError())) {
+            KUMA_ERRXTRACE("sendFile, file error, offset=" << offset << ", err=" << getLastError());
+            return -1;
+        }
+        else {
+            KUMA_ERRXTRACE("sendFile, failed, err=" << getLastError());
+        }
+    }
+
+    if (ret >= 0 && static_cast<size_t>(ret) < length) {
+        notifySendBlocked();
+    } else if (ret < 0) {
+        cleanup();
+        setState(State::CLOSED);
+    }
+    return ret;
+}
+
+#ifdef KUMA_HAS_ZEROCOPY
+int SocketBase::sendZeroCopy(const KMBuffer &buf)
+{
+    IOVEC iovs;
+    buf.fillIov(iovs);
+    if (iovs.empty()) {
+        return 0;
+    }
+    msghdr msg = { 0 };
+    msg.msg_iov = &iovs[0];
+    msg.msg_iovlen = iovs.size();
+    int ret = (int)::sendmsg(fd_, &msg, MSG_ZEROCOPY);
+    if (ret < 0 && ENOBUFS == getLastError()) {
+        // too many notifications are pending, send by copy
+        return send(&iovs[0], static_cast<int>(iovs.size()));
+    }
+    if (0 == ret) {
+        KUMA_WARNXTRACE("sendZeroCopy, peer closed");
+        ret = -1;
+    }
+    else if (ret < 0) {
+        if (EAGAIN == getLastError() || EWOULDBLOCK == getLastError()) {
+            ret = 0;
+        }
+        else {
+            KUMA_ERRXTRACE("sendZeroCopy, fail, err=" << getLastError());
+        }
+    }
+
+    if (ret > 0) {
+        // each successful sendmsg takes one notification id
+        zc_sends_.push_back({zc_next_id_++, KMBuffer::Ptr(buf.subbuffer(0, ret)), false});
+    }
+    if (ret >= 0 && static_cast<size_t>(ret) < buf.chainLength()) {
+        notifySendBlocked();
+    } else if (ret < 0) {
+        cleanup();
+        setState(State::CLOSED);
+    }
+    return ret;
+}
+
+bool SocketBase::readZeroCopyCompletions(SOCKET_FD fd, ZeroCopySends &sends, bool &copied)
+{
+    bool completed = false;
+    while (true) {
+        char control[128];
+        msghdr msg = { 0 };
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (::recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) {
+            break; // the error queue is drained
+        }
+        for (auto *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+                !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            auto *serr = reinterpret_cast<sock_extended_err*>(CMSG_DATA(cmsg));
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                copied = true;
+            }
+            completeZeroCopy(sends, serr->ee_info, serr->ee_data);
+            completed = true;
+        }
+    }
+    return completed;
+}
+
+void SocketBase::completeZeroCopy(ZeroCopySends &sends, uint32_t lo, uint32_t hi)
+{
+    // the range may wrap around
+    for (auto &zc : sends) {
+        if (zc.id - lo <= hi - lo) {
+            zc.done = true;
+        }
+    }
+    while (!sends.empty() && sends.front().done) {
+        sends.pop_front();
+    }
+}
+
+static void abort_connection(SOCKET_FD fd)
+{
+    // the unsent data is dropped by RST, the kernel releases the pages of pending sends
+    linger lg = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    closeFd(fd);
+}
+
+/**
+ * ZeroCopyReaper holds the closed fd and the storages of its pending zero-copy sends.
+ * the kernel may still transmit or retransmit from the pages after close, so the storages
+ * are released after the completions are read from the error queue
+ */
+class SocketBase::ZeroCopyReaper : public PendingObject
+{
+public:
+    ZeroCopyReaper(const EventLoopPtr &loop, SOCKET_FD fd, ZeroCopySends &&sends)
+        : loop_(loop), timer_(loop->getTimerMgr()), fd_(fd), sends_(std::move(sends))
+    {
+    }
+
+    void start()
+    {
+        loop_.lock()->appendPendingObject(this);
+        timer_.schedule(kPollIntervalMs, 0, TimerMode::REPEATING, [this] { onTimer(); });
+    }
+
+    bool isPending() const override
+    {
+        return !sends_.empty();
+    }
+
+    void onLoopExit() override
+    {
+        // loop exited, no more timer
+        abort_connection(fd_);
+        delete this;
+    }
+
+private:
+    void onTimer()
+    {
+        bool copied = false;
+        readZeroCopyCompletions(fd_, sends_, copied);
+        if (!sends_.empty() && ++polls_ < kMaxPolls) {
+            return;
+        }
+        if (sends_.empty()) {
+            closeFd(fd_);
+        } else {
+            KUMA_WARNTRACE("ZeroCopyReaper, completions timeout, fd=" << fd_ << ", pending=" << sends_.size());
+            abort_connection(fd_);
+        }
+        auto loop = loop_.lock();
+        if (loop) {
+            loop->removePendingObject(this);
+        }
+        delete this;
+    }
+
+private:
+    static const uint32_t kPollIntervalMs = 100;
+    static const uint32_t kMaxPolls = 600; // the peer is not acking for 1 minute
+
+    EventLoopWeakPtr    loop_;
+    Timer::Impl         timer_;
+    SOCKET_FD           fd_;
+    ZeroCopySends       sends_;
+    uint32_t            polls_ = 0;
+};
+
+void SocketBase::reapZeroCopy(SOCKET_FD fd)
+{
+    unregisterFd(fd, false);
+    bool copied = false;
+    readZeroCopyCompletions(fd, zc_sends_, copied);
+    if (zc_sends_.empty()) {
+        closeFd(fd);
+        return;
+    }
+    auto loop = loop_.lock();
+    if (loop && loop->inSameThread() && !loop->stopped()) {
+        auto *reaper = new ZeroCopyReaper(loop, fd, std::move(zc_sends_));
+        reaper->start();
+    } else {
+        // the completions cannot be waited
+        abort_connection(fd);
+    }
+}
+#endif
+
 int SocketBase::receive(void* data, size_t length)
 {
     if (!isReady()) {
@@ -427,6 +743,16 @@ KMError SocketBase::close()
     return KMError::NOERR;
 }
 
+KMError SocketBase::setZeroCopy(size_t threshold)
+{
+#ifdef KUMA_HAS_ZEROCOPY
+    zc_threshold_ = threshold;
+    return KMError::NOERR;
+#else
+    return threshold > 0 ? KMError::NOT_SUPPORTED : KMError::NOERR;
+#endif
+}
+
 KMError SocketBase::pause()
 {
     auto loop = loop_.lock();
@@ -445,18 +771,22 @@ KMError SocketBase::resume()
     return KMError::INVALID_STATE;
 }
 
-void SocketBase::setSocketOption()
+void SocketBase::setSocketOption(uint32_t flags)
 {
     if (INVALID_FD == fd_) {
         return;
     }
 
 #ifdef KUMA_OS_LINUX
-    fcntl(fd_, F_SETFD, FD_CLOEXEC);
-#endif
-
+    // the fd from accept4 is nonblocking and close-on-exec already
+    if (!(flags & ATTACH_FLAG_ACCEPTED)) {
+        fcntl(fd_, F_SETFD, FD_CLOEXEC);
+        set_nonblocking(fd_);
+    }
+#else
     // nonblock
     set_nonblocking(fd_);
+#endif
 
     if (0) {
         int opt_val = 1;
@@ -522,6 +852,21 @@ void SocketBase::onConnect(KMError err)
     if (connect_cb) connect_cb(err);
 }
 
+void SocketBase::onConnectTimeout()
+{
+    auto loop = loop_.lock();
+    if (loop && registered_ && fd_ != INVALID_FD) {
+        // ioReady may be running on IO thread, the timeout is serialized with it
+        loop->runExclusive(fd_, [this] {
+            if (getState() == State::CONNECTING) {
+                onConnect(KMError::TIMEOUT);
+            }
+        });
+    } else {
+        onConnect(KMError::TIMEOUT);
+    }
+}
+
 void SocketBase::onSend(KMError err)
 {
     notifySendReady();
@@ -569,6 +914,23 @@ void SocketBase::ioReady(KMEvent events, void* ol, size_t io_size)
             onReceive(KMError::NOERR);
             DESTROY_DETECTOR_CHECK_VOID();
         }
+#ifdef KUMA_HAS_ZEROCOPY
+        if ((events & KUMA_EV_ERROR) && !zc_sends_.empty() && getState() == State::OPEN) {
+            // the completions of zero-copy sends are reported as EPOLLERR
+            int err = 0;
+            socklen_t len = sizeof(err);
+            bool copied = false;
+            if (readZeroCopyCompletions(fd_, zc_sends_, copied) &&
+                getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && 0 == err) {
+                events &= ~KUMA_EV_ERROR;
+            }
+            if (copied && zc_threshold_ > 0) {
+                // the kernel copied the data anyway, e.g. on loopback, the notifications are pure cost
+                KUMA_INFOXTRACE("ioReady, zero-copy data copied, zero-copy is disabled");
+                zc_threshold_ = 0;
+            }
+        }
+#endif
         if ((events & KUMA_EV_ERROR) && getState() == State::OPEN) {
             KUMA_ERRXTRACE("ioReady, KUMA_EV_ERROR on OPEN, events=" << events << ", err=" << getLastError());
             onClose(KMError::POLL_ERROR);
@@ -28,6 +28,12 @@
 #include "DnsResolver.h"
 #include "util/kmobject.h"
 #include "util/DestroyDetector.h"
+
+#include <deque>
+
+#if defined(KUMA_OS_LINUX) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+# define KUMA_HAS_ZEROCOPY
+#endif
 KUMA_NS_BEGIN
 
 class SocketBase : public KMObject, public DestroyDetector
@@ -40,15 +46,20 @@ public:
 
     KMError bind(const std::string &bind_host, uint16_t bind_port);
     KMError connect(const std::string &host, uint16_t port, EventCallback cb, uint32_t timeout_ms = 0);
-    virtual KMError attachFd(SOCKET_FD fd);
+    virtual KMError attachFd(SOCKET_FD fd, uint32_t flags = 0);
     virtual KMError detachFd(SOCKET_FD &fd);
+    virtual KMError migrate(const EventLoopPtr &loop);
+    virtual KMError onMigrated();
     virtual int send(const void* data, size_t length);
     virtual int send(const iovec* iovs, int count);
     virtual int send(const KMBuffer &buf);
+    virtual int sendFile(int file_fd, int64_t offset, size_t length);
     virtual int receive(void* data, size_t length);
     virtual KMError pause();
     virtual KMError resume();
     virtual KMError close();
+    // KMBuffer not less than threshold bytes is sent with MSG_ZEROCOPY, 0 to disable
+    KMError setZeroCopy(size_t threshold);
 
     virtual void notifySendBlocked();
     SOCKET_FD getFd() const { return fd_; }
@@ -69,7 +80,7 @@ protected:
     };
     State getState() const { return state_; }
     void setState(State state) { state_ = state; }
-    void setSocketOption();
+    void setSocketOption(uint32_t flags = 0);
     KMError connect_i(const std::string &addr, uint16_t port, uint32_t timeout_ms);
     virtual KMError connect_i(const sockaddr_storage &ss_addr, uint32_t timeout_ms);
     void cleanup();
@@ -83,10 +94,15 @@ protected:
 
     virtual void ioReady(KMEvent events, void* ol, size_t io_size);
     virtual void onConnect(KMError err);
+    void onConnectTimeout();
     virtual void onSend(KMError err);
     virtual void onReceive(KMError err);
     virtual void onClose(KMError err);
 
+#ifdef KUMA_HAS_ZEROCOPY
+    int sendZeroCopy(const KMBuffer &buf);
+#endif
+
 protected:
     SOCKET_FD           fd_{ INVALID_FD };
     EventLoopWeakPtr    loop_;
@@ -100,6 +116,25 @@ protected:
     EventCallback       error_cb_;
 
     Timer::Impl         timer_;
+
+#ifdef KUMA_HAS_ZEROCOPY
+    struct ZeroCopySend
+    {
+        uint32_t        id;
+        KMBuffer::Ptr   buf; // references the storage until the kernel completes the send
+        bool            done;
+    };
+    using ZeroCopySends = std::deque<ZeroCopySend>;
+    class ZeroCopyReaper;
+    static bool readZeroCopyCompletions(SOCKET_FD fd, ZeroCopySends &sends, bool &copied);
+    static void completeZeroCopy(ZeroCopySends &sends, uint32_t lo, uint32_t hi);
+    void reapZeroCopy(SOCKET_FD fd);
+
+    ZeroCopySends       zc_sends_;
+    size_t              zc_threshold_{ 0 };
+    uint32_t            zc_next_id_{ 0 };
+    bool                zc_enabled_{ false }; // SO_ZEROCOPY is set on fd_
+#endif
 };
 
 KUMA_NS_END
@@ -35,11 +35,20 @@ TcpConnection::TcpConnection(const EventLoopPtr &loop)
 
 TcpConnection::~TcpConnection()
 {
+    if (flush_queued_) {
+        auto loop = eventLoop();
+        if (loop) {
+            loop->sync([this, &loop] { loop->removeFlushIO(this); });
+        }
+    }
     send_buffer_.reset();
 }
 
 void TcpConnection::cleanup()
 {
+    if (flush_queued_) {
+        cancelFlush();
+    }
     tcp_.close();
 }
 
@@ -53,6 +62,8 @@ void TcpConnection::setupCallbacks()
     tcp_.setReadCallback([this] (KMError err) { onReceive(err); });
     tcp_.setWriteCallback([this] (KMError err) { onSend(err); });
     tcp_.setErrorCallback([this] (KMError err) { onClose(err); });
+    auto loop = eventLoop();
+    write_coalescing_ = loop && loop->writeCoalescing();
 }
 
 KMError TcpConnection::connect(const std::string &host, uint16_t port)
@@ -92,8 +103,38 @@ KMError TcpConnection::attachSocket(TcpSocket::Impl &&tcp, const KMBuffer *init_
     return tcp_.attach(std::move(tcp));
 }
 
+KMError TcpConnection::migrate(const EventLoopPtr &loop, TcpSocket::EventCallback cb)
+{
+    auto old_loop = eventLoop();
+    if (old_loop && !old_loop->inSameThread()) {
+        KMError ret = KMError::INVALID_STATE;
+        auto err = old_loop->sync([&ret, &loop, &cb, this] {
+            ret = migrate(loop, std::move(cb));
+        });
+        return err == KMError::NOERR ? ret : err;
+    }
+    // the output is written at once till the socket is moved, the flush list is per loop
+    if (flush_queued_) {
+        cancelFlush();
+    }
+    write_coalescing_ = false;
+    // the send buffer and init data go with the connection, they are
+    // flushed and handled by the write and read events on the new loop
+    return tcp_.migrate(loop, [this, cb=std::move(cb)] (KMError err) {
+        auto loop = eventLoop();
+        write_coalescing_ = loop && loop->writeCoalescing();
+        if (cb) cb(err);
+    });
+}
+
 int TcpConnection::send(const void *data, size_t len)
 {
+    iovec iov;
+    iov.iov_base = (char*)data;
+    iov.iov_len = len;
+    if (deferSend(&iov, 1)) {
+        return int(len);
+    }
     if(!sendBufferEmpty()) {
         // try to send buffered data
         auto ret = sendBufferedData();
@@ -118,6 +159,13 @@ int TcpConnection::send(const void *data, size_t len)
 
 int TcpConnection::send(const iovec *iovs, int count)
 {
+    if (deferSend(iovs, count)) {
+        size_t total_len = 0;
+        for (int i=0; i<count; ++i) {
+            total_len += iovs[i].iov_len;
+        }
+        return int(total_len);
+    }
     if(!sendBufferEmpty()) {
         // try to send buffered data
         auto ret = sendBufferedData();
@@ -155,6 +203,13 @@ int TcpConnection::send(const iovec *iovs, int count)
 
 int TcpConnection::send(const KMBuffer &buf)
 {
+    if (write_coalescing_) {
+        IOVEC iovs;
+        buf.fillIov(iovs);
+        if (!iovs.empty() && deferSend(&iovs[0], static_cast<int>(iovs.size()))) {
+            return (int)buf.chainLength();
+        }
+    }
     if(!sendBufferEmpty()) {
         // try to send buffered data
         auto ret = sendBufferedData();
@@ -180,6 +235,23 @@ int TcpConnection::send(const KMBuffer &buf)
     return ret;
 }
 
+int TcpConnection::sendFile(int file_fd, int64_t offset, size_t length)
+{
+    // the output queued before goes first
+    if (flush_queued_) {
+        cancelFlush();
+    }
+    if(!sendBufferEmpty()) {
+        auto ret = sendBufferedData();
+        if (ret != KMError::NOERR) {
+            return -1;
+        } else if (!sendBufferEmpty()) {
+            return 0;
+        }
+    }
+    return tcp_.sendFile(file_fd, offset, length);
+}
+
 KMError TcpConnection::close()
 {
     //KUMA_INFOXTRACE("close");
@@ -203,6 +275,94 @@ KMError TcpConnection::sendBufferedData()
     return KMError::NOERR;
 }
 
+KMError TcpConnection::sendOrBuffer(const KMBuffer &buf)
+{
+    if (write_coalescing_) {
+        IOVEC iovs;
+        buf.fillIov(iovs);
+        if (!iovs.empty() && deferSend(&iovs[0], static_cast<int>(iovs.size()))) {
+            return KMError::NOERR;
+        }
+    }
+    appendSendBuffer(buf);
+    return sendBufferedData();
+}
+
+bool TcpConnection::deferSend(const iovec *iovs, int count)
+{
+    // the large writes and the writes after the socket is blocked are not deferred
+    static const size_t kMaxFlushBytes = 64*1024;
+    static const size_t kLargeWriteBytes = 16*1024;
+    if (!write_coalescing_ || !sendBufferEmpty()) {
+        return false;
+    }
+    size_t total_len = 0;
+    for (int i=0; i<count; ++i) {
+        total_len += iovs[i].iov_len;
+    }
+    if (total_len >= kLargeWriteBytes || flush_buffer_.size() + total_len > kMaxFlushBytes) {
+        // keep the order, the queued output goes first
+        if (sendFlushBuffer() != KMError::NOERR) {
+            return false;
+        }
+        if (total_len >= kLargeWriteBytes || !sendBufferEmpty()) {
+            return false;
+        }
+    }
+    if (!flush_queued_) {
+        auto loop = eventLoop();
+        if (!loop || !loop->inSameThread()) {
+            return false;
+        }
+        loop->appendFlushIO(this);
+    }
+    for (int i=0; i<count; ++i) {
+        auto *p = static_cast<const uint8_t*>(iovs[i].iov_base);
+        flush_buffer_.insert(flush_buffer_.end(), p, p + iovs[i].iov_len);
+    }
+    return true;
+}
+
+KMError TcpConnection::sendFlushBuffer()
+{
+    if (flush_buffer_.empty()) {
+        return KMError::NOERR;
+    }
+    int ret = tcp_.send(flush_buffer_.data(), flush_buffer_.size());
+    if (ret < 0) {
+        flush_buffer_.clear();
+        return KMError::SOCK_ERROR;
+    }
+    if (static_cast<size_t>(ret) < flush_buffer_.size()) {
+        KMBuffer buf(flush_buffer_.data() + ret, flush_buffer_.size() - ret, flush_buffer_.size() - ret);
+        appendSendBuffer(buf);
+    }
+    flush_buffer_.clear();
+    return KMError::NOERR;
+}
+
+void TcpConnection::cancelFlush()
+{
+    // write the queued output at once
+    auto loop = eventLoop();
+    if (loop && !loop->inSameThread()) {
+        loop->sync([this] { cancelFlush(); });
+        return;
+    }
+    if (loop) {
+        loop->removeFlushIO(this);
+    }
+    sendFlushBuffer();
+}
+
+void TcpConnection::onFlush()
+{
+    if (sendFlushBuffer() != KMError::NOERR) {
+        cleanup();
+        onError(KMError::SOCK_ERROR);
+    }
+}
+
 void TcpConnection::appendSendBuffer(const KMBuffer &buf)
 {
     if (send_buffer_) {
@@ -214,6 +374,13 @@ void TcpConnection::appendSendBuffer(const KMBuffer &buf)
 
 void TcpConnection::reset()
 {
+    if (flush_queued_) {
+        auto loop = eventLoop();
+        if (loop) {
+            loop->removeFlushIO(this);
+        }
+    }
+    flush_buffer_.clear();
     send_buffer_.reset();
     initData_.clear();
 }
@@ -28,7 +28,7 @@
 
 KUMA_NS_BEGIN
 
-class TcpConnection
+class TcpConnection : public FlushIO
 {
 public:
     TcpConnection(const EventLoopPtr &loop);
@@ -40,9 +40,12 @@ public:
     KMError connect(const std::string &host, uint16_t port);
     KMError attachFd(SOCKET_FD fd, const KMBuffer *init_buf);
     KMError attachSocket(TcpSocket::Impl &&tcp, const KMBuffer *init_buf);
+    KMError migrate(const EventLoopPtr &loop, TcpSocket::EventCallback cb = nullptr);
     int send(const void* data, size_t len);
     int send(const iovec* iovs, int count);
     int send(const KMBuffer &buf);
+    // unlike send, the rest is not buffered, it should be sent again in onWrite
+    int sendFile(int file_fd, int64_t offset, size_t length);
     KMError close();
     
 #ifdef KUMA_HAS_OPENSSL
@@ -64,15 +67,22 @@ protected:
     bool sendBufferEmpty() const { return !send_buffer_ || send_buffer_->empty(); }
     KMError sendBufferedData();
     void appendSendBuffer(const KMBuffer &buf);
+    // send buf at the end of loop iteration if write coalescing is enabled, or at once,
+    // the rest is buffered if the socket is blocked
+    KMError sendOrBuffer(const KMBuffer &buf);
     void reset();
     
 private:
     void onSend(KMError err);
     void onReceive(KMError err);
     void onClose(KMError err);
+    void onFlush() override;
     
 private:
     void cleanup();
+    bool deferSend(const iovec *iovs, int count);
+    KMError sendFlushBuffer();
+    void cancelFlush();
     void setupCallbacks();
     void saveInitData(const KMBuffer *init_buf);
     
@@ -85,6 +95,10 @@ protected:
 private:
     std::vector<uint8_t>    initData_;
     
+    // the output queued in current iteration, see EventLoop::setWriteCoalescing
+    std::vector<uint8_t>    flush_buffer_;
+    bool                    write_coalescing_{ false };
+    
     bool                    isServer_{ false };
 };
 
@@ -23,6 +23,8 @@
 
 #include <stdarg.h>
 #include <errno.h>
+#include <string.h>
+#include <algorithm>
 
 #include "EventLoopImpl.h"
 #include "TcpListenerImpl.h"
@@ -32,41 +34,168 @@
 # include "iocp/IocpAcceptor.h"
 #endif
 
+#if defined(KUMA_OS_LINUX) && defined(SO_REUSEPORT)
+// the kernel balances incoming connections between the SO_REUSEPORT listen sockets
+# define KUMA_HAS_REUSEPORT_LB
+#endif
+
 using namespace kuma;
 
+namespace {
+    // the fd accepted on other loop, it's closed unless the accept callback takes it
+    class AcceptedFd
+    {
+    public:
+        explicit AcceptedFd(SOCKET_FD fd) : fd_(fd) {}
+        AcceptedFd(AcceptedFd &&other) : fd_(other.release()) {}
+        AcceptedFd(const AcceptedFd &other) = delete;
+        ~AcceptedFd()
+        {
+            if (fd_ != INVALID_FD) {
+                closeFd(fd_);
+            }
+        }
+        SOCKET_FD get() const { return fd_; }
+        SOCKET_FD release()
+        {
+            auto fd = fd_;
+            fd_ = INVALID_FD;
+            return fd;
+        }
+        
+    private:
+        SOCKET_FD fd_;
+    };
+}
+
 TcpListener::Impl::Impl(const EventLoopPtr &loop)
+{
+    createAcceptor(loop);
+}
+
+TcpListener::Impl::Impl(const std::vector<EventLoopPtr> &loops)
+{
+#ifdef KUMA_HAS_REUSEPORT_LB
+    listen_flags_ |= LISTEN_FLAG_REUSE_PORT;
+    for (auto &loop : loops) {
+        createAcceptor(loop);
+    }
+#else
+    if (!loops.empty()) {
+        createAcceptor(loops[0]);
+        for (auto &acceptor : acceptors_) {
+            acceptor->setAcceptCallback([this] (SOCKET_FD fd, const char *ip, uint16_t port) {
+                return dispatchAccept(fd, ip, port);
+            });
+        }
+    }
+    for (auto &loop : loops) {
+        EventLoopTokenPtr token(new EventLoopToken());
+        token->eventLoop(loop);
+        dispatch_tokens_.emplace_back(std::move(token));
+    }
+#endif
+}
+
+TcpListener::Impl::~Impl()
+{
+    close();
+    for (auto &token : dispatch_tokens_) {
+        token->reset();
+    }
+}
+
+void TcpListener::Impl::createAcceptor(const EventLoopPtr &loop)
 {
 #ifdef KUMA_OS_WIN
     if (loop->getPollType() == PollType::IOCP) {
-        acceptor_.reset(new IocpAcceptor(loop));
+        acceptors_.emplace_back(new IocpAcceptor(loop));
     }
     else
 #endif
     {
-        acceptor_.reset(new AcceptorBase(loop));
+        acceptors_.emplace_back(new AcceptorBase(loop));
     }
 }
 
-TcpListener::Impl::~Impl()
+void TcpListener::Impl::setAcceptCallback(AcceptCallback cb)
 {
-    if (acceptor_) {
-        acceptor_->close();
+    if (!dispatch_tokens_.empty()) {
+        accept_cb_ = std::move(cb);
+        return;
+    }
+    for (auto &acceptor : acceptors_) {
+        acceptor->setAcceptCallback(cb);
     }
 }
 
-void TcpListener::Impl::setAcceptCallback(AcceptCallback cb)
+void TcpListener::Impl::setAcceptAddrCallback(AcceptAddrCallback cb)
 {
-    acceptor_->setAcceptCallback(std::move(cb));
+    if (!dispatch_tokens_.empty()) {
+        addr_accept_cb_ = std::move(cb);
+        for (auto &acceptor : acceptors_) {
+            if (addr_accept_cb_) {
+                acceptor->setAcceptAddrCallback([this] (SOCKET_FD fd, const sockaddr *addr, socklen_t addr_len) {
+                    return dispatchAccept(fd, addr, addr_len);
+                });
+            } else {
+                acceptor->setAcceptAddrCallback(nullptr);
+            }
+        }
+        return;
+    }
+    for (auto &acceptor : acceptors_) {
+        acceptor->setAcceptAddrCallback(cb);
+    }
 }
 
 void TcpListener::Impl::setErrorCallback(ErrorCallback cb)
 {
-    acceptor_->setErrorCallback(std::move(cb));
+    for (auto &acceptor : acceptors_) {
+        acceptor->setErrorCallback(cb);
+    }
 }
 
 KMError TcpListener::Impl::startListen(const std::string &host, uint16_t port)
 {
-    return acceptor_->listen(host, port);
+    if (acceptors_.empty()) {
+        return KMError::INVALID_STATE;
+    }
+    if (listen_flags_ & LISTEN_FLAG_EXCLUSIVE) {
+        auto ret = acceptors_[0]->listen(host, port, listen_flags_);
+        if (ret != KMError::NOERR) {
+            return ret;
+        }
+        for (size_t i = 1; i < acceptors_.size(); ++i) {
+            ret = acceptors_[i]->attach(acceptors_[0]->getFd(), listen_flags_);
+            if (ret != KMError::NOERR) {
+                close();
+                return ret;
+            }
+        }
+        return KMError::NOERR;
+    }
+    for (auto &acceptor : acceptors_) {
+        auto ret = acceptor->listen(host, port, listen_flags_);
+        if (ret != KMError::NOERR) {
+            close();
+            return ret;
+        }
+        if (0 == port && acceptors_.size() > 1) {
+            // all the acceptors should listen on the ephemeral port of the first one
+            sockaddr_storage ss_addr = {0};
+#if defined(KUMA_OS_LINUX) || defined(KUMA_OS_MAC)
+            socklen_t ss_len = sizeof(ss_addr);
+#else
+            int ss_len = sizeof(ss_addr);
+#endif
+            if (getsockname(acceptor->getFd(), (struct sockaddr*)&ss_addr, &ss_len) == 0) {
+                std::string ip;
+                km_get_sock_addr(ss_addr, ip, &port);
+            }
+        }
+    }
+    return KMError::NOERR;
 }
 
 KMError TcpListener::Impl::stopListen(const std::string &host, uint16_t port)
@@ -76,5 +205,99 @@ KMError TcpListener::Impl::stopListen(const std::string &host, uint16_t port)
 
 KMError TcpListener::Impl::close()
 {
-    return acceptor_->close();
+    // the owner of shared listen fd is the first one, close it last
+    for (auto it = acceptors_.rbegin(); it != acceptors_.rend(); ++it) {
+        (*it)->close();
+    }
+    return KMError::NOERR;
+}
+
+KMError TcpListener::Impl::setSharedListenSocket(bool shared)
+{
+    if (!acceptors_.empty() && acceptors_[0]->getFd() != INVALID_FD) {
+        return KMError::INVALID_STATE;
+    }
+#ifdef KUMA_HAS_REUSEPORT_LB
+    if (shared) {
+        listen_flags_ = (listen_flags_ & ~LISTEN_FLAG_REUSE_PORT) | LISTEN_FLAG_EXCLUSIVE;
+    } else {
+        listen_flags_ = (listen_flags_ & ~LISTEN_FLAG_EXCLUSIVE) | LISTEN_FLAG_REUSE_PORT;
+    }
+    return KMError::NOERR;
+#else
+    return shared ? KMError::NOT_SUPPORTED : KMError::NOERR;
+#endif
+}
+
+KMError TcpListener::Impl::setBacklog(int backlog)
+{
+    if (backlog <= 0) {
+        return KMError::INVALID_PARAM;
+    }
+    if (!acceptors_.empty() && acceptors_[0]->getFd() != INVALID_FD) {
+        return KMError::INVALID_STATE;
+    }
+    for (auto &acceptor : acceptors_) {
+        acceptor->setBacklog(backlog);
+    }
+    return KMError::NOERR;
+}
+
+void TcpListener::Impl::setAcceptBatch(uint32_t max_accepts)
+{
+    for (auto &acceptor : acceptors_) {
+        acceptor->setAcceptBatch(max_accepts);
+    }
+}
+
+EventLoopToken* TcpListener::Impl::nextDispatchToken()
+{
+    // called on the loop of acceptor
+    auto *token = dispatch_tokens_[next_loop_].get();
+    if (++next_loop_ >= dispatch_tokens_.size()) {
+        next_loop_ = 0;
+    }
+    return token;
+}
+
+bool TcpListener::Impl::dispatchAccept(SOCKET_FD fd, const char *ip, uint16_t port)
+{
+    auto *token = nextDispatchToken();
+    auto loop = token->eventLoop();
+    if (!loop) {
+        return false;
+    }
+    if (loop->inSameThread()) {
+        return accept_cb_ && accept_cb_(fd, ip, port);
+    }
+    std::string peer_ip(ip);
+    // the task owns the fd, it's closed when the task is dropped by cancel or loop exit
+    loop->post([this, accepted = AcceptedFd(fd), peer_ip, port] () mutable {
+        if (accept_cb_ && accept_cb_(accepted.get(), peer_ip.c_str(), port)) {
+            accepted.release();
+        }
+    }, token);
+    return true;
+}
+
+bool TcpListener::Impl::dispatchAccept(SOCKET_FD fd, const sockaddr *addr, socklen_t addr_len)
+{
+    auto *token = nextDispatchToken();
+    auto loop = token->eventLoop();
+    if (!loop) {
+        return false;
+    }
+    if (loop->inSameThread()) {
+        return addr_accept_cb_ && addr_accept_cb_(fd, addr, addr_len);
+    }
+    sockaddr_storage ss_addr = { 0 };
+    addr_len = std::min<socklen_t>(addr_len, sizeof(ss_addr));
+    memcpy(&ss_addr, addr, addr_len);
+    // the task owns the fd, it's closed when the task is dropped by cancel or loop exit
+    loop->post([this, accepted = AcceptedFd(fd), ss_addr, addr_len] () mutable {
+        if (addr_accept_cb_ && addr_accept_cb_(accepted.get(), (const sockaddr*)&ss_addr, addr_len)) {
+            accepted.release();
+        }
+    }, token);
+    return true;
 }
@@ -26,26 +26,52 @@
 #include "kmapi.h"
 #include "evdefs.h"
 #include "AcceptorBase.h"
+
+#include <vector>
 KUMA_NS_BEGIN
 
 class TcpListener::Impl
 {
 public:
     using AcceptCallback = TcpListener::AcceptCallback;
+    using AcceptAddrCallback = TcpListener::AcceptAddrCallback;
     using ErrorCallback = TcpListener::ErrorCallback;
     
     Impl(const EventLoopPtr &loop);
+    Impl(const std::vector<EventLoopPtr> &loops);
     ~Impl();
     
     KMError startListen(const std::string &host, uint16_t port);
     KMError stopListen(const std::string &host, uint16_t port);
     KMError close();
+    KMError setSharedListenSocket(bool shared);
+    KMError setBacklog(int backlog);
+    void setAcceptBatch(uint32_t max_accepts);
     
     void setAcceptCallback(AcceptCallback cb);
+    void setAcceptAddrCallback(AcceptAddrCallback cb);
     void setErrorCallback(ErrorCallback cb);
     
 private:
-    std::unique_ptr<AcceptorBase> acceptor_;
+    void createAcceptor(const EventLoopPtr &loop);
+    bool dispatchAccept(SOCKET_FD fd, const char *ip, uint16_t port);
+    bool dispatchAccept(SOCKET_FD fd, const sockaddr *addr, socklen_t addr_len);
+    EventLoopToken* nextDispatchToken();
+    
+private:
+    using AcceptorPtr = std::unique_ptr<AcceptorBase>;
+    using EventLoopTokenPtr = std::unique_ptr<EventLoopToken>;
+    
+    // one acceptor for each loop in SO_REUSEPORT or shared mode, otherwise only one acceptor.
+    // in shared mode the first acceptor owns the listen fd
+    std::vector<AcceptorPtr>        acceptors_;
+    uint32_t                        listen_flags_{ 0 };
+    
+    // the loops that accepted fds are dispatched to if not in SO_REUSEPORT mode
+    std::vector<EventLoopTokenPtr>  dispatch_tokens_;
+    size_t                          next_loop_{ 0 };
+    AcceptCallback                  accept_cb_;
+    AcceptAddrCallback              addr_accept_cb_;
 };
 
 KUMA_NS_END
@@ -62,6 +62,7 @@
 
 #include <stdarg.h>
 #include <errno.h>
+#include <algorithm>
 
 #include "EventLoopImpl.h"
 #include "TcpSocketImpl.h"
@@ -89,6 +90,8 @@ TcpSocket::Impl::~Impl()
 
 void TcpSocket::Impl::cleanup()
 {
+    loop_token_.reset();
+    removeReadyIO();
     if (socket_) {
         socket_->close();
         socket_.reset();
@@ -98,6 +101,23 @@ void TcpSocket::Impl::cleanup()
 #endif
 }
 
+void TcpSocket::Impl::removeReadyIO()
+{
+    // the ready list is only touched on loop thread
+    auto loop = eventLoop();
+    if (!loop) {
+        return;
+    }
+    if (loop->inSameThread()) {
+        loop->removeReadyIO(this);
+    } else if (!loop->stopped()) {
+        loop->sync([this, &loop] {
+            loop->removeReadyIO(this);
+        });
+    }
+    // else the ready list is dropped when the loop exits
+}
+
 KMError TcpSocket::Impl::setSslFlags(uint32_t ssl_flags)
 {
 #ifdef KUMA_HAS_OPENSSL
@@ -146,13 +166,13 @@ KMError TcpSocket::Impl::connect(const std::string &host, uint16_t port, EventCa
     }, timeout_ms);
 }
 
-KMError TcpSocket::Impl::attachFd(SOCKET_FD fd)
+KMError TcpSocket::Impl::attachFd(SOCKET_FD fd, uint32_t flags)
 {
     KUMA_INFOXTRACE("attachFd, fd=" << fd << ", flags=" << ssl_flags_);
     if (!createSocket()) {
         return KMError::INVALID_STATE;
     }
-    auto err = socket_->attachFd(fd);
+    auto err = socket_->attachFd(fd, flags);
     if (err != KMError::NOERR) {
         return err;
     }
@@ -195,6 +215,12 @@ KMError TcpSocket::Impl::attach(Impl &&other)
     }
     ssl_flags_ = other.ssl_flags_;
     socket_ = std::move(other.socket_);
+    auto loop = eventLoop();
+    if (loop && other.queued_) {
+        // the input left by read budget is resumed on this one
+        loop->removeReadyIO(&other);
+        loop->appendReadyIO(this);
+    }
     socket_->setReadCallback([this](KMError err) {
         onReceive(err);
     });
@@ -416,12 +442,57 @@ int TcpSocket::Impl::send(const iovec* iovs, int count)
 
 int TcpSocket::Impl::send(const KMBuffer &buf)
 {
-    IOVEC iovs;
-    buf.fillIov(iovs);
-    if (iovs.empty()) {
+#ifdef KUMA_HAS_OPENSSL
+    if (sslEnabled()) {
+        IOVEC iovs;
+        buf.fillIov(iovs);
+        if (iovs.empty()) {
+            return 0;
+        }
+        return send(&iovs[0], static_cast<int>(iovs.size()));
+    }
+#endif
+    if (!isReady()) {
+        KUMA_WARNXTRACE("send 3, invalid state");
+        return 0;
+    }
+    // SocketBase sends the shared storage of buf with zero-copy if enabled
+    int ret = sendData(buf);
+    if (ret < 0) {
+        cleanup();
+    }
+    return ret;
+}
+
+int TcpSocket::Impl::sendFile(int file_fd, int64_t offset, size_t length)
+{
+    if (!isReady()) {
+        KUMA_WARNXTRACE("sendFile, invalid state");
         return 0;
     }
-    return send(&iovs[0], static_cast<int>(iovs.size()));
+    if (0 == length) {
+        return 0;
+    }
+#ifdef KUMA_HAS_OPENSSL
+    if (sslEnabled()) {
+        // the file is encrypted in user space, read it in blocks
+        const size_t kFileBlockSize = 64*1024;
+        KMBuffer buf(std::min(length, kFileBlockSize));
+        int nread = read_file(file_fd, buf.writePtr(), buf.space(), offset);
+        if (nread <= 0) {
+            // the file error leaves the socket open
+            KUMA_ERRXTRACE("sendFile, failed to read file, offset=" << offset << ", err=" << errno);
+            return -1;
+        }
+        buf.bytesWritten(nread);
+        return send(buf.readPtr(), nread);
+    }
+#endif
+    int ret = socket_->sendFile(file_fd, offset, length);
+    if (ret < 0 && !socket_->isReady()) {
+        cleanup();
+    }
+    return ret;
 }
 
 int TcpSocket::Impl::receive(void* data, size_t length)
@@ -429,6 +500,9 @@ int TcpSocket::Impl::receive(void* data, size_t length)
     if (!isReady()) {
         return 0;
     }
+    if (read_budget_ > 0 && readBudgetExceeded()) {
+        return 0;
+    }
 
     int ret = 0;
 #ifdef KUMA_HAS_OPENSSL
@@ -442,10 +516,98 @@ int TcpSocket::Impl::receive(void* data, size_t length)
     }
     if (ret < 0) {
         cleanup();
+    } else {
+        read_bytes_ += ret;
     }
     return ret;
 }
 
+bool TcpSocket::Impl::readBudgetExceeded()
+{
+    if (read_bytes_ < read_budget_) {
+        return false;
+    }
+    // the rest input is read in next iteration, edge-triggered poll will not report it again.
+    // the shared poll reports it again after re-arming the fd, the callback may run on IO thread
+    auto loop = eventLoop();
+    if (loop && !loop->isPollShared() && loop->inSameThread()) {
+        loop->appendReadyIO(this);
+    }
+    return true;
+}
+
+KMError TcpSocket::Impl::migrate(const EventLoopPtr &loop, EventCallback cb)
+{
+    auto old_loop = eventLoop();
+    if (!loop || !old_loop) {
+        return KMError::INVALID_PARAM;
+    }
+    if (loop == old_loop) {
+        return KMError::NOERR;
+    }
+    if (loop->getPollType() == PollType::IOCP || old_loop->getPollType() == PollType::IOCP) {
+        // the pending overlapped operations are bound to the completion port
+        return KMError::NOT_SUPPORTED;
+    }
+    if (!old_loop->inSameThread()) {
+        KMError ret = KMError::INVALID_STATE;
+        auto err = old_loop->sync([&ret, &loop, &cb, this] {
+            ret = migrate(loop, std::move(cb));
+        });
+        return err == KMError::NOERR ? ret : err;
+    }
+    if (!isReady() || migrating_) {
+        return KMError::INVALID_STATE;
+    }
+    KUMA_INFOXTRACE("migrate, fd=" << getFd());
+    // it may be called in the callbacks of this socket, the loop is switched after they return
+    loop_token_.eventLoop(old_loop);
+    auto ret = old_loop->post([this, loop, cb=std::move(cb)] () mutable {
+        switchLoop(loop, std::move(cb));
+    }, &loop_token_);
+    if (ret == KMError::NOERR) {
+        migrating_ = true;
+    }
+    return ret;
+}
+
+void TcpSocket::Impl::switchLoop(const EventLoopPtr &loop, EventCallback cb)
+{
+    migrating_ = false;
+    auto old_loop = eventLoop();
+    if (queued_ && old_loop) {
+        old_loop->removeReadyIO(this);
+    }
+    loop_token_.reset();
+    auto ret = socket_->migrate(loop);
+    if (ret == KMError::NOERR) {
+        loop_ = loop;
+        loop_token_.eventLoop(loop);
+        read_bytes_ = 0;
+        ret = loop->post([this, cb=std::move(cb)] {
+            auto err = socket_->onMigrated();
+            if (err != KMError::NOERR) {
+                KUMA_ERRXTRACE("migrate, failed to register fd, err=" << int(err));
+                onClose(err);
+                return;
+            }
+            if (cb) {
+                DESTROY_DETECTOR_SETUP();
+                cb(KMError::NOERR);
+                DESTROY_DETECTOR_CHECK_VOID();
+            }
+            // the input buffered by SSL or deferred by read budget has no poll event
+            if (isReady()) {
+                onReceive(KMError::NOERR);
+            }
+        }, &loop_token_);
+    }
+    if (ret != KMError::NOERR) {
+        KUMA_ERRXTRACE("migrate, failed, err=" << int(ret));
+        onClose(ret);
+    }
+}
+
 KMError TcpSocket::Impl::close()
 {
     KUMA_INFOXTRACE("close");
@@ -466,14 +628,36 @@ KMError TcpSocket::Impl::pause()
     if (!isReady()) {
         return KMError::INVALID_STATE;
     }
+    removeReadyIO();
     return socket_->pause();
 }
 
+KMError TcpSocket::Impl::setZeroCopy(size_t threshold)
+{
+    if (sslEnabled()) {
+        return KMError::NOT_SUPPORTED;
+    }
+#ifndef KUMA_HAS_ZEROCOPY
+    if (threshold > 0) {
+        return KMError::NOT_SUPPORTED;
+    }
+#endif
+    zc_threshold_ = threshold;
+    if (socket_) {
+        return socket_->setZeroCopy(threshold);
+    }
+    return KMError::NOERR;
+}
+
 KMError TcpSocket::Impl::resume()
 {
     if (!isReady()) {
         return KMError::INVALID_STATE;
     }
+    if (read_budget_ > 0) {
+        // resume the input left by read budget before pause
+        readBudgetExceeded();
+    }
     return socket_->resume();
 }
 
@@ -525,9 +709,17 @@ void TcpSocket::Impl::onReceive(KMError err)
         return;
     }
 #endif
+    read_bytes_ = 0;
+    auto loop = eventLoop();
+    read_budget_ = loop ? loop->readBudget() : 0;
     if (read_cb_ && isReady()) read_cb_(err);
 }
 
+void TcpSocket::Impl::onReadyIO()
+{
+    onReceive(KMError::NOERR);
+}
+
 void TcpSocket::Impl::onClose(KMError err)
 {
     KUMA_INFOXTRACE("onClose, err=" << int(err));
@@ -548,6 +740,9 @@ bool TcpSocket::Impl::createSocket()
         {
             socket_.reset(new SocketBase(loop));
         }
+        if (zc_threshold_ > 0) {
+            socket_->setZeroCopy(zc_threshold_);
+        }
         socket_->setReadCallback([this](KMError err) {
             onReceive(err);
         });
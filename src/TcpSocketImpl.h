@@ -45,7 +45,7 @@
 KUMA_NS_BEGIN
 class SocketBase;
 
-class TcpSocket::Impl : public KMObject, public DestroyDetector
+class TcpSocket::Impl : public KMObject, public DestroyDetector, public ReadyIO
 {
 public:
     using EventCallback = TcpSocket::EventCallback;
@@ -60,9 +60,10 @@ public:
     bool sslEnabled() const;
     KMError bind(const std::string &bind_host, uint16_t bind_port);
     KMError connect(const std::string &host, uint16_t port, EventCallback cb, uint32_t timeout_ms = 0);
-    KMError attachFd(SOCKET_FD fd);
+    KMError attachFd(SOCKET_FD fd, uint32_t flags = 0);
     KMError attach(Impl &&other);
     KMError detachFd(SOCKET_FD &fd);
+    KMError migrate(const EventLoopPtr &loop, EventCallback cb = nullptr);
 #ifdef KUMA_HAS_OPENSSL
     KMError setAlpnProtocols(const AlpnProtos &protocols);
     KMError getAlpnSelected(std::string &protocol);
@@ -74,11 +75,13 @@ public:
     int send(const void* data, size_t length);
     int send(const iovec* iovs, int count);
     int send(const KMBuffer &buf);
+    int sendFile(int file_fd, int64_t offset, size_t length);
     int receive(void* data, size_t length);
     KMError close();
     
     KMError pause();
     KMError resume();
+    KMError setZeroCopy(size_t threshold);
     
     void setReadCallback(EventCallback cb) { read_cb_ = std::move(cb); }
     void setWriteCallback(EventCallback cb) { write_cb_ = std::move(cb); }
@@ -92,6 +95,7 @@ private:
     void onSend(KMError err);
     void onReceive(KMError err);
     void onClose(KMError err);
+    void onReadyIO() override;
     
     bool createSocket();
 #ifdef KUMA_HAS_OPENSSL
@@ -105,10 +109,14 @@ private:
     
 private:
     void cleanup();
+    void removeReadyIO();
     bool isReady() const;
+    bool readBudgetExceeded();
+    void switchLoop(const EventLoopPtr &loop, EventCallback cb);
     
 private:
     EventLoopWeakPtr    loop_;
+    EventLoopToken      loop_token_;
     uint32_t            ssl_flags_{ SSL_NONE };
     
     std::unique_ptr<SocketBase> socket_;
@@ -124,6 +132,12 @@ private:
     EventCallback       read_cb_;
     EventCallback       write_cb_;
     EventCallback       error_cb_;
+    
+    // bytes received since the read callback was called, see EventLoop::setReadBudget
+    size_t              read_bytes_ = 0;
+    uint32_t            read_budget_ = 0;
+    bool                migrating_ = false;
+    size_t              zc_threshold_ = 0;
 };
 
 KUMA_NS_END
@@ -38,24 +38,23 @@ KUMA_NS_END
 //////////////////////////////////////////////////////////////////////////
 // Timer::Impl
 Timer::Impl::Impl(TimerManagerPtr mgr)
-: cb_()
-, timer_mgr_(mgr)
-, timer_node_()
+: timer_mgr_(mgr)
+, timer_node_(new TimerManager::TimerNode())
 {
-    timer_node_.timer_ = this;
+    
 }
 
 Timer::Impl::~Impl()
 {
     cancel();
+    timer_node_->release();
 }
 
-bool Timer::Impl::schedule(uint32_t delay_ms, TimerMode mode, TimerCallback cb)
+bool Timer::Impl::schedule(uint32_t delay_ms, uint32_t slack_ms, TimerMode mode, TimerCallback cb)
 {
     TimerManagerPtr mgr = timer_mgr_.lock();
     if(mgr) {
-        cb_ = std::move(cb);
-        return mgr->scheduleTimer(this, delay_ms, mode);
+        return mgr->scheduleTimer(this, delay_ms, slack_ms, mode, std::move(cb));
     }
     return false;
 }
@@ -85,86 +84,207 @@ TimerManager::TimerManager(EventLoop::Impl* loop)
 
 TimerManager::~TimerManager()
 {
-    
+    while (auto req = requests_.dequeue()) {
+        req->node->release();
+        delete req;
+    }
+    for (int i=0; i<TV_COUNT; ++i)
+    {
+        for (int j=0; j<TIMER_VECTOR_SIZE; ++j)
+        {
+            while (!list_empty(&tv_[i][j])) {
+                auto timer_node = tv_[i][j].next_;
+                list_remove_node(timer_node);
+                if (timer_node->is_group_) {
+                    auto group = static_cast<TimerGroup*>(timer_node);
+                    while (!list_empty(&group->members_)) {
+                        auto member = group->members_.next_;
+                        list_remove_node(member);
+                        member->group_ = nullptr;
+                        member->release();
+                    }
+                    delete group;
+                } else {
+                    timer_node->release();
+                }
+            }
+        }
+    }
 }
 
-bool TimerManager::scheduleTimer(Timer::Impl* timer, uint32_t delay_ms, TimerMode mode)
+bool TimerManager::scheduleTimer(Timer::Impl* timer, uint32_t delay_ms, uint32_t slack_ms, TimerMode mode, Timer::TimerCallback cb)
 {
-    TimerNode* timer_node = &timer->timer_node_;
-    if(isTimerPending(timer_node) && delay_ms == timer_node->delay_ms_) {
+    TimerNode* timer_node = timer->timer_node_;
+    // the pending requests from other threads are stale after this
+    uint32_t seq = timer_node->seq_.fetch_add(1, std::memory_order_seq_cst) + 1;
+    if(!loop_->inSameThread()) {
+        postRequest(timer_node, seq, false, delay_ms, slack_ms, mode, std::move(cb));
+        if(get_tick_count_ms() + delay_ms < wakeup_tick_.load(std::memory_order_seq_cst)) {
+            loop_->notify();
+        }
         return true;
     }
-    TICK_COUNT_TYPE now_tick = get_tick_count_ms();
-    timer_node->cancelled_ = false;
-    bool need_notify = false;
-    bool ret = false;
-    {
-        KM_Lock_Guard g(mutex_);
-        if(isTimerPending(timer_node)) {
-            removeTimer(timer_node);
+    // fast path, the wheel is accessed on loop thread only, no lock is needed
+    timer_node->cb_ = std::move(cb);
+    if(isTimerPending(timer_node) && timer_node->slack_ms_ == slack_ms &&
+       timer_node->repeating_ == (mode == TimerMode::REPEATING)) {
+        if(delay_ms == timer_node->delay_ms_ && 0 == slack_ms) {
+            timer_node->armed_seq_ = seq;
+            return true;
         }
-        timer_node->start_tick_ = now_tick;
-        timer_node->delay_ms_ = delay_ms;
-        timer_node->repeating_ = mode == TimerMode::REPEATING;
-        
-        ret = addTimer(timer_node, FROM_SCHEDULE);
-        if(reschedule_node_ == timer_node) {
-            reschedule_node_ = nullptr;
+        if(timer_node->group_) {
+            // the slack timer stays in the group if it is due in same window
+            TICK_COUNT_TYPE now_tick = (TICK_COUNT_TYPE)loop_->nowMs();
+            if(calcGroupTick(now_tick + delay_ms, slack_ms) == timer_node->group_->fire_tick_) {
+                timer_node->delay_ms_ = delay_ms;
+                timer_node->armed_seq_ = seq;
+                return true;
+            }
         }
-        long diff = long(now_tick - last_tick_);
-        if(last_remain_ms_ == -1 || (diff >= 0 && delay_ms < last_remain_ms_ - diff)) {
-            // need update poll wait time
-            need_notify = !loop_->inSameThread();
+    }
+    return armTimer(timer_node, delay_ms, slack_ms, mode, seq);
+}
+
+void TimerManager::cancelTimer(Timer::Impl* timer)
+{
+    TimerNode* timer_node = timer->timer_node_;
+    uint32_t seq = timer_node->seq_.fetch_add(1, std::memory_order_seq_cst) + 1;
+    if(loop_->inSameThread()) {
+        disarmTimer(timer_node);
+        return;
+    }
+    if(running_node_.load(std::memory_order_seq_cst) == timer_node) {
+        // the timer may be running, wait it
+        running_mutex_.lock();
+        running_mutex_.unlock();
+    }
+    // the entry in wheel is dropped since its sequence is stale, the request
+    // lets loop thread release it without waiting for expiration
+    postRequest(timer_node, seq, true);
+}
+
+bool TimerManager::armTimer(TimerNode* timer_node, uint32_t delay_ms, uint32_t slack_ms, TimerMode mode, uint32_t seq)
+{
+    bool pending = isTimerPending(timer_node);
+    if(pending) {
+        removeTimer(timer_node);
+    }
+    timer_node->start_tick_ = (TICK_COUNT_TYPE)loop_->nowMs();
+    timer_node->delay_ms_ = delay_ms;
+    timer_node->slack_ms_ = slack_ms;
+    timer_node->repeating_ = mode == TimerMode::REPEATING;
+    timer_node->armed_seq_ = seq;
+    last_remain_ms_ = -1; // the poll wait time needs update
+    bool ret = slack_ms > 0 ? addToGroup(timer_node) : addTimer(timer_node, FROM_SCHEDULE);
+    if(!ret) {
+        if(pending) {
+            timer_node->release();
         }
+        return false;
     }
-    if(need_notify) {
-        loop_->notify();
+    if(!pending) { // the wheel holds a reference
+        timer_node->addRef();
     }
-    return ret;
+    return true;
 }
 
-void TimerManager::cancelTimer(Timer::Impl* timer)
+void TimerManager::disarmTimer(TimerNode* timer_node)
 {
-    TimerNode* timer_node = &timer->timer_node_;
-    if(timer_node->cancelled_) {
-        return ;
+    if(isTimerPending(timer_node)) {
+        removeTimer(timer_node);
+        timer_node->release();
     }
-    timer_node->cancelled_ = true;
-    bool cancelled = false;
-    if(reschedule_node_ == timer_node || isTimerPending(timer_node)) {
-        mutex_.lock();
-        if(isTimerPending(timer_node)) {
-            removeTimer(timer_node);
-            cancelled = true;
-        } else {
-            if(running_node_ != timer_node) {
-                cancelled = true;
-            }
-            if(reschedule_node_ == timer_node) {
-                reschedule_node_ = nullptr;
+}
+
+void TimerManager::postRequest(TimerNode* timer_node, uint32_t seq, bool cancel, uint32_t delay_ms,
+                               uint32_t slack_ms, TimerMode mode, Timer::TimerCallback cb)
+{
+    auto req = new TimerRequest();
+    timer_node->addRef();
+    req->node = timer_node;
+    req->seq = seq;
+    req->cancel = cancel;
+    req->delay_ms = delay_ms;
+    req->slack_ms = slack_ms;
+    req->mode = mode;
+    req->cb = std::move(cb);
+    requests_.enqueue(req);
+}
+
+void TimerManager::updateWakeupTick(TICK_COUNT_TYPE now_tick, unsigned long* remain_ms)
+{
+    if(!remain_ms) {
+        wakeup_tick_.store(0, std::memory_order_seq_cst); // unknown
+        return;
+    }
+    TICK_COUNT_TYPE wakeup_tick = *remain_ms == (unsigned long)-1 ? (TICK_COUNT_TYPE)-1 : now_tick + *remain_ms;
+    wakeup_tick_.store(wakeup_tick, std::memory_order_seq_cst);
+    if(!requests_.empty()) {
+        // the request is queued before wakeup tick is updated, it may miss the notification
+        *remain_ms = 0;
+    }
+}
+
+void TimerManager::processRequests()
+{
+    while (auto req = requests_.dequeue()) {
+        auto timer_node = req->node;
+        if(req->seq == timer_node->seq_.load(std::memory_order_acquire)) {
+            if(req->cancel) {
+                disarmTimer(timer_node);
+            } else {
+                timer_node->cb_ = std::move(req->cb);
+                armTimer(timer_node, req->delay_ms, req->slack_ms, req->mode, req->seq);
             }
         }
-        mutex_.unlock();
+        timer_node->release();
+        delete req;
     }
-    // check timer running
-    if(!cancelled && running_node_ == timer_node) { // may be running, wait it
-        running_mutex_.lock();
-        if(running_node_ == timer_node) {
-            running_node_ = nullptr;
-            cancelled = true;
-        }
-        running_mutex_.unlock();
+}
+
+TICK_COUNT_TYPE TimerManager::calcGroupTick(TICK_COUNT_TYPE fire_tick, uint32_t slack_ms)
+{
+    // align to the largest power of 2 not greater than slack, so that the timers
+    // with similar slack share the windows
+    TICK_COUNT_TYPE window = 1;
+    while(window <= (slack_ms >> 1)) {
+        window <<= 1;
     }
-    // check again for reschedule timer
-    if(!cancelled && (reschedule_node_ == timer_node || isTimerPending(timer_node))) {
-        mutex_.lock();
-        if(isTimerPending(timer_node)) {
-            removeTimer(timer_node);
-        }
-        if(reschedule_node_ == timer_node) {
-            reschedule_node_ = nullptr;
+    return (fire_tick + window - 1) & ~(window - 1);
+}
+
+bool TimerManager::addToGroup(TimerNode* timer_node)
+{
+    auto fire_tick = calcGroupTick(timer_node->start_tick_ + timer_node->delay_ms_, timer_node->slack_ms_);
+    auto &group = groups_[fire_tick];
+    if(!group) {
+        group = new TimerGroup();
+        group->is_group_ = true;
+        group->fire_tick_ = fire_tick;
+        group->start_tick_ = timer_node->start_tick_;
+        group->delay_ms_ = (uint32_t)(fire_tick - timer_node->start_tick_);
+        list_init_head(&group->members_);
+        if(!addTimer(group, FROM_SCHEDULE)) {
+            delete group;
+            groups_.erase(fire_tick);
+            return false;
         }
-        mutex_.unlock();
+    }
+    list_add_node(&group->members_, timer_node);
+    timer_node->group_ = group;
+    return true;
+}
+
+void TimerManager::removeFromGroup(TimerNode* timer_node)
+{
+    auto group = timer_node->group_;
+    list_remove_node(timer_node);
+    timer_node->group_ = nullptr;
+    if(list_empty(&group->members_) && isTimerPending(group)) {
+        // the group is not firing, remove its wheel entry
+        groups_.erase(group->fire_tick_);
+        removeTimer(group);
+        delete group;
     }
 }
 
@@ -315,6 +435,10 @@ bool TimerManager::addTimer(TimerNode* timer_node, FROM from)
 
 void TimerManager::removeTimer(TimerNode* timer_node)
 {
+    if(timer_node->group_) {
+        removeFromGroup(timer_node);
+        return;
+    }
     if(0 == timer_node->tv_index_
        && timer_node->next_ != timer_node
        && timer_node->next_ == timer_node->prev_
@@ -347,12 +471,14 @@ int TimerManager::cascadeTimer(int tv_idx, int tl_idx)
 #define INDEX(N) ((next_jiffies >> ((N+1) * TIMER_VECTOR_BITS)) & TIMER_VECTOR_MASK)
 int TimerManager::checkExpire(unsigned long* remain_ms)
 {
+    processRequests();
+    TICK_COUNT_TYPE now_tick = (TICK_COUNT_TYPE)loop_->nowMs();
     if(0 == timer_count_) {
         last_remain_ms_ = -1;
         *remain_ms = last_remain_ms_;
+        updateWakeupTick(now_tick, remain_ms);
         return 0;
     }
-    TICK_COUNT_TYPE now_tick = get_tick_count_ms();
     TICK_COUNT_TYPE delta_tick = calc_time_elapse_delta_ms(now_tick, last_tick_);
     if(0 == delta_tick) {
         if(remain_ms) {
@@ -360,13 +486,12 @@ int TimerManager::checkExpire(unsigned long* remain_ms)
                 *remain_ms = last_remain_ms_;
             } else {
                 // calc remain time in ms
-                mutex_.lock();
                 int pos = find_first_set_in_bitmap(now_tick & TIMER_VECTOR_MASK);
-                mutex_.unlock();
                 *remain_ms = -1==pos?256:pos;
                 last_remain_ms_ = *remain_ms;
             }
         }
+        updateWakeupTick(now_tick, remain_ms);
         return 0;
     }
     TICK_COUNT_TYPE cur_jiffies = now_tick;
@@ -375,7 +500,6 @@ int TimerManager::checkExpire(unsigned long* remain_ms)
     TICK_COUNT_TYPE last_tick = now_tick;
     TimerNode tmp_head;
     list_init_head(&tmp_head);
-    mutex_.lock();
     while(cur_jiffies >= next_jiffies)
     {
         int idx = next_jiffies & TIMER_VECTOR_MASK;
@@ -407,42 +531,33 @@ int TimerManager::checkExpire(unsigned long* remain_ms)
     
     while(!list_empty(&tmp_head))
     {
-        running_node_ = tmp_head.next_;
-        if(!running_node_->cancelled_ && running_node_->repeating_) {
-            reschedule_node_ = running_node_;
-        }
-        list_remove_node(running_node_);
+        auto timer_node = tmp_head.next_;
+        list_remove_node(timer_node);
         --timer_count_;
-        mutex_.unlock(); // sync nodes in tmp_list with cancel_timer.
-
-        running_mutex_.lock();
-        if(running_node_) {
-            if(running_node_->timer_) {
-                running_node_->timer_->cb_();
-                ++count;
+        if(timer_node->is_group_) {
+            auto group = static_cast<TimerGroup*>(timer_node);
+            groups_.erase(group->fire_tick_);
+            while(!list_empty(&group->members_)) {
+                auto member = group->members_.next_;
+                list_remove_node(member);
+                member->group_ = nullptr;
+                count += runTimer(member, now_tick);
             }
-        } else { // this timer is cancelled
-            reschedule_node_ = nullptr;
-        }
-        running_node_ = nullptr;
-        running_mutex_.unlock();
-        
-        mutex_.lock();
-        if(reschedule_node_ && !reschedule_node_->cancelled_ && !isTimerPending(reschedule_node_)) {
-            reschedule_node_->start_tick_ = now_tick;
-            addTimer(reschedule_node_, FROM_RESCHEDULE);
-            reschedule_node_ = nullptr;
+            delete group;
+        } else {
+            count += runTimer(timer_node, now_tick);
         }
     }
 
     if(remain_ms) {
         // calc remain time in ms
+        // pos is relative to next_jiffies, which is ahead of now_tick. counting it from
+        // now_tick makes the loop spin until the tick changes
         int pos = find_first_set_in_bitmap(next_jiffies & TIMER_VECTOR_MASK);
-        *remain_ms = -1==pos?256:pos;
+        *remain_ms = -1==pos?256:(unsigned long)(pos + (next_jiffies - now_tick));
     }
 
-    mutex_.unlock();
-    if(remain_ms) { // revise the remain time
+    if(remain_ms) { // revise the remain time, the timer callbacks may take a while
         now_tick = get_tick_count_ms();
         delta_tick = calc_time_elapse_delta_ms(now_tick, last_tick);
         if(*remain_ms <= delta_tick) {
@@ -452,5 +567,42 @@ int TimerManager::checkExpire(unsigned long* remain_ms)
         }
         last_remain_ms_ = *remain_ms;
     }
+    updateWakeupTick(now_tick, remain_ms);
+    return count;
+}
+
+int TimerManager::runTimer(TimerNode* timer_node, TICK_COUNT_TYPE now_tick)
+{
+    // the reference of wheel is taken over, the node is alive even if the timer
+    // is destroyed in callback
+    int count = 0;
+    running_mutex_.lock();
+    running_node_.store(timer_node, std::memory_order_seq_cst);
+    // the timer is cancelled or rescheduled by other threads if sequence changed
+    if(timer_node->seq_.load(std::memory_order_seq_cst) == timer_node->armed_seq_) {
+        auto tracker = loop_->callbackTracker();
+        if (tracker) {
+            tracker->enter(CallbackTracker::Type::TIMER, (intptr_t)timer_node);
+            timer_node->cb_();
+            tracker->leave();
+        } else {
+            timer_node->cb_();
+        }
+        ++count;
+    }
+    running_node_.store(nullptr, std::memory_order_relaxed);
+    running_mutex_.unlock();
+    
+    if(timer_node->repeating_ && !isTimerPending(timer_node) &&
+       timer_node->seq_.load(std::memory_order_acquire) == timer_node->armed_seq_) {
+        timer_node->start_tick_ = now_tick;
+        bool ret = timer_node->slack_ms_ > 0 ? addToGroup(timer_node) : addTimer(timer_node, FROM_RESCHEDULE);
+        if(!ret) {
+            timer_node->release();
+        }
+    } else {
+        // cancelled, or rescheduled in callback and the wheel holds a new reference
+        timer_node->release();
+    }
     return count;
 }
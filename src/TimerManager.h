@@ -25,9 +25,12 @@
 #include "kmdefs.h"
 #include "kmapi.h"
 #include "util/util.h"
+#include "util/kmqueue.h"
 
 #include <memory>
 #include <mutex>
+#include <atomic>
+#include <unordered_map>
 
 #ifndef TICK_COUNT_TYPE
 # define TICK_COUNT_TYPE    uint64_t
@@ -43,15 +46,22 @@ KUMA_NS_BEGIN
 class TimerManager
 {
 public:
+    class TimerNode;
+    class TimerGroup;
+    
     TimerManager(EventLoop::Impl* loop);
     ~TimerManager();
 
-    bool scheduleTimer(Timer::Impl* timer, uint32_t delay_ms, TimerMode mode);
+    bool scheduleTimer(Timer::Impl* timer, uint32_t delay_ms, uint32_t slack_ms, TimerMode mode, Timer::TimerCallback cb);
     void cancelTimer(Timer::Impl* timer);
 
     int checkExpire(unsigned long* remain_ms = nullptr);
 
 public:
+    /**
+     * TimerNode is shared by Timer::Impl, the timer wheel and the requests from other
+     * threads, it is reference counted. the wheel fields are accessed on loop thread only
+     */
     class TimerNode
     {
     public:
@@ -63,12 +73,28 @@ public:
             prev_ = nullptr;
             next_ = nullptr;
         }
+        void addRef()
+        {
+            ref_count_.fetch_add(1, std::memory_order_relaxed);
+        }
+        void release()
+        {
+            if (ref_count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete this;
+            }
+        }
         
-        bool            cancelled_{ true };
         bool            repeating_{ false };
+        bool            is_group_{ false };
         uint32_t        delay_ms_{ 0 };
+        uint32_t        slack_ms_{ 0 };
         TICK_COUNT_TYPE start_tick_{ 0 };
-        Timer::Impl*    timer_{ nullptr };
+        uint32_t        armed_seq_{ 0 };
+        TimerGroup*     group_{ nullptr }; // the group that the slack timer is linked in
+        Timer::TimerCallback cb_;
+        // increased by each schedule and cancel, the wheel entry and the requests
+        // with stale sequence are dropped
+        std::atomic<uint32_t> seq_{ 0 };
         
     protected:
         friend class TimerManager;
@@ -76,14 +102,52 @@ public:
         int tl_index_{ -1 };
         TimerNode* prev_{ nullptr };
         TimerNode* next_{ nullptr };
+        std::atomic<int> ref_count_{ 1 };
+    };
+    
+    /**
+     * TimerGroup is the wheel entry of the slack timers that fire at same tick,
+     * the timers are linked in members_ by their list node
+     */
+    class TimerGroup : public TimerNode
+    {
+    public:
+        TICK_COUNT_TYPE fire_tick_{ 0 };
+        TimerNode       members_;
     };
     
 private:
+    /**
+     * TimerRequest carries the schedule or cancel from other threads to loop thread
+     */
+    class TimerRequest final : public MPSCNode
+    {
+    public:
+        TimerNode*      node = nullptr;
+        uint32_t        seq = 0;
+        bool            cancel = false;
+        uint32_t        delay_ms = 0;
+        uint32_t        slack_ms = 0;
+        TimerMode       mode = TimerMode::ONE_SHOT;
+        Timer::TimerCallback cb;
+    };
+    using RequestQueue = MPSCQueue<TimerRequest>;
+    
     typedef enum {
         FROM_SCHEDULE,
         FROM_CASCADE,
         FROM_RESCHEDULE
     } FROM;
+    bool armTimer(TimerNode* timer_node, uint32_t delay_ms, uint32_t slack_ms, TimerMode mode, uint32_t seq);
+    void disarmTimer(TimerNode* timer_node);
+    void postRequest(TimerNode* timer_node, uint32_t seq, bool cancel, uint32_t delay_ms = 0, uint32_t slack_ms = 0,
+                     TimerMode mode = TimerMode::ONE_SHOT, Timer::TimerCallback cb = nullptr);
+    TICK_COUNT_TYPE calcGroupTick(TICK_COUNT_TYPE fire_tick, uint32_t slack_ms);
+    bool addToGroup(TimerNode* timer_node);
+    void removeFromGroup(TimerNode* timer_node);
+    int runTimer(TimerNode* timer_node, TICK_COUNT_TYPE now_tick);
+    void processRequests();
+    void updateWakeupTick(TICK_COUNT_TYPE now_tick, unsigned long* remain_ms);
     bool addTimer(TimerNode* timer_node, FROM from);
     void removeTimer(TimerNode* timer_node);
     int cascadeTimer(int tv_idx, int tl_idx);
@@ -108,10 +172,13 @@ private:
     typedef std::lock_guard<KM_Mutex> KM_Lock_Guard;
     
     EventLoop::Impl* loop_;
-    KM_Mutex mutex_;
+    RequestQueue requests_; // the schedule and cancel from other threads
+    // the tick that loop will wake up at, other threads notify loop only if the timer fires earlier
+    std::atomic<TICK_COUNT_TYPE> wakeup_tick_{ 0 };
+    // held while a timer callback is running, cancel from other threads waits on it
     KM_Mutex running_mutex_;
-    TimerNode*  running_node_{ nullptr };
-    TimerNode*  reschedule_node_{ nullptr };
+    std::atomic<TimerNode*> running_node_{ nullptr };
+    std::unordered_map<TICK_COUNT_TYPE, TimerGroup*> groups_; // slack timer groups by fire tick
     unsigned long last_remain_ms_ = -1;
     TICK_COUNT_TYPE last_tick_{ 0 };
     uint32_t timer_count_{ 0 };
@@ -128,14 +195,13 @@ public:
     Impl(TimerManagerPtr mgr);
     ~Impl();
     
-    bool schedule(uint32_t delay_ms, TimerMode mode, TimerCallback cb);
+    bool schedule(uint32_t delay_ms, uint32_t slack_ms, TimerMode mode, TimerCallback cb);
     void cancel();
     
 private:
     friend class TimerManager;
-    TimerCallback cb_;
     std::weak_ptr<TimerManager> timer_mgr_;
-    TimerManager::TimerNode timer_node_; // intrusive list node
+    TimerManager::TimerNode* timer_node_; // intrusive list node
 };
 
 KUMA_NS_END
@@ -59,6 +59,7 @@
 
 #include <stdarg.h>
 #include <errno.h>
+#include <algorithm>
 
 #include "EventLoopImpl.h"
 #include "UdpSocketBase.h"
@@ -73,6 +74,11 @@
 
 using namespace kuma;
 
+namespace {
+    // datagrams handled by one batch send or receive
+    const int kMaxBatchCount = 64;
+}
+
 UdpSocketBase::UdpSocketBase(const EventLoopPtr &loop)
 : loop_(loop)
 {
@@ -141,6 +147,19 @@ KMError UdpSocketBase::bind(const std::string &bind_host, uint16_t bind_port, ui
         KUMA_ERRXTRACE("bind, bind error: "<<getLastError());
         return KMError::FAILED;
     }
+#ifdef KUMA_HAS_UDP_GSO
+    gro_ = false;
+    gro_len_ = gro_offset_ = 0;
+    if (udp_flags & UDP_FLAG_GRO) {
+        int opt_val = 1;
+        if (setsockopt(fd_, IPPROTO_UDP, UDP_GRO, &opt_val, sizeof(opt_val)) == 0) {
+            gro_ = true;
+            gro_buf_.resize(64*1024);
+        } else {
+            KUMA_WARNXTRACE("bind, failed to set UDP_GRO, err="<<getLastError());
+        }
+    }
+#endif
     
     sockaddr_storage ss_addr = {0};
 #if defined(KUMA_OS_LINUX) || defined(KUMA_OS_MAC)
@@ -438,6 +457,11 @@ int UdpSocketBase::receive(void* data, size_t length, char* ip, size_t ip_len, u
         KUMA_ERRXTRACE("receive, invalid fd");
         return -1;
     }
+#ifdef KUMA_HAS_UDP_GSO
+    if (gro_) {
+        return receiveGRO(data, length, ip, ip_len, port);
+    }
+#endif
     
     int ret = 0;
     sockaddr_storage ss_addr = {0};
@@ -473,6 +497,309 @@ int UdpSocketBase::receive(void* data, size_t length, char* ip, size_t ip_len, u
     return ret;
 }
 
+bool UdpSocketBase::getSendAddr(const char *ip, uint16_t port, sockaddr_storage &ss_addr)
+{
+    if (port != send_port_ || send_ip_ != ip) {
+        struct addrinfo hints = {0};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        hints.ai_flags = AI_NUMERICHOST|AI_ADDRCONFIG; // will block 10 seconds in some case if not set AI_ADDRCONFIG
+        if (km_set_sock_addr(ip, port, &hints, (struct sockaddr*)&send_addr_, sizeof(send_addr_)) != 0) {
+            send_ip_.clear();
+            return false;
+        }
+        send_ip_ = ip;
+        send_port_ = port;
+    }
+    ss_addr = send_addr_;
+    return true;
+}
+
+int UdpSocketBase::send(const UdpDatagram *dgrams, int count)
+{
+    if(INVALID_FD == fd_) {
+        KUMA_ERRXTRACE("send 3, invalid fd");
+        return -1;
+    }
+    if (!dgrams || count <= 0) {
+        return 0;
+    }
+#ifdef KUMA_OS_LINUX
+    count = std::min(count, kMaxBatchCount);
+    mmsgs_.resize(kMaxBatchCount);
+    mmsg_iovs_.resize(kMaxBatchCount);
+    mmsg_addrs_.resize(kMaxBatchCount);
+    for (int i = 0; i < count; ++i) {
+        if (!getSendAddr(dgrams[i].ip, dgrams[i].port, mmsg_addrs_[i])) {
+            KUMA_ERRXTRACE("send 3, invalid address, ip=" << dgrams[i].ip << ", port=" << dgrams[i].port);
+            if (0 == i) {
+                return -1;
+            }
+            count = i; // send the datagrams before it
+            break;
+        }
+        mmsg_iovs_[i].iov_base = dgrams[i].data;
+        mmsg_iovs_[i].iov_len = dgrams[i].length;
+        auto &hdr = mmsgs_[i].msg_hdr;
+        hdr.msg_name = &mmsg_addrs_[i];
+        hdr.msg_namelen = km_get_addr_length(mmsg_addrs_[i]);
+        hdr.msg_iov = &mmsg_iovs_[i];
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = nullptr;
+        hdr.msg_controllen = 0;
+        hdr.msg_flags = 0;
+        mmsgs_[i].msg_len = 0;
+    }
+    int ret = ::sendmmsg(fd_, &mmsgs_[0], count, 0);
+    if (ret < 0) {
+        if (EAGAIN == getLastError() || EWOULDBLOCK == getLastError()) {
+            ret = 0;
+        } else {
+            KUMA_ERRXTRACE("send 3, sendmmsg failed, err=" << getLastError());
+        }
+    }
+#else
+    int ret = 0;
+    for (; ret < count; ++ret) {
+        int r = send(dgrams[ret].data, dgrams[ret].length, dgrams[ret].ip, dgrams[ret].port);
+        if (r <= 0) {
+            if (0 == ret) {
+                return r;
+            }
+            break;
+        }
+    }
+#endif
+    if (ret >= 0 && ret < count) {
+        notifySendBlocked();
+    }
+    return ret;
+}
+
+int UdpSocketBase::receive(UdpDatagram *dgrams, int count)
+{
+    if(INVALID_FD == fd_) {
+        KUMA_ERRXTRACE("receive 2, invalid fd");
+        return -1;
+    }
+    if (!dgrams || count <= 0) {
+        return 0;
+    }
+#ifdef KUMA_OS_LINUX
+    if (!gro_) { // coalesced datagrams are split by receiveGRO
+        return receiveMmsg(dgrams, count);
+    }
+#endif
+    int ret = 0;
+    for (; ret < count; ++ret) {
+        int r = receive(dgrams[ret].data, dgrams[ret].size, dgrams[ret].ip, sizeof(dgrams[ret].ip), dgrams[ret].port);
+        if (r <= 0) {
+            if (0 == ret) {
+                return r;
+            }
+            break;
+        }
+        dgrams[ret].length = r;
+    }
+    return ret;
+}
+
+#ifdef KUMA_OS_LINUX
+int UdpSocketBase::receiveMmsg(UdpDatagram *dgrams, int count)
+{
+    count = std::min(count, kMaxBatchCount);
+    mmsgs_.resize(kMaxBatchCount);
+    mmsg_iovs_.resize(kMaxBatchCount);
+    mmsg_addrs_.resize(kMaxBatchCount);
+    for (int i = 0; i < count; ++i) {
+        mmsg_iovs_[i].iov_base = dgrams[i].data;
+        mmsg_iovs_[i].iov_len = dgrams[i].size;
+        auto &hdr = mmsgs_[i].msg_hdr;
+        hdr.msg_name = &mmsg_addrs_[i];
+        hdr.msg_namelen = sizeof(sockaddr_storage);
+        hdr.msg_iov = &mmsg_iovs_[i];
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = nullptr;
+        hdr.msg_controllen = 0;
+        hdr.msg_flags = 0;
+        mmsgs_[i].msg_len = 0;
+    }
+    int ret = ::recvmmsg(fd_, &mmsgs_[0], count, 0, nullptr);
+    if (ret < 0) {
+        if (EAGAIN == getLastError() || EWOULDBLOCK == getLastError()) {
+            ret = 0;
+        } else {
+            KUMA_ERRXTRACE("receive 2, recvmmsg failed, err=" << getLastError());
+        }
+        return ret;
+    }
+    for (int i = 0; i < ret; ++i) {
+        // msg_len is the datagram length if it's truncated
+        dgrams[i].length = std::min<size_t>(mmsgs_[i].msg_len, dgrams[i].size);
+        dgrams[i].port = 0;
+        km_get_sock_addr((struct sockaddr*)&mmsg_addrs_[i], sizeof(sockaddr_storage), dgrams[i].ip, sizeof(dgrams[i].ip), &dgrams[i].port);
+    }
+    return ret;
+}
+#endif
+
+int UdpSocketBase::sendSegments(const void* data, size_t length, uint16_t segment_size, const char* host, uint16_t port)
+{
+    if(INVALID_FD == fd_) {
+        KUMA_ERRXTRACE("sendSegments, invalid fd");
+        return -1;
+    }
+    if (!data || 0 == segment_size || !host) {
+        return -1;
+    }
+    if (length <= segment_size) {
+        return send(data, length, host, port);
+    }
+    auto *ptr = static_cast<const uint8_t*>(data);
+#ifdef KUMA_HAS_UDP_GSO
+    if (gso_) {
+        int ret = sendGSO(ptr, length, segment_size, host, port);
+        if (gso_) {
+            return ret;
+        }
+        // UDP_SEGMENT is not supported, send the segments in batches
+    }
+#endif
+    UdpDatagram dgrams[kMaxBatchCount];
+    size_t bytes_sent = 0;
+    while (bytes_sent < length) {
+        int count = 0;
+        size_t offset = bytes_sent;
+        for (; count < kMaxBatchCount && offset < length; ++count) {
+            dgrams[count].data = const_cast<uint8_t*>(ptr + offset);
+            dgrams[count].length = std::min<size_t>(segment_size, length - offset);
+            strncpy(dgrams[count].ip, host, sizeof(dgrams[count].ip) - 1);
+            dgrams[count].port = port;
+            offset += dgrams[count].length;
+        }
+        int ret = send(dgrams, count);
+        if (ret < 0) {
+            return bytes_sent > 0 ? int(bytes_sent) : -1;
+        }
+        for (int i = 0; i < ret; ++i) {
+            bytes_sent += dgrams[i].length;
+        }
+        if (ret < count) {
+            break;
+        }
+    }
+    return int(bytes_sent);
+}
+
+#ifdef KUMA_HAS_UDP_GSO
+int UdpSocketBase::sendGSO(const uint8_t* data, size_t length, uint16_t segment_size, const char* host, uint16_t port)
+{
+    // the segments of one send are in a single skb, the payload is at most 64KB
+    const size_t kMaxSegments = 64;
+    const size_t max_payload = 65535 - 40 - 8;
+    size_t max_bytes = std::min(kMaxSegments, max_payload / segment_size) * segment_size;
+    if (0 == max_bytes) {
+        KUMA_ERRXTRACE("sendGSO, invalid segment size, size="<<segment_size);
+        return -1;
+    }
+    sockaddr_storage ss_addr;
+    if (!getSendAddr(host, port, ss_addr)) {
+        KUMA_ERRXTRACE("sendGSO, invalid address, host=" << host << ", port=" << port);
+        return -1;
+    }
+    size_t bytes_sent = 0;
+    while (bytes_sent < length) {
+        size_t len = std::min(length - bytes_sent, max_bytes);
+        iovec iov;
+        iov.iov_base = const_cast<uint8_t*>(data + bytes_sent);
+        iov.iov_len = len;
+        char ctrl[CMSG_SPACE(sizeof(uint16_t))] = {0};
+        msghdr send_msg = {0};
+        send_msg.msg_name = &ss_addr;
+        send_msg.msg_namelen = km_get_addr_length(ss_addr);
+        send_msg.msg_iov = &iov;
+        send_msg.msg_iovlen = 1;
+        if (len > segment_size) {
+            send_msg.msg_control = ctrl;
+            send_msg.msg_controllen = sizeof(ctrl);
+            cmsghdr *cmsg = CMSG_FIRSTHDR(&send_msg);
+            cmsg->cmsg_level = IPPROTO_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+        }
+        int ret = (int)::sendmsg(fd_, &send_msg, 0);
+        if (ret < 0) {
+            auto err = getLastError();
+            if (EAGAIN == err || EWOULDBLOCK == err) {
+                break;
+            }
+            if (0 == bytes_sent && (EIO == err || EINVAL == err || ENOPROTOOPT == err || EOPNOTSUPP == err)) {
+                // EIO if the device has no checksum offload
+                KUMA_WARNXTRACE("sendGSO, UDP_SEGMENT is not supported, err=" << err);
+                gso_ = false;
+                return -1;
+            }
+            KUMA_ERRXTRACE("sendGSO, failed, err=" << err << ", host=" << host << ", port=" << port);
+            return bytes_sent > 0 ? int(bytes_sent) : -1;
+        }
+        bytes_sent += ret;
+    }
+    if (bytes_sent < length) {
+        notifySendBlocked();
+    }
+    return int(bytes_sent);
+}
+
+int UdpSocketBase::receiveGRO(void* data, size_t length, char* ip, size_t ip_len, uint16_t& port)
+{
+    if (gro_offset_ >= gro_len_) {
+        iovec iov;
+        iov.iov_base = &gro_buf_[0];
+        iov.iov_len = gro_buf_.size();
+        char ctrl[CMSG_SPACE(sizeof(int))] = {0};
+        msghdr recv_msg = {0};
+        recv_msg.msg_name = &gro_addr_;
+        recv_msg.msg_namelen = sizeof(gro_addr_);
+        recv_msg.msg_iov = &iov;
+        recv_msg.msg_iovlen = 1;
+        recv_msg.msg_control = ctrl;
+        recv_msg.msg_controllen = sizeof(ctrl);
+        int ret = (int)::recvmsg(fd_, &recv_msg, 0);
+        if (0 == ret) {
+            KUMA_ERRXTRACE("receiveGRO, peer closed, err"<<getLastError());
+            return -1;
+        } else if (ret < 0) {
+            if (EAGAIN == getLastError() || EWOULDBLOCK == getLastError()) {
+                return 0;
+            }
+            KUMA_ERRXTRACE("receiveGRO, failed, err="<<getLastError());
+            return -1;
+        }
+        gro_len_ = ret;
+        gro_offset_ = 0;
+        gro_segment_ = gro_len_;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&recv_msg); cmsg; cmsg = CMSG_NXTHDR(&recv_msg, cmsg)) {
+            if (IPPROTO_UDP == cmsg->cmsg_level && UDP_GRO == cmsg->cmsg_type) {
+                int segment_size = 0;
+                memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+                if (segment_size > 0) {
+                    gro_segment_ = segment_size;
+                }
+                break;
+            }
+        }
+    }
+    size_t segment_len = std::min(gro_segment_, gro_len_ - gro_offset_);
+    size_t copy_len = std::min(segment_len, length);
+    memcpy(data, &gro_buf_[gro_offset_], copy_len);
+    gro_offset_ += segment_len;
+    port = 0;
+    km_get_sock_addr((struct sockaddr*)&gro_addr_, sizeof(gro_addr_), ip, (uint32_t)ip_len, &port);
+    return int(copy_len);
+}
+#endif
+
 KMError UdpSocketBase::close()
 {
     KUMA_INFOXTRACE("close");
@@ -29,10 +29,20 @@
 #include "util/DestroyDetector.h"
 #include "EventLoopImpl.h"
 #include <stdint.h>
+#include <string>
+#include <vector>
 #ifdef KUMA_OS_WIN
 # include <Ws2tcpip.h>
 #else
 # include <netinet/in.h>
+# include <sys/socket.h>
+#endif
+#ifdef KUMA_OS_LINUX
+# include <netinet/udp.h>
+#endif
+
+#if defined(KUMA_OS_LINUX) && defined(UDP_SEGMENT) && defined(UDP_GRO)
+# define KUMA_HAS_UDP_GSO
 #endif
 
 KUMA_NS_BEGIN
@@ -50,6 +60,9 @@ public:
     virtual int send(const iovec* iovs, int count, const std::string &host, uint16_t port);
     virtual int send(const KMBuffer &buf, const char* host, uint16_t port);
     virtual int receive(void* data, size_t length, char* ip, size_t ip_len, uint16_t& port);
+    int send(const UdpDatagram *dgrams, int count);
+    int receive(UdpDatagram *dgrams, int count);
+    int sendSegments(const void* data, size_t length, uint16_t segment_size, const char* host, uint16_t port);
     virtual KMError close();
     
     KMError mcastJoin(const std::string &mcast_addr, uint16_t mcast_port);
@@ -66,6 +79,14 @@ protected:
     virtual void onReceive(KMError err);
     virtual void onClose(KMError err);
     void cleanup();
+    bool getSendAddr(const char *ip, uint16_t port, sockaddr_storage &ss_addr);
+#ifdef KUMA_HAS_UDP_GSO
+    int sendGSO(const uint8_t* data, size_t length, uint16_t segment_size, const char* host, uint16_t port);
+    int receiveGRO(void* data, size_t length, char* ip, size_t ip_len, uint16_t& port);
+#endif
+#ifdef KUMA_OS_LINUX
+    int receiveMmsg(UdpDatagram *dgrams, int count);
+#endif
     virtual bool registerFd(SOCKET_FD fd);
     virtual void unregisterFd(SOCKET_FD fd, bool close_fd);
     virtual void ioReady(KMEvent events, void* ol, size_t io_size);
@@ -78,6 +99,7 @@ protected:
     EventLoopWeakPtr    loop_;
     bool                registered_{ false };
     uint32_t            flags_{ 0 };
+    bool                gro_{ false };
     
     EventCallback       read_cb_;
     EventCallback       error_cb_;
@@ -87,6 +109,25 @@ protected:
     uint16_t            mcast_port_;
     struct ip_mreq      mcast_req_v4_;
     struct ipv6_mreq    mcast_req_v6_;
+    
+    // the last destination of batch send, datagrams are mostly sent to few peers
+    std::string         send_ip_;
+    uint16_t            send_port_{ 0 };
+    sockaddr_storage    send_addr_;
+#ifdef KUMA_HAS_UDP_GSO
+    bool                gso_{ true }; // cleared if the kernel rejects UDP_SEGMENT
+    // the last coalesced datagram, it's returned segment by segment
+    std::vector<uint8_t>    gro_buf_;
+    size_t              gro_len_{ 0 };
+    size_t              gro_offset_{ 0 };
+    size_t              gro_segment_{ 0 };
+    sockaddr_storage    gro_addr_;
+#endif
+#ifdef KUMA_OS_LINUX
+    std::vector<mmsghdr>            mmsgs_;
+    std::vector<iovec>              mmsg_iovs_;
+    std::vector<sockaddr_storage>   mmsg_addrs_;
+#endif
 };
 
 KUMA_NS_END
@@ -125,6 +125,21 @@ int UdpSocket::Impl::receive(void *data, size_t length, char *ip, size_t ip_len,
     return socket_->receive(data, length, ip, ip_len, port);
 }
 
+int UdpSocket::Impl::send(const UdpDatagram *dgrams, int count)
+{
+    return socket_->send(dgrams, count);
+}
+
+int UdpSocket::Impl::receive(UdpDatagram *dgrams, int count)
+{
+    return socket_->receive(dgrams, count);
+}
+
+int UdpSocket::Impl::sendSegments(const void* data, size_t length, uint16_t segment_size, const char* host, uint16_t port)
+{
+    return socket_->sendSegments(data, length, segment_size, host, port);
+}
+
 KMError UdpSocket::Impl::close()
 {
     return socket_->close();
@@ -48,6 +48,9 @@ public:
     int send(const iovec* iovs, int count, const std::string &host, uint16_t port);
     int send(const KMBuffer &buf, const char* host, uint16_t port);
     int receive(void* data, size_t length, char* ip, size_t ip_len, uint16_t& port);
+    int send(const UdpDatagram *dgrams, int count);
+    int receive(UdpDatagram *dgrams, int count);
+    int sendSegments(const void* data, size_t length, uint16_t segment_size, const char* host, uint16_t port);
     KMError close();
     
     KMError mcastJoin(const std::string &mcast_addr, uint16_t mcast_port);
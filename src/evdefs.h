@@ -23,6 +23,7 @@
 #define __KUMAEVDEFS_H__
 
 #include "kmdefs.h"
+#include "kmfunction.h"
 #ifdef KUMA_OS_WIN
 # include <Ws2tcpip.h>
 #else
@@ -36,6 +37,8 @@ KUMA_NS_BEGIN
 #define KUMA_EV_WRITE   (1 << 1)
 #define KUMA_EV_ERROR   (1 << 2)
 #define KUMA_EV_NETWORK (KUMA_EV_READ|KUMA_EV_WRITE|KUMA_EV_ERROR)
+// register flag, wake up only one of the loops that poll a shared fd. EPoll only
+#define KUMA_EV_EXCLUSIVE   (1 << 3)
 
 #ifdef KUMA_OS_WIN
 # define SOCKET_FD   SOCKET
@@ -51,6 +54,9 @@ KUMA_NS_BEGIN
 
 using KMEvent = uint32_t;
 using IOCallback = std::function<void(KMEvent, void*, size_t)>;
+// the IO callback inside the library, the callback capturing one pointer (this)
+// is stored inline in the poll record
+using PollCallback = KMFunction<void(KMEvent, void*, size_t), sizeof(void*)>;
 
 enum class PollType {
     NONE,
@@ -59,7 +65,8 @@ enum class PollType {
     KQUEUE,
     SELECT,
     IOCP,
-    WIN
+    WIN,
+    IO_URING, // Linux only, fall back to default poll if kernel doesn't support it
 };
 
 KUMA_NS_END
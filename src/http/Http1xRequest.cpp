@@ -123,13 +123,13 @@ bool Http1xRequest::processHttpCache()
     int status_code = 0;
     HeaderVector rsp_headers;
     KMBuffer rsp_body;
-    if (HttpCache::instance().getCache(cache_key, status_code, rsp_headers, rsp_body)) {
+    auto loop = TcpConnection::eventLoop();
+    if (HttpCache::instance().getCache(cache_key, loop->now(), status_code, rsp_headers, rsp_body)) {
         // cache hit
         setState(State::RECVING_RESPONSE);
         rsp_parser_.setHeaders(std::move(rsp_headers));
         rsp_parser_.setStatusCode(status_code);
         rsp_cache_body_.reset(rsp_body.clone());
-        auto loop = TcpConnection::eventLoop();
         loop->post([this] { onCacheComplete(); }, &loop_token_);
         return true;
     }
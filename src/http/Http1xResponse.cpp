@@ -41,6 +41,9 @@ Http1xResponse::Http1xResponse(const EventLoopPtr &loop, std::string ver)
     rsp_message_.setBSender([this] (const KMBuffer &buf) -> int {
         return TcpConnection::send(buf);
     });
+    rsp_message_.setFSender([this] (int file_fd, int64_t offset, size_t len) -> int {
+        return TcpConnection::sendFile(file_fd, offset, len);
+    });
     KM_SetObjKey("Http1xResponse");
 }
 
@@ -169,6 +172,24 @@ int Http1xResponse::sendBody(const KMBuffer &buf)
     return ret;
 }
 
+int Http1xResponse::sendFileBody(int file_fd, int64_t offset, size_t len)
+{
+    if (rsp_message_.isChunked()) {
+        // each block is framed as a chunk
+        return HttpResponse::Impl::sendFileBody(file_fd, offset, len);
+    }
+    int ret = rsp_message_.sendFile(file_fd, offset, len);
+    if(ret < 0) {
+        setState(State::IN_ERROR);
+    } else if(ret >= 0) {
+        if (rsp_message_.isCompleted() && sendBufferEmpty()) {
+            setState(State::COMPLETE);
+            eventLoop()->post([this] { notifyComplete(); }, &loop_token_);
+        }
+    }
+    return ret;
+}
+
 void Http1xResponse::reset()
 {
     // reset TcpConnection
@@ -48,6 +48,7 @@ public:
     KMError sendResponse(int status_code, const std::string& desc, const std::string& ver) override;
     int sendBody(const void* data, size_t len) override;
     int sendBody(const KMBuffer &buf) override;
+    int sendFileBody(int file_fd, int64_t offset, size_t len) override;
     void reset() override; // reset for connection reuse
     KMError close() override;
     
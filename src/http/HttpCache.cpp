@@ -24,14 +24,13 @@
 
 KUMA_NS_USING
 
-bool HttpCache::getCache(const std::string &key, int &status_code, HeaderVector &headers, KMBuffer &body)
+bool HttpCache::getCache(const std::string &key, const time_point<steady_clock> &now_time, int &status_code, HeaderVector &headers, KMBuffer &body)
 {
     std::lock_guard<std::mutex> g(mutex_);
     auto it = caches_.find(key);
     if (it == caches_.end()) {
         return false;
     }
-    auto now_time = steady_clock::now();
     if (now_time > it->second.expire_time) {
         caches_.erase(it);
         return false;
@@ -38,7 +38,7 @@ KUMA_NS_BEGIN
 class HttpCache
 {
 public:
-    bool getCache(const std::string &key, int &status_code, HeaderVector &headers, KMBuffer &body);
+    bool getCache(const std::string &key, const time_point<steady_clock> &now, int &status_code, HeaderVector &headers, KMBuffer &body);
     //void setCache(const std::string &key, int status_code, HeaderVector headers, const uint8_t *body, size_t body_size);
     void setCache(const std::string &key, int status_code, HeaderVector headers, KMBuffer &body);
     
@@ -22,6 +22,7 @@
 #include "HttpMessage.h"
 
 #include <sstream>
+#include <algorithm>
 
 using namespace kuma;
 
@@ -63,6 +64,28 @@ int HttpMessage::sendData(const KMBuffer &buf)
     return ret;
 }
 
+int HttpMessage::sendFile(int file_fd, int64_t offset, size_t len)
+{
+    if(is_chunked_ || !fsender_) {
+        return 0;
+    }
+    if (has_content_length_) {
+        // sendfile sends what it is asked, the bytes beyond the body would corrupt the stream
+        len = std::min(len, content_length_ > body_bytes_sent_ ? content_length_ - body_bytes_sent_ : 0);
+    }
+    if (0 == len) {
+        return 0;
+    }
+    int ret = fsender_(file_fd, offset, len);
+    if(ret > 0) {
+        body_bytes_sent_ += ret;
+        if (has_body_ && has_content_length_ && body_bytes_sent_ >= content_length_) {
+            completed_ = true;
+        }
+    }
+    return ret;
+}
+
 int HttpMessage::sendChunk(const void* data, size_t len)
 {
     if(nullptr == data || 0 == len) { // chunk end
@@ -36,16 +36,20 @@ public:
     using MessageSender = std::function<int(const void*, size_t)>;
     using MessageVSender = std::function<int(const iovec*, int)>;
     using MessageBSender = std::function<int(const KMBuffer&)>;
+    using MessageFSender = std::function<int(int, int64_t, size_t)>;
     
     HttpMessage() : HttpHeader(true) {}
     int sendData(const void* data, size_t len);
     int sendData(const KMBuffer &buf);
+    // the body of file, not for chunked message
+    int sendFile(int file_fd, int64_t offset, size_t len);
     bool isCompleted() const { return !hasBody() || completed_; }
     void reset() override;
     
     void setSender(MessageSender sender) { sender_ = std::move(sender); }
     void setVSender(MessageVSender sender) { vsender_ = std::move(sender); }
     void setBSender(MessageBSender sender) { bsender_ = std::move(sender); }
+    void setFSender(MessageFSender sender) { fsender_ = std::move(sender); }
     
 protected:
     int sendChunk(const void* data, size_t len);
@@ -58,6 +62,7 @@ protected:
     MessageSender           sender_;
     MessageVSender          vsender_;
     MessageBSender          bsender_;
+    MessageFSender          fsender_;
 };
 
 KUMA_NS_END
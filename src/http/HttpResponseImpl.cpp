@@ -23,9 +23,11 @@
 #include "EventLoopImpl.h"
 #include "httputils.h"
 #include "util/kmtrace.h"
+#include "util/util.h"
 #include "compr/compr_zlib.h"
 
 #include <iterator>
+#include <algorithm>
 
 using namespace kuma;
 
@@ -273,6 +275,39 @@ int HttpResponse::Impl::sendData(const KMBuffer &buf)
     }
 }
 
+int HttpResponse::Impl::sendFile(int file_fd, int64_t offset, size_t len)
+{
+    if (!canSendBody()) {
+        return 0;
+    }
+    if (compressor_) {
+        return sendFileBlock(file_fd, offset, len);
+    }
+    return sendFileBody(file_fd, offset, len);
+}
+
+int HttpResponse::Impl::sendFileBody(int file_fd, int64_t offset, size_t len)
+{
+    return sendFileBlock(file_fd, offset, len);
+}
+
+int HttpResponse::Impl::sendFileBlock(int file_fd, int64_t offset, size_t len)
+{
+    // the block is read into the buffer that is sent or queued without copying again
+    static const size_t kFileBlockSize = 256*1024;
+    if (0 == len) {
+        return 0;
+    }
+    KMBuffer buf(std::min(len, kFileBlockSize));
+    int nread = read_file(file_fd, buf.writePtr(), buf.space(), offset);
+    if (nread <= 0) {
+        KUMA_ERRXTRACE("sendFileBlock, failed to read file, offset=" << offset << ", err=" << errno);
+        return -1;
+    }
+    buf.bytesWritten(nread);
+    return sendData(buf);
+}
+
 void HttpResponse::Impl::reset()
 {
     req_encoding_type_.clear();
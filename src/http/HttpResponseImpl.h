@@ -53,6 +53,7 @@ public:
     KMError sendResponse(int status_code, const std::string& desc);
     int sendData(const void* data, size_t len);
     int sendData(const KMBuffer &buf);
+    int sendFile(int file_fd, int64_t offset, size_t len);
     virtual void reset();
     virtual KMError close() = 0;
     
@@ -78,6 +79,9 @@ protected:
     virtual bool canSendBody() const = 0;
     virtual int sendBody(const void* data, size_t len) = 0;
     virtual int sendBody(const KMBuffer &buf) = 0;
+    // the file is read in blocks and sent by sendData if not overridden
+    virtual int sendFileBody(int file_fd, int64_t offset, size_t len);
+    int sendFileBlock(int file_fd, int64_t offset, size_t len);
     virtual void checkRequestHeaders();
     virtual void checkResponseHeaders();
     virtual const HttpHeader& getRequestHeader() const = 0;
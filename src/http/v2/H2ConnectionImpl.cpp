@@ -172,6 +172,38 @@ KMError H2Connection::Impl::attachStream(uint32_t stream_id, HttpResponse::Impl*
     return rsp->attachStream(this, stream_id);
 }
 
+KMError H2Connection::Impl::migrate(const EventLoopPtr &loop)
+{
+    auto old_loop = eventLoop();
+    if (!loop || !old_loop) {
+        return KMError::INVALID_PARAM;
+    }
+    if (loop == old_loop) {
+        return KMError::NOERR;
+    }
+    if (!isInSameThread()) {
+        KMError ret = KMError::INVALID_STATE;
+        auto err = old_loop->sync([&ret, &loop, this] {
+            ret = migrate(loop);
+        });
+        return err == KMError::NOERR ? ret : err;
+    }
+    // the streams are bound to the requests and responses on this loop,
+    // and the client connections are shared by the requests of this loop
+    if (!isReady() || !streams_.empty() || !promised_streams_.empty() ||
+        !push_clients_.empty() || !key_.empty()) {
+        return KMError::INVALID_STATE;
+    }
+    KUMA_INFOXTRACE("migrate");
+    return TcpConnection::migrate(loop, [this] (KMError) {
+        // on the thread of new loop
+        auto loop = eventLoop();
+        loop_token_.reset();
+        loop_token_.eventLoop(loop);
+        thread_id_ = loop->threadId();
+    });
+}
+
 KMError H2Connection::Impl::close()
 {
     KUMA_INFOXTRACE("close");
@@ -224,8 +256,7 @@ KMError H2Connection::Impl::sendH2Frame(H2Frame *frame)
     }
     KUMA_ASSERT(ret == (int)frameSize);
     buf.bytesWritten(ret);
-    appendSendBuffer(buf);
-    return sendBufferedData();
+    return sendOrBuffer(buf);
 }
 
 KMError H2Connection::Impl::sendHeadersFrame(HeadersFrame *frame)
@@ -248,8 +279,7 @@ KMError H2Connection::Impl::sendHeadersFrame(HeadersFrame *frame)
     ret = frame->encode((uint8_t*)buf.writePtr(), len1, bsize);
     KUMA_ASSERT(ret == (int)len1);
     buf.bytesWritten(len1 + bsize);
-    appendSendBuffer(buf);
-    return sendBufferedData();
+    return sendOrBuffer(buf);
 }
 
 H2StreamPtr H2Connection::Impl::createStream()
@@ -822,7 +852,7 @@ void H2Connection::Impl::onLoopActivity(LoopActivity acti)
     }
 }
 
-bool H2Connection::Impl::sync(EventLoop::Task task)
+bool H2Connection::Impl::sync(EventLoop::MoveTask task)
 {
     if (isInSameThread()) {
         task();
@@ -835,7 +865,7 @@ bool H2Connection::Impl::sync(EventLoop::Task task)
     return false;
 }
 
-bool H2Connection::Impl::async(EventLoop::Task task, EventLoopToken *token)
+bool H2Connection::Impl::async(EventLoop::MoveTask task, EventLoopToken *token)
 {
     if (isInSameThread()) {
         task();
@@ -58,6 +58,7 @@ public:
     KMError attachFd(SOCKET_FD fd, const KMBuffer *init_buf);
     KMError attachSocket(TcpSocket::Impl&& tcp, HttpParser::Impl&& parser, const KMBuffer *init_buf);
     KMError attachStream(uint32_t stream_id, HttpResponse::Impl* rsp);
+    KMError migrate(const EventLoopPtr &loop);
     PushClient* getPushClient(const std::string &cache_key);
     KMError close();
     void setAcceptCallback(AcceptCallback cb) { accept_cb_ = std::move(cb); }
@@ -83,8 +84,8 @@ public:
     
     void onLoopActivity(LoopActivity acti);
     
-    bool sync(EventLoop::Task task);
-    bool async(EventLoop::Task task, EventLoopToken *token=nullptr);
+    bool sync(EventLoop::MoveTask task);
+    bool async(EventLoop::MoveTask task, EventLoopToken *token=nullptr);
     bool isInSameThread() const { return std::this_thread::get_id() == thread_id_; }
     
     void connectionError(H2Error err);
@@ -136,7 +136,7 @@ bool Http2Request::processHttpCache(const EventLoopPtr &loop)
     int status_code = 0;
     HeaderVector rsp_headers;
     KMBuffer rsp_body;
-    if (HttpCache::instance().getCache(cache_key, status_code, rsp_headers, rsp_body)) {
+    if (HttpCache::instance().getCache(cache_key, loop->now(), status_code, rsp_headers, rsp_body)) {
         // cache hit
         setState(State::RECVING_RESPONSE);
         status_code_ = status_code;
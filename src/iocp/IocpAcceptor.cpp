@@ -56,9 +56,9 @@ void IocpAcceptor::unregisterFd(SOCKET_FD fd, bool close_fd)
     IocpBase::unregisterFd(loop_.lock(), fd, close_fd);
 }
 
-KMError IocpAcceptor::listen(const std::string &host, uint16_t port)
+KMError IocpAcceptor::listen(const std::string &host, uint16_t port, uint32_t flags)
 {
-    auto ret = AcceptorBase::listen(host, port);
+    auto ret = AcceptorBase::listen(host, port, flags);
     if (ret != KMError::NOERR) {
         return ret;
     }
@@ -35,7 +35,7 @@ class IocpAcceptor : public AcceptorBase, public IocpBase
 public:
     IocpAcceptor(const EventLoopPtr &loop);
     ~IocpAcceptor();
-    KMError listen(const std::string &host, uint16_t port) override;
+    KMError listen(const std::string &host, uint16_t port, uint32_t flags = 0) override;
     
 protected:
     void onAccept() override;
@@ -104,9 +104,9 @@ KMError IocpSocket::connect_i(const sockaddr_storage &ss_addr, uint32_t timeout_
     return KMError::NOERR;
 }
 
-KMError IocpSocket::attachFd(SOCKET_FD fd)
+KMError IocpSocket::attachFd(SOCKET_FD fd, uint32_t flags)
 {
-    SocketBase::attachFd(fd);
+    SocketBase::attachFd(fd, flags);
     postRecvOperation(fd_);
     return KMError::NOERR;
 }
@@ -37,7 +37,7 @@ public:
     IocpSocket(const EventLoopPtr &loop);
     ~IocpSocket();
 
-    KMError attachFd(SOCKET_FD fd) override;
+    KMError attachFd(SOCKET_FD fd, uint32_t flags = 0) override;
     KMError detachFd(SOCKET_FD &fd) override;
     int send(const void* data, size_t length) override;
     int send(const iovec* iovs, int count) override;
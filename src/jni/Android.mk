@@ -30,15 +30,20 @@ MY_ZLIB_SRC_FILES := \
 
 LOCAL_SRC_FILES := \
     EventLoopImpl.cpp \
+    EventLoopGroupImpl.cpp \
+    LoopWatchdog.cpp \
     AcceptorBase.cpp \
     SocketBase.cpp \
     UdpSocketBase.cpp \
     TcpSocketImpl.cpp \
     UdpSocketImpl.cpp \
     TimerManager.cpp \
+    HighResTimerImpl.cpp \
     TcpListenerImpl.cpp \
     TcpConnection.cpp \
     poll/EPoll.cpp \
+    poll/IoUring.cpp \
+    poll/SharedEPoll.cpp \
     poll/VPoll.cpp \
     poll/SelectPoll.cpp \
     poll/Notifier.cpp \
@@ -20,10 +20,12 @@
  */
 
 #include "EventLoopImpl.h"
+#include "EventLoopGroupImpl.h"
 #include "TcpSocketImpl.h"
 #include "UdpSocketImpl.h"
 #include "TcpListenerImpl.h"
 #include "TimerManager.h"
+#include "HighResTimerImpl.h"
 #include "http/HttpParserImpl.h"
 #include "http/Http1xRequest.h"
 #include "http/Http1xResponse.h"
@@ -139,6 +141,11 @@ bool EventLoop::isPollLT() const
     return  pimpl_->isPollLT();
 }
 
+bool EventLoop::inSameThread() const
+{
+    return pimpl_->inSameThread();
+}
+
 KMError EventLoop::registerFd(SOCKET_FD fd, uint32_t events, IOCallback cb)
 {
     return pimpl_->registerFd(fd, events, std::move(cb));
@@ -169,6 +176,117 @@ void EventLoop::stop()
     pimpl_->stop();
 }
 
+void EventLoop::Histogram::record(uint64_t value)
+{
+    ++counts[bucketIndex(value)];
+    ++total;
+    if (value > max) {
+        max = value;
+    }
+}
+
+uint64_t EventLoop::Histogram::percentile(double p) const
+{
+    if (0 == total) {
+        return 0;
+    }
+    uint64_t target = uint64_t(total * p / 100);
+    if (target < 1) {
+        target = 1;
+    } else if (target > total) {
+        target = total;
+    }
+    uint64_t count = 0;
+    for (int i = 0; i < kBucketCount; ++i) {
+        count += counts[i];
+        if (count >= target) {
+            auto value = bucketUpperBound(i);
+            return value < max ? value : max;
+        }
+    }
+    return max;
+}
+
+int EventLoop::Histogram::bucketIndex(uint64_t value)
+{
+    const int sub_count = 1 << kSubBucketBits;
+    if (value < 2 * sub_count) {
+        return int(value);
+    }
+#if defined(__GNUC__) || defined(__clang__)
+    int msb = 63 - __builtin_clzll(value);
+#else
+    int msb = 0;
+    while (value >> (msb + 1)) {
+        ++msb;
+    }
+#endif
+    int shift = msb - kSubBucketBits;
+    int index = (shift + 1) * sub_count + int((value >> shift) & (sub_count - 1));
+    return index < kBucketCount ? index : kBucketCount - 1;
+}
+
+uint64_t EventLoop::Histogram::bucketUpperBound(int index)
+{
+    const int sub_count = 1 << kSubBucketBits;
+    if (index < 2 * sub_count) {
+        return index;
+    }
+    int shift = index / sub_count - 1;
+    uint64_t lower = uint64_t(sub_count + index % sub_count) << shift;
+    return lower + (uint64_t(1) << shift) - 1;
+}
+
+void EventLoop::setBusyPoll(uint32_t spin_us, uint32_t sock_busy_poll_us)
+{
+    pimpl_->setBusyPoll(spin_us, sock_busy_poll_us);
+}
+
+void EventLoop::setWatchdog(uint32_t threshold_ms)
+{
+    pimpl_->setWatchdog(threshold_ms);
+}
+
+void EventLoop::setTaskBudget(TaskPriority priority, uint32_t max_tasks)
+{
+    pimpl_->setTaskBudget(priority, max_tasks);
+}
+
+void EventLoop::setPollBatch(uint32_t min_events, uint32_t max_events)
+{
+    pimpl_->setPollBatch(min_events, max_events);
+}
+
+void EventLoop::setReadBudget(uint32_t max_bytes)
+{
+    pimpl_->setReadBudget(max_bytes);
+}
+
+void EventLoop::setWriteCoalescing(bool enable)
+{
+    pimpl_->setWriteCoalescing(enable);
+}
+
+KMError EventLoop::setIOThreads(uint32_t io_threads)
+{
+    return pimpl_->setIOThreads(io_threads);
+}
+
+std::chrono::steady_clock::time_point EventLoop::now() const
+{
+    return pimpl_->now();
+}
+
+EventLoop::Stats EventLoop::getStats() const
+{
+    return pimpl_->getStats();
+}
+
+uint32_t EventLoop::getLoad() const
+{
+    return pimpl_->getLoad();
+}
+
 EventLoop::Impl* EventLoop::pimpl()
 {
     return pimpl_;
@@ -179,14 +297,43 @@ KMError EventLoop::sync(Task task)
     return pimpl_->sync(std::move(task));
 }
 
-KMError EventLoop::async(Task task, Token *token)
+KMError EventLoop::async(Task task, Token *token, TaskPriority priority)
+{
+    return pimpl_->async(std::move(task), token?token->pimpl():nullptr, priority);
+}
+
+KMError EventLoop::post(Task task, Token *token, TaskPriority priority)
+{
+    return pimpl_->post(std::move(task), token?token->pimpl():nullptr, priority);
+}
+
+KMError EventLoop::async(MoveTask &&task, Token *token, TaskPriority priority)
+{
+    return pimpl_->async(std::move(task), token?token->pimpl():nullptr, priority);
+}
+
+KMError EventLoop::post(MoveTask &&task, Token *token, TaskPriority priority)
+{
+    return pimpl_->post(std::move(task), token?token->pimpl():nullptr, priority);
+}
+
+KMError EventLoop::post(std::vector<Task> &&tasks, Token *token)
 {
-    return pimpl_->async(std::move(task), token?token->pimpl():nullptr);
+    std::vector<MoveTask> move_tasks;
+    move_tasks.reserve(tasks.size());
+    for (auto &task : tasks) {
+        move_tasks.emplace_back(std::move(task));
+    }
+    auto ret = pimpl_->post(std::move(move_tasks), token?token->pimpl():nullptr);
+    if (ret == KMError::NOERR) {
+        tasks.clear();
+    }
+    return ret;
 }
 
-KMError EventLoop::post(Task task, Token *token)
+KMError EventLoop::post(std::vector<MoveTask> &&tasks, Token *token)
 {
-    return pimpl_->post(std::move(task), token?token->pimpl():nullptr);
+    return pimpl_->post(std::move(tasks), token?token->pimpl():nullptr);
 }
 
 void EventLoop::cancel(Token *token)
@@ -234,6 +381,53 @@ EventLoop::Token::Impl* EventLoop::Token::pimpl()
     return pimpl_;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+EventLoopGroup::EventLoopGroup(PollType poll_type)
+: pimpl_(new Impl(poll_type))
+{
+    
+}
+
+EventLoopGroup::~EventLoopGroup()
+{
+    delete pimpl_;
+}
+
+bool EventLoopGroup::init(int count, bool pin_cpu)
+{
+    return pimpl_->init(count, pin_cpu);
+}
+
+void EventLoopGroup::stop()
+{
+    pimpl_->stop();
+}
+
+int EventLoopGroup::size() const
+{
+    return pimpl_->size();
+}
+
+EventLoop* EventLoopGroup::getLoop(int index) const
+{
+    return pimpl_->getLoop(index);
+}
+
+EventLoop* EventLoopGroup::getNextLoop()
+{
+    return pimpl_->getNextLoop();
+}
+
+EventLoop* EventLoopGroup::getLeastLoadedLoop()
+{
+    return pimpl_->getLeastLoadedLoop();
+}
+
+EventLoopGroup::Impl* EventLoopGroup::pimpl()
+{
+    return pimpl_;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 TcpSocket::TcpSocket(EventLoop* loop)
 : pimpl_(new Impl(EventLoopHelper::implPtr(loop->pimpl())))
@@ -289,9 +483,9 @@ KMError TcpSocket::connect(const char* host, uint16_t port, EventCallback cb, ui
     return pimpl_->connect(host, port, std::move(cb), timeout);
 }
 
-KMError TcpSocket::attachFd(SOCKET_FD fd)
+KMError TcpSocket::attachFd(SOCKET_FD fd, uint32_t flags)
 {
-    return pimpl_->attachFd(fd);
+    return pimpl_->attachFd(fd, flags);
 }
 
 KMError TcpSocket::detachFd(SOCKET_FD &fd)
@@ -299,6 +493,14 @@ KMError TcpSocket::detachFd(SOCKET_FD &fd)
     return pimpl_->detachFd(fd);
 }
 
+KMError TcpSocket::migrate(EventLoop *loop)
+{
+    if (!loop) {
+        return KMError::INVALID_PARAM;
+    }
+    return pimpl_->migrate(EventLoopHelper::implPtr(loop->pimpl()));
+}
+
 KMError TcpSocket::startSslHandshake(SslRole ssl_role)
 {
 #ifdef KUMA_HAS_OPENSSL
@@ -341,6 +543,11 @@ int TcpSocket::send(const KMBuffer &buf)
     return pimpl_->send(buf);
 }
 
+int TcpSocket::sendFile(int file_fd, int64_t offset, size_t length)
+{
+    return pimpl_->sendFile(file_fd, offset, length);
+}
+
 int TcpSocket::receive(void* data, size_t length)
 {
     return pimpl_->receive(data, length);
@@ -361,6 +568,11 @@ KMError TcpSocket::resume()
     return pimpl_->resume();
 }
 
+KMError TcpSocket::setZeroCopy(size_t threshold)
+{
+    return pimpl_->setZeroCopy(threshold);
+}
+
 void TcpSocket::setReadCallback(EventCallback cb)
 {
     pimpl_->setReadCallback(std::move(cb));
@@ -392,6 +604,15 @@ TcpListener::TcpListener(EventLoop* loop)
 {
 
 }
+
+TcpListener::TcpListener(EventLoopGroup* group)
+{
+    std::vector<EventLoopPtr> loops;
+    for (int i = 0; i < group->size(); ++i) {
+        loops.emplace_back(EventLoopHelper::implPtr(group->getLoop(i)->pimpl()));
+    }
+    pimpl_ = new Impl(loops);
+}
 TcpListener::~TcpListener()
 {
     delete pimpl_;
@@ -415,11 +636,31 @@ KMError TcpListener::close()
     return pimpl_->close();
 }
 
+KMError TcpListener::setSharedListenSocket(bool shared)
+{
+    return pimpl_->setSharedListenSocket(shared);
+}
+
+KMError TcpListener::setBacklog(int backlog)
+{
+    return pimpl_->setBacklog(backlog);
+}
+
+void TcpListener::setAcceptBatch(uint32_t max_accepts)
+{
+    pimpl_->setAcceptBatch(max_accepts);
+}
+
 void TcpListener::setAcceptCallback(AcceptCallback cb)
 {
     pimpl_->setAcceptCallback(std::move(cb));
 }
 
+void TcpListener::setAcceptAddrCallback(AcceptAddrCallback cb)
+{
+    pimpl_->setAcceptAddrCallback(std::move(cb));
+}
+
 void TcpListener::setErrorCallback(ErrorCallback cb)
 {
     pimpl_->setErrorCallback(std::move(cb));
@@ -470,6 +711,21 @@ int UdpSocket::receive(void* data, size_t length, char* ip, size_t ip_len, uint1
     return pimpl_->receive(data, length, ip, ip_len, port);
 }
 
+int UdpSocket::send(const UdpDatagram *dgrams, int count)
+{
+    return pimpl_->send(dgrams, count);
+}
+
+int UdpSocket::receive(UdpDatagram *dgrams, int count)
+{
+    return pimpl_->receive(dgrams, count);
+}
+
+int UdpSocket::sendSegments(const void *data, size_t length, uint16_t segment_size, const char *host, uint16_t port)
+{
+    return pimpl_->sendSegments(data, length, segment_size, host, port);
+}
+
 KMError UdpSocket::close()
 {
     return pimpl_->close();
@@ -521,7 +777,12 @@ Timer::~Timer()
 
 bool Timer::schedule(uint32_t delay_ms, TimerMode mode, TimerCallback cb)
 {
-    return pimpl_->schedule(delay_ms, mode, std::move(cb));
+    return pimpl_->schedule(delay_ms, 0, mode, std::move(cb));
+}
+
+bool Timer::schedule(uint32_t delay_ms, uint32_t slack_ms, TimerMode mode, TimerCallback cb)
+{
+    return pimpl_->schedule(delay_ms, slack_ms, mode, std::move(cb));
 }
 
 void Timer::cancel()
@@ -534,6 +795,34 @@ Timer::Impl* Timer::pimpl()
     return pimpl_;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+HighResTimer::HighResTimer(EventLoop* loop)
+: pimpl_(new Impl(EventLoopHelper::implPtr(loop->pimpl())))
+{
+    
+}
+
+HighResTimer::~HighResTimer()
+{
+    delete pimpl_;
+}
+
+bool HighResTimer::schedule(uint32_t delay_us, TimerMode mode, TimerCallback cb)
+{
+    return pimpl_->schedule(delay_us, mode, std::move(cb));
+}
+
+void HighResTimer::cancel()
+{
+    pimpl_->cancel();
+}
+
+HighResTimer::Impl* HighResTimer::pimpl()
+{
+    return pimpl_;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 HttpParser::HttpParser()
 : pimpl_(new Impl())
@@ -856,6 +1145,11 @@ int HttpResponse::sendData(const KMBuffer &buf)
     return pimpl_->sendData(buf);
 }
 
+int HttpResponse::sendFile(int file_fd, int64_t offset, size_t length)
+{
+    return pimpl_->sendFile(file_fd, offset, length);
+}
+
 void HttpResponse::reset()
 {
     pimpl_->reset();
@@ -1031,6 +1325,14 @@ int WebSocket::send(const KMBuffer &buf, bool is_text, bool is_fin, uint32_t fla
     return pimpl_->send(buf, is_text, is_fin, flags);
 }
 
+KMError WebSocket::migrate(EventLoop *loop)
+{
+    if (!loop) {
+        return KMError::INVALID_PARAM;
+    }
+    return pimpl_->migrate(EventLoopHelper::implPtr(loop->pimpl()));
+}
+
 KMError WebSocket::close()
 {
     return pimpl_->close();
@@ -1123,6 +1425,14 @@ KMError H2Connection::attachStream(uint32_t stream_id, HttpResponse* rsp)
     return pimpl_->attachStream(stream_id, rsp->pimpl());
 }
 
+KMError H2Connection::migrate(EventLoop *loop)
+{
+    if (!loop) {
+        return KMError::INVALID_PARAM;
+    }
+    return pimpl_->migrate(EventLoopHelper::implPtr(loop->pimpl()));
+}
+
 KMError H2Connection::close()
 {
     return pimpl_->close();
@@ -25,8 +25,11 @@
 #include "kmdefs.h"
 #include "evdefs.h"
 #include "kmbuffer.h"
+#include "kmfunction.h"
 
 #include <stdint.h>
+#include <vector>
+#include <chrono>
 #ifdef KUMA_OS_WIN
 # include <Ws2tcpip.h>
 #else
@@ -41,6 +44,15 @@ class KUMA_API EventLoop
 {
 public:
     using Task = std::function<void(void)>;
+    /* MoveTask is move-only, the callable up to 112 bytes is stored inline without
+     * heap allocation. the lambdas passed to async and post are stored as MoveTask,
+     * so they can have move-only captures
+     */
+    using MoveTask = KMFunction<void(void)>;
+    template <typename F>
+    using EnableIfCallable = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, Task>::value &&
+        !std::is_same<typename std::decay<F>::type, MoveTask>::value>::type;
     
     class Token {
     public:
@@ -61,6 +73,52 @@ public:
         Impl* pimpl_;
     };
     
+    /* HDR style histogram with log-linear buckets. each value less than 16 has its own
+     * bucket, and each power of two range above is split into 8 buckets, so the relative
+     * error of a recorded value is less than 12.5%
+     */
+    struct KUMA_API Histogram {
+        static const int kSubBucketBits = 3;
+        static const int kBucketCount = 272; // values up to 2^36
+        
+        uint64_t counts[kBucketCount] = {0};
+        uint64_t total = 0;
+        uint64_t max = 0;
+        
+        void record(uint64_t value);
+        
+        /* get the value at percentile p (0 ~ 100), it is the upper bound of
+         * the bucket that the value falls in
+         */
+        uint64_t percentile(double p) const;
+        
+        static int bucketIndex(uint64_t value);
+        static uint64_t bucketUpperBound(int index);
+    };
+    
+    struct Stats {
+        uint64_t notify_issued = 0; // wakeups written to the poll notifier
+        uint64_t notify_elided = 0; // wakeups skipped since loop was awake or already notified
+        
+        uint64_t iterations = 0;
+        uint64_t wait_time_ns = 0;  // time blocked in IOPoll waiting for events
+        uint64_t io_time_ns = 0;    // time running IO callbacks
+        uint64_t task_time_ns = 0;  // time running tasks
+        uint64_t timer_time_ns = 0; // time running timers
+        uint64_t max_tasks_per_iteration = 0; // max tasks executed in one iteration
+        uint64_t fd_count = 0;      // fds registered currently
+        uint64_t read_deferred = 0; // socket reads or accepts resumed in next iteration by read budget or accept batch
+        uint64_t flush_count = 0;   // connections flushed at the end of iterations by write coalescing
+        Histogram iteration_latency; // time in ns that each iteration runs tasks, timers and IO
+        
+        // busy poll mode, see setBusyPoll
+        uint64_t spin_count = 0;    // spin phases before blocking in IOPoll
+        uint64_t spin_hits = 0;     // spin phases that found IO events, tasks or timers
+        uint64_t spin_time_ns = 0;  // time spent in spinning
+        uint64_t sleep_count = 0;   // blocking waits in IOPoll
+        uint64_t sleep_time_ns = 0; // time blocked in IOPoll
+    };
+    
 public:
     EventLoop(PollType poll_type = PollType::NONE);
     ~EventLoop();
@@ -101,16 +159,41 @@ public:
      * @param task the task to be executed. it will always be executed when call success
      * @param token to be used to cancel the task. If token is null, the caller should
      *              make sure the resources referenced by task are valid when task running
+     * @param priority lane of the task when it is queued from other threads
+     * the callables other than Task are stored as MoveTask without std::function
      */
-    KMError async(Task task, Token *token=nullptr);
+    KMError async(Task task, Token *token=nullptr, TaskPriority priority=TaskPriority::NORMAL);
+    KMError async(MoveTask &&task, Token *token=nullptr, TaskPriority priority=TaskPriority::NORMAL);
+    template <typename F, typename = EnableIfCallable<F>>
+    KMError async(F &&f, Token *token=nullptr, TaskPriority priority=TaskPriority::NORMAL)
+    {
+        return async(MoveTask(std::forward<F>(f)), token, priority);
+    }
     
     /* run the task in loop thread at next time.
      *
      * @param task the task to be executed. it will always be executed when call success
      * @param token to be used to cancel the task. If token is null, the caller should
      *              make sure the resources referenced by task are valid when task running
+     * @param priority lane of the task, the urgent tasks are executed before the others
+     * the callables other than Task are stored as MoveTask without std::function
      */
-    KMError post(Task task, Token *token=nullptr);
+    KMError post(Task task, Token *token=nullptr, TaskPriority priority=TaskPriority::NORMAL);
+    KMError post(MoveTask &&task, Token *token=nullptr, TaskPriority priority=TaskPriority::NORMAL);
+    template <typename F, typename = EnableIfCallable<F>>
+    KMError post(F &&f, Token *token=nullptr, TaskPriority priority=TaskPriority::NORMAL)
+    {
+        return post(MoveTask(std::forward<F>(f)), token, priority);
+    }
+    
+    /* run the tasks in loop thread at next time. the tasks are queued at once with
+     * one wakeup, and will be executed contiguously in order
+     *
+     * @param tasks the tasks to be executed, they are moved into loop when call success
+     * @param token to be used to cancel the tasks
+     */
+    KMError post(std::vector<Task> &&tasks, Token *token=nullptr);
+    KMError post(std::vector<MoveTask> &&tasks, Token *token=nullptr);
     
     /* cancel the tasks that are scheduled with token. you cannot cancel the task that is in running,
      * but will wait untill the task completion
@@ -123,6 +206,94 @@ public:
     void loop(uint32_t max_wait_ms = -1);
     void stop();
     
+    /* busy poll mode. before blocking in IOPoll, the loop spins on polling IO without
+     * waiting and checking the tasks and timers. the spin time is halved each time the
+     * spinning finds nothing, and is restored when the spinning finds work or an event
+     * arrives within spin_us after the loop blocks.
+     * it should be called before loop running or on loop thread
+     *
+     * @param spin_us max spin time in microseconds of each iteration, 0 to disable busy poll
+     * @param sock_busy_poll_us set SO_BUSY_POLL to this value on the sockets registered
+     *                          afterwards, Linux only. 0 to leave the sockets unchanged
+     */
+    void setBusyPoll(uint32_t spin_us, uint32_t sock_busy_poll_us = 0);
+    
+    /* enable the slow callback watchdog. the IO callback, task or timer that runs longer
+     * than threshold_ms is reported through the trace function, a shared watchdog thread
+     * also reports the callback that is still blocking the loop.
+     * it should be called before loop running or on loop thread
+     *
+     * @param threshold_ms 0 to disable the watchdog
+     */
+    void setWatchdog(uint32_t threshold_ms);
+    
+    /* set the max number of tasks of a lane executed in one loop iteration, the rest
+     * are deferred to next iteration after IO is processed. the urgent lane is not
+     * budgeted, the idle lane runs 64 tasks per iteration by default.
+     * it should be called before loop running or on loop thread
+     *
+     * @param priority NORMAL or IDLE
+     * @param max_tasks 0 for no limit
+     */
+    void setTaskBudget(TaskPriority priority, uint32_t max_tasks);
+    
+    /* set the range of the IO events fetched by one poll wait. the batch doubles when
+     * a wait fills it, and halves when the waits keep using less than a quarter of it.
+     * EPoll only, the default range is 64 ~ 4096.
+     * it should be called before loop running or on loop thread
+     *
+     * @param min_events the initial and min batch size
+     * @param max_events the max batch size, set it to min_events for a fixed batch
+     */
+    void setPollBatch(uint32_t min_events, uint32_t max_events);
+    
+    /* set the max bytes read from one socket per wakeup, TcpSocket::receive returns 0
+     * when the budget is used up, and the read callback is called again in next iteration
+     * after other sockets are served. so one fast peer cannot monopolize the loop.
+     * it should be called before loop running or on loop thread
+     *
+     * @param max_bytes 0 for no limit, which is the default
+     */
+    void setReadBudget(uint32_t max_bytes);
+    
+    /* coalesce the output of the connections. WebSocket, H2Connection and the HTTP/1
+     * requests and responses created afterwards queue the small writes issued on loop thread,
+     * and write them with one call at the end of the iteration, after the tasks, timers and
+     * IO callbacks. it reduces the syscalls and TLS records for chatty protocols.
+     * it should be called before loop running or on loop thread
+     */
+    void setWriteCoalescing(bool enable);
+    
+    /* dispatch IO events on io_threads more threads besides the loop thread. all of them
+     * wait on one epoll set, the fds are registered with EPOLLONESHOT and re-armed after the
+     * callback, so the callbacks of one fd never run concurrently and an idle thread picks up
+     * any ready fd. it suits the workloads that the cost of connections is very uneven.
+     * tasks and timers still run on the loop thread, the loop APIs called on IO threads are
+     * posted to the loop thread as on other threads, and the IO callbacks on IO threads are
+     * not tracked by watchdog. the data shared by fds should be synchronized by application.
+     * the input left by read budget or accept batch is reported again when the fd is re-armed.
+     * Linux EPoll only, it should be called before init
+     */
+    KMError setIOThreads(uint32_t io_threads);
+    
+    /* the monotonic time cached by the loop. it is sampled at the beginning of each
+     * iteration, after the tasks are executed and when IOPoll wait returns, so the
+     * callbacks in the same phase get a consistent time without reading the clock.
+     * it returns the current clock time if called on other threads or out of loop iteration
+     */
+    std::chrono::steady_clock::time_point now() const;
+    
+    /* get the loop statistics, the counters are accumulated since loop created.
+     * it should be called on loop thread, use sync to get the stats from other threads
+     */
+    Stats getStats() const;
+    
+    /* get the busy time of the loop in permille, it is sampled in windows of 100ms
+     * and the time running tasks, timers and IO callbacks is counted as busy.
+     * the value is kept while the loop is blocking in IOPoll. this API is thread-safe
+     */
+    uint32_t getLoad() const;
+    
     class Impl;
     Impl* pimpl();
 
@@ -130,6 +301,46 @@ private:
     Impl* pimpl_;
 };
 
+/* EventLoopGroup owns a number of EventLoops, each of them runs on its own thread
+ */
+class KUMA_API EventLoopGroup
+{
+public:
+    EventLoopGroup(PollType poll_type = PollType::NONE);
+    ~EventLoopGroup();
+    
+    /* start the loop threads, return after all loops are initialized
+     *
+     * @param count number of loops, the number of cpu cores will be used if count is 0
+     * @param pin_cpu pin the thread of loop i to cpu core (i % cores)
+     */
+    bool init(int count = 0, bool pin_cpu = false);
+    
+    /* stop all the loops and wait for the loop threads to exit. the loops are released,
+     * it must not be called concurrently with the other APIs of EventLoopGroup
+     */
+    void stop();
+    
+    int size() const;
+    EventLoop* getLoop(int index) const;
+    
+    /* get the loop in round-robin. this API is thread-safe between init and stop
+     */
+    EventLoop* getNextLoop();
+    
+    /* get the loop with the lowest load, see EventLoop::getLoad. it can be used to
+     * place the new connections or to pick the target of migrate. this API is thread-safe
+     * between init and stop
+     */
+    EventLoop* getLeastLoadedLoop();
+    
+    class Impl;
+    Impl* pimpl();
+    
+private:
+    Impl* pimpl_;
+};
+
 class KUMA_API TcpSocket
 {
 public:
@@ -147,13 +358,32 @@ public:
     KMError setSslServerName(const char *server_name);
     KMError bind(const char *bind_host, uint16_t bind_port);
     KMError connect(const char *host, uint16_t port, EventCallback cb, uint32_t timeout_ms = 0);
-    KMError attachFd(SOCKET_FD fd);
+    /* flags is ATTACH_FLAG_*, pass ATTACH_FLAG_ACCEPTED for the fd from TcpListener
+     * to skip the fcntl calls
+     */
+    KMError attachFd(SOCKET_FD fd, uint32_t flags = 0);
     KMError detachFd(SOCKET_FD &fd);
+    
+    /* move the open socket to loop, the SSL session and the input not read yet go with it.
+     * the socket is moved on the current loop thread after the running callbacks return,
+     * the callbacks are called on the thread of loop from then on, starting with one read
+     * callback to pick up the buffered input. the socket is resumed if it was paused.
+     * not supported on IOCP
+     */
+    KMError migrate(EventLoop *loop);
     KMError startSslHandshake(SslRole ssl_role);
     KMError getAlpnSelected(char *buf, size_t len);
     int send(const void *data, size_t length);
     int send(const iovec *iovs, int count);
     int send(const KMBuffer &buf);
+    
+    /* send length bytes of file from offset, with sendfile on plain TCP. the file is read
+     * in blocks and sent by copy on SSL socket or the platforms without sendfile.
+     * return the bytes sent, the rest should be sent from offset + ret in write callback.
+     * return -1 on socket error, or if the range exceeds the file. the socket is left
+     * open on file error
+     */
+    int sendFile(int file_fd, int64_t offset, size_t length);
     int receive(void *data, size_t length);
     
     KMError close();
@@ -161,6 +391,14 @@ public:
     KMError pause();
     KMError resume();
     
+    /* send the KMBuffer not less than threshold bytes with MSG_ZEROCOPY, the buffer
+     * storage is referenced until the kernel reports the send completed. the buffer
+     * that is not shared, e.g. wrapping user memory, is still copied. zero-copy is turned
+     * off for the socket when the kernel reports it copied the data, e.g. on loopback.
+     * 0 to disable. Linux and plain TCP only
+     */
+    KMError setZeroCopy(size_t threshold);
+    
     /* NOTE: cb must be valid untill close called
      */
     void setReadCallback(EventCallback cb);
@@ -180,16 +418,50 @@ class KUMA_API TcpListener
 {
 public:
     using AcceptCallback = std::function<bool(SOCKET_FD, const char*, uint16_t)>;
+    // the peer address is passed as returned by accept, without formatting it to string
+    using AcceptAddrCallback = std::function<bool(SOCKET_FD, const sockaddr*, socklen_t)>;
     using ErrorCallback = std::function<void(KMError)>;
     
     TcpListener(EventLoop *loop);
+    
+    /* listen on all the loops of group, the group must be initialized.
+     * on platforms that support SO_REUSEPORT load balancing, there is one listen socket
+     * on each loop, and a connection is accepted and served on the same loop.
+     * otherwise, the connections are accepted on the first loop and dispatched to the
+     * loops in round-robin.
+     * in both cases the accept callback is called on the loop that the fd should be served
+     */
+    TcpListener(EventLoopGroup *group);
     ~TcpListener();
     
     KMError startListen(const char *host, uint16_t port);
     KMError stopListen(const char *host, uint16_t port);
     KMError close();
     
+    /* share one listen socket between the loops of group instead of one listen socket
+     * on each loop. it is registered with EPOLLEXCLUSIVE, so only one of the idle loops
+     * is woken up for incoming connections, the busy loops accept less.
+     * Linux only, it should be called before startListen
+     */
+    KMError setSharedListenSocket(bool shared);
+    
+    /* the backlog of listen socket, default is 128.
+     * it should be called before startListen
+     */
+    KMError setBacklog(int backlog);
+    
+    /* max connections accepted per wakeup of the listen socket, the rest are accepted
+     * in next iteration of the loop, so a connection storm doesn't starve the other IO.
+     * default is 0, the connections are accepted until the backlog is empty.
+     * it should be called before startListen
+     */
+    void setAcceptBatch(uint32_t max_accepts);
+    
+    /* the accepted fd is nonblocking and close-on-exec on Linux. return false to let
+     * the listener close the fd. AcceptAddrCallback is used instead of AcceptCallback if set
+     */
     void setAcceptCallback(AcceptCallback cb);
+    void setAcceptAddrCallback(AcceptAddrCallback cb);
     void setErrorCallback(ErrorCallback cb);
     
     class Impl;
@@ -213,6 +485,29 @@ public:
     int send(const KMBuffer &buf, const char *host, uint16_t port);
     int receive(void *data, size_t length, char *ip_buf, size_t ip_len, uint16_t &port);
     
+    /**
+     * Send the datagrams to their own destinations in one call, sendmmsg is used on Linux.
+     * The destination must be an IP address, at most 64 datagrams are sent per call.
+     * return the number of datagrams sent, the rest are not sent if it's less than count
+     */
+    int send(const UdpDatagram *dgrams, int count);
+    
+    /**
+     * Receive up to count datagrams in one call, recvmmsg is used on Linux.
+     * At most 64 datagrams are received per call.
+     * return the number of datagrams received, 0 if no datagram is available
+     */
+    int receive(UdpDatagram *dgrams, int count);
+    
+    /**
+     * Send the data as datagrams of segment_size bytes, the last one may be shorter.
+     * UDP segmentation offload (UDP_SEGMENT) is used on Linux, the kernel splits the
+     * data into datagrams, otherwise the datagrams are sent in batches.
+     * The destination must be an IP address.
+     * return the bytes sent, it may be less than length and ends at a segment boundary
+     */
+    int sendSegments(const void *data, size_t length, uint16_t segment_size, const char *host, uint16_t port);
+    
     KMError close();
     
     KMError mcastJoin(const char *mcast_addr, uint16_t mcast_port);
@@ -241,6 +536,45 @@ public:
      */
     bool schedule(uint32_t delay_ms, TimerMode mode, TimerCallback cb);
     
+    /**
+     * Schedule the timer with slack, it fires in [delay_ms, delay_ms + slack_ms].
+     * The timers due in the same slack window share one timer wheel entry and are
+     * fired together, rescheduling the timer within its window does not move it.
+     * It is suitable for the idle timeouts of massive connections. This API is thread-safe
+     */
+    bool schedule(uint32_t delay_ms, uint32_t slack_ms, TimerMode mode, TimerCallback cb);
+    
+    /**
+     * Cancel the scheduled timer. This API is thread-safe
+     */
+    void cancel();
+    
+    class Impl;
+    Impl* pimpl();
+    
+private:
+    Impl* pimpl_;
+};
+
+/**
+ * HighResTimer is a timer with microsecond resolution. It is backed by timerfd on Linux,
+ * each timer occupies one fd in the loop, so it is meant for the few timers that need
+ * sub-millisecond accuracy such as pacing, use Timer for timeouts.
+ * On other platforms it falls back to Timer with the delay rounded up to milliseconds
+ */
+class KUMA_API HighResTimer
+{
+public:
+    using TimerCallback = std::function<void(void)>;
+    
+    HighResTimer(EventLoop *loop);
+    ~HighResTimer();
+    
+    /**
+     * Schedule the timer in microseconds. This API is thread-safe
+     */
+    bool schedule(uint32_t delay_us, TimerMode mode, TimerCallback cb);
+    
     /**
      * Cancel the scheduled timer. This API is thread-safe
      */
@@ -369,6 +703,13 @@ public:
     KMError sendResponse(int status_code, const char *desc = nullptr);
     int sendData(const void *data, size_t len);
     int sendData(const KMBuffer &buf);
+    
+    /* send length bytes of file from offset as body, see TcpSocket::sendFile.
+     * the chunked, compressed or HTTP/2 body is read from file in large blocks and sent
+     * as sendData(KMBuffer). return the bytes sent, the rest should be sent from
+     * offset + ret in write callback
+     */
+    int sendFile(int file_fd, int64_t offset, size_t length);
     void reset(); // reset for connection reuse
     
     KMError close();
@@ -433,6 +774,10 @@ public:
     KMError attachFd(SOCKET_FD fd, const KMBuffer *init_buf, HandshakeCallback cb);
     KMError attachSocket(TcpSocket &&tcp, HttpParser &&parser, const KMBuffer *init_buf, HandshakeCallback cb);
     
+    /* move the open connection to loop with its pending send data, see TcpSocket::migrate
+     */
+    KMError migrate(EventLoop *loop);
+    
     /**
      * @param flags, bit 1 -- no compression flag when PMCE is negotiated
      */
@@ -477,6 +822,11 @@ public:
      */
     KMError attachStream(uint32_t stream_id, HttpResponse *rsp);
     
+    /* move the connection to loop, see TcpSocket::migrate. the streams are bound to
+     * the HttpResponses on current loop, so it fails with INVALID_STATE if any stream is open
+     */
+    KMError migrate(EventLoop *loop);
+    
     KMError close();
     
     void setAcceptCallback(AcceptCallback cb);
@@ -457,6 +457,19 @@ public:
         }
     }
 
+    // all the storages in chain are shared, clone and subbuffer reference them without copying
+    bool isShared() const
+    {
+        auto *kmb = this;
+        do {
+            if (kmb->length() > 0 && !kmb->shared_data_) {
+                return false;
+            }
+            kmb = kmb->next_;
+        } while (kmb != this);
+        return true;
+    }
+    
     KMBuffer* clone() const
     {
         auto *dup = cloneSelf();
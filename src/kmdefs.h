@@ -23,6 +23,8 @@
 #define __KUMADEFS_H__
 
 #include "kmconf.h"
+#include <stddef.h>
+#include <stdint.h>
 
 #ifdef KUMA_OS_MAC
 # define KUMA_NS_BEGIN   namespace kuma {;
@@ -97,7 +99,19 @@ enum class TimerMode {
     REPEATING
 };
 
+enum class TaskPriority {
+    URGENT,     // always run before the lower lanes and never budgeted
+    NORMAL,
+    IDLE,       // background tasks, budgeted per loop iteration by default
+};
+
 #define UDP_FLAG_MULTICAST  1
+#define UDP_FLAG_GRO        2 // UDP_GRO, coalesced datagrams are split back on receive, Linux only
+
+#define LISTEN_FLAG_REUSE_PORT  1 // SO_REUSEPORT, the kernel balances connections between the listeners
+#define LISTEN_FLAG_EXCLUSIVE   2 // the listen fd is shared by loops, only one loop is woken up per connection
+
+#define ATTACH_FLAG_ACCEPTED    1 // the fd is passed by TcpListener, it is nonblocking and close-on-exec already on Linux
 
 #ifdef KUMA_OS_WIN
 struct iovec {
@@ -106,6 +120,20 @@ struct iovec {
 };
 #endif
 
+/**
+ * Datagram descriptor of UdpSocket batch send and receive.
+ * On send, data and length are the payload, ip and port are the destination.
+ * On receive, data and size are the buffer to receive into, length, ip and port
+ * are set to the datagram length and its source address
+ */
+struct UdpDatagram {
+    void*           data = nullptr;
+    size_t          size = 0;
+    size_t          length = 0;
+    char            ip[64] = {0};
+    uint16_t        port = 0;
+};
+
 KUMA_NS_END
 
 #endif
@@ -0,0 +1,200 @@
+/* Copyright (c) 2014, Fengping Bao <jamol@live.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __KMFunction_H__
+#define __KMFunction_H__
+
+#include "kmdefs.h"
+#include <stddef.h>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <functional>
+#include <type_traits>
+
+KUMA_NS_BEGIN
+
+/**
+ * KMFunction is a move-only function wrapper. the callable is stored inline if its
+ * size is not larger than N, otherwise it is allocated on heap. so a lambda with
+ * move-only captures (std::unique_ptr, KMBuffer) can be used, and no heap allocation
+ * is needed for most callables
+ */
+template <typename Signature, size_t N = 112>
+class KMFunction;
+
+template <typename R, typename... Args, size_t N>
+class KMFunction<R(Args...), N> final
+{
+public:
+    KMFunction() = default;
+    KMFunction(std::nullptr_t) {}
+    
+    template <typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, KMFunction>::value>::type>
+    KMFunction(F &&f)
+    {
+        using Functor = typename std::decay<F>::type;
+        if (isEmpty(f)) {
+            return;
+        }
+        init<Functor>(std::forward<F>(f), std::integral_constant<bool, isInline<Functor>()>());
+    }
+    
+    KMFunction(KMFunction &&other)
+    {
+        moveFrom(other);
+    }
+    
+    KMFunction(const KMFunction &other) = delete;
+    
+    ~KMFunction()
+    {
+        reset();
+    }
+    
+    KMFunction& operator=(KMFunction &&other)
+    {
+        if (this != &other) {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+    
+    KMFunction& operator=(const KMFunction &other) = delete;
+    
+    KMFunction& operator=(std::nullptr_t)
+    {
+        reset();
+        return *this;
+    }
+    
+    template <typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, KMFunction>::value>::type>
+    KMFunction& operator=(F &&f)
+    {
+        KMFunction tmp(std::forward<F>(f));
+        return *this = std::move(tmp);
+    }
+    
+    R operator()(Args... args)
+    {
+        return invoker_(storage(), std::forward<Args>(args)...);
+    }
+    
+    explicit operator bool() const
+    {
+        return invoker_ != nullptr;
+    }
+    
+    void reset()
+    {
+        if (manager_) {
+            manager_(Op::DESTROY, storage(), nullptr);
+            manager_ = nullptr;
+            invoker_ = nullptr;
+        }
+    }
+    
+private:
+    enum class Op {
+        MOVE,
+        DESTROY
+    };
+    using Invoker = R (*)(void*, Args&&...);
+    using Manager = void (*)(Op, void*, void*);
+    
+    template <typename Functor>
+    static constexpr bool isInline()
+    {
+        return sizeof(Functor) <= N &&
+            alignof(Functor) <= alignof(Storage) &&
+            std::is_move_constructible<Functor>::value;
+    }
+    
+    template <typename T>
+    static bool isEmpty(const T &) { return false; }
+    template <typename T>
+    static bool isEmpty(T *f) { return f == nullptr; }
+    template <typename S>
+    static bool isEmpty(const std::function<S> &f) { return !f; }
+    
+    template <typename Functor, typename F>
+    void init(F &&f, std::true_type)
+    {
+        new (storage()) Functor(std::forward<F>(f));
+        invoker_ = [] (void *obj, Args&&... args) -> R {
+            return (*static_cast<Functor*>(obj))(std::forward<Args>(args)...);
+        };
+        manager_ = [] (Op op, void *dst, void *src) {
+            if (op == Op::MOVE) {
+                new (dst) Functor(std::move(*static_cast<Functor*>(src)));
+            }
+            static_cast<Functor*>(op == Op::MOVE ? src : dst)->~Functor();
+        };
+    }
+    
+    template <typename Functor, typename F>
+    void init(F &&f, std::false_type)
+    {
+        *static_cast<Functor**>(storage()) = new Functor(std::forward<F>(f));
+        invoker_ = [] (void *obj, Args&&... args) -> R {
+            return (**static_cast<Functor**>(obj))(std::forward<Args>(args)...);
+        };
+        manager_ = [] (Op op, void *dst, void *src) {
+            if (op == Op::MOVE) {
+                *static_cast<Functor**>(dst) = *static_cast<Functor**>(src);
+            } else {
+                delete *static_cast<Functor**>(dst);
+            }
+        };
+    }
+    
+    void moveFrom(KMFunction &other)
+    {
+        if (other.manager_) {
+            other.manager_(Op::MOVE, storage(), other.storage());
+            invoker_ = other.invoker_;
+            manager_ = other.manager_;
+            other.invoker_ = nullptr;
+            other.manager_ = nullptr;
+        }
+    }
+    
+    void* storage() const
+    {
+        return const_cast<void*>(static_cast<const void*>(&storage_));
+    }
+    
+private:
+    static constexpr size_t kStorageSize = N < sizeof(void*) ? sizeof(void*) : N;
+    // small storage is pointer aligned to keep the wrapper compact
+    static constexpr size_t kStorageAlign = kStorageSize < alignof(std::max_align_t) ? alignof(void*) : alignof(std::max_align_t);
+    using Storage = typename std::aligned_storage<kStorageSize, kStorageAlign>::type;
+    Storage storage_;
+    Invoker invoker_ = nullptr;
+    Manager manager_ = nullptr;
+};
+
+KUMA_NS_END
+
+#endif
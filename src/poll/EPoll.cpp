@@ -24,11 +24,31 @@
 #include "util/kmtrace.h"
 
 #include <sys/epoll.h>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
 
 KUMA_NS_BEGIN
 
-#define MAX_EPOLL_FDS   5000
-#define MAX_EVENT_NUM   500
+#define MIN_EVENT_NUM   64
+#define MAX_EVENT_NUM   4096
+#define EVENT_SHRINK_WAITS  64
+#define ITEM_BLOCK_SIZE 256
+
+/**
+ * EPollItem is the record of a registered fd, epoll_event.data points to it directly.
+ * it is half of a cache line, so dispatching an event touches one cache line only.
+ * the items are allocated in blocks and recycled, and the fd lookup for register and
+ * update is hashed, memory scales with registered fds instead of the max fd number
+ */
+struct alignas(32) EPollItem
+{
+    PollCallback  cb;
+    SOCKET_FD   fd { INVALID_FD };
+    KMEvent     events { 0 };
+};
+static_assert(sizeof(EPollItem) == 32, "EPollItem should be half of a cache line");
 
 class EPoll : public IOPoll
 {
@@ -37,21 +57,46 @@ public:
     ~EPoll();
 
     bool init();
-    KMError registerFd(SOCKET_FD fd, KMEvent events, IOCallback cb);
+    KMError registerFd(SOCKET_FD fd, KMEvent events, PollCallback cb);
     KMError unregisterFd(SOCKET_FD fd);
     KMError updateFd(SOCKET_FD fd, KMEvent events);
     KMError wait(uint32_t wait_time_ms);
     void notify();
     PollType getType() const { return PollType::EPOLL; }
     bool isLevelTriggered() const { return false; }
+    size_t registeredFdCount() const { return item_count_; }
+    void setEventBatch(uint32_t min_events, uint32_t max_events);
 
 private:
     uint32_t get_events(KMEvent kuma_events);
     KMEvent get_kuma_events(uint32_t events);
+    EPollItem* getItem(SOCKET_FD fd) const {
+        auto it = fd_items_.find(fd);
+        return it != fd_items_.end() ? it->second : nullptr;
+    }
+    EPollItem* allocItem();
+    void freeItem(EPollItem *item);
+    void releaseRetiredItems();
+    void adjustEventBatch(int nfds);
+    int ctlItem(EPollItem *item, KMEvent events, bool added);
 
 private:
     int             epoll_fd_;
     NotifierPtr     notifier_ { std::move(Notifier::createNotifier()) };
+    
+    std::unordered_map<SOCKET_FD, EPollItem*> fd_items_;
+    std::vector<std::unique_ptr<EPollItem[]>> item_blocks_;
+    std::vector<EPollItem*> free_items_;
+    // the items unregistered while dispatching, the pending events in same batch may refer them
+    std::vector<EPollItem*> retired_items_;
+    bool            dispatching_ = false;
+    size_t          item_count_ = 0;
+    
+    // the batch grows when a wait fills it, and shrinks after idle waits
+    std::vector<epoll_event> events_;
+    size_t          min_events_ = MIN_EVENT_NUM;
+    size_t          max_events_ = MAX_EVENT_NUM;
+    uint32_t        low_waits_ = 0;
 };
 
 EPoll::EPoll()
@@ -70,15 +115,16 @@ EPoll::~EPoll()
 
 bool EPoll::init()
 {
-    epoll_fd_ = epoll_create(MAX_EPOLL_FDS);
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
     if(INVALID_FD == epoll_fd_) {
         return false;
     }
+    events_.resize(min_events_);
     if (!notifier_->ready()) {
         if(!notifier_->init()) {
             return false;
         }
-        IOCallback cb ([this](KMEvent ev, void*, size_t) { notifier_->onEvent(ev); });
+        PollCallback cb ([this](KMEvent ev, void*, size_t) { notifier_->onEvent(ev); });
         registerFd(notifier_->getReadFD(), KUMA_EV_READ|KUMA_EV_ERROR, std::move(cb));
     }
     return true;
@@ -96,6 +142,11 @@ uint32_t EPoll::get_events(KMEvent kuma_events)
     if(kuma_events & KUMA_EV_ERROR) {
         ev |= EPOLLERR | EPOLLHUP;
     }
+#ifdef EPOLLEXCLUSIVE
+    if(kuma_events & KUMA_EV_EXCLUSIVE) {
+        ev |= EPOLLEXCLUSIVE;
+    }
+#endif
     return ev;
 }
 
@@ -114,89 +165,178 @@ KMEvent EPoll::get_kuma_events(uint32_t events)
     return ev;
 }
 
-KMError EPoll::registerFd(SOCKET_FD fd, KMEvent events, IOCallback cb)
+EPollItem* EPoll::allocItem()
 {
-    if (fd < 0) {
-        return KMError::INVALID_PARAM;
+    if (free_items_.empty()) {
+        std::unique_ptr<EPollItem[]> block(new EPollItem[ITEM_BLOCK_SIZE]);
+        for (int i = ITEM_BLOCK_SIZE - 1; i >= 0; --i) {
+            free_items_.push_back(&block[i]);
+        }
+        item_blocks_.push_back(std::move(block));
+    }
+    auto *item = free_items_.back();
+    free_items_.pop_back();
+    ++item_count_;
+    return item;
+}
+
+void EPoll::freeItem(EPollItem *item)
+{
+    item->fd = INVALID_FD;
+    item->events = 0;
+    --item_count_;
+    if (dispatching_) {
+        // the callback is not destroyed, it may be the one running
+        retired_items_.push_back(item);
+    } else {
+        item->cb = nullptr;
+        free_items_.push_back(item);
     }
-    resizePollItems(fd);
-    int epoll_op = EPOLL_CTL_ADD;
-    if (INVALID_FD != poll_items_[fd].fd) {
-        epoll_op = EPOLL_CTL_MOD;
+}
+
+void EPoll::releaseRetiredItems()
+{
+    for (auto *item : retired_items_) {
+        item->cb = nullptr;
+        free_items_.push_back(item);
     }
-    poll_items_[fd].fd = fd;
-    poll_items_[fd].events = events;
-    poll_items_[fd].cb = std::move(cb);
+    retired_items_.clear();
+}
+
+int EPoll::ctlItem(EPollItem *item, KMEvent events, bool added)
+{
     struct epoll_event evt = {0};
-    evt.data.ptr = (void*)(long)fd;
+    evt.data.ptr = item;
     evt.events = get_events(events);//EPOLLIN | EPOLLOUT | EPOLLERR | EPOLLHUP | EPOLLET;
-    if(epoll_ctl(epoll_fd_, epoll_op, fd, &evt) < 0) {
-        KUMA_ERRTRACE("EPoll::registerFd error, fd=" << fd << ", ev=" << evt.events << ", errno=" << errno);
+    if (!added) {
+        return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, item->fd, &evt);
+    }
+    if ((events | item->events) & KUMA_EV_EXCLUSIVE) {
+        // EPOLL_CTL_MOD is not allowed on the fd added with EPOLLEXCLUSIVE
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, item->fd, NULL);
+        return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, item->fd, &evt);
+    }
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, item->fd, &evt);
+}
+
+KMError EPoll::registerFd(SOCKET_FD fd, KMEvent events, PollCallback cb)
+{
+    if (fd < 0) {
+        return KMError::INVALID_PARAM;
+    }
+    bool added = true;
+    auto *item = getItem(fd);
+    if (!item) {
+        item = allocItem();
+        item->fd = fd;
+        fd_items_[fd] = item;
+        added = false;
+    }
+    if(ctlItem(item, events, added) < 0) {
+        KUMA_ERRTRACE("EPoll::registerFd error, fd=" << fd << ", ev=" << events << ", errno=" << errno);
+        if (!added) {
+            fd_items_.erase(fd);
+            freeItem(item);
+        }
         return KMError::FAILED;
     }
-    KUMA_INFOTRACE("EPoll::registerFd, fd=" << fd << ", ev=" << evt.events);
+    item->events = events;
+    item->cb = std::move(cb);
+    KUMA_INFOTRACE("EPoll::registerFd, fd=" << fd << ", ev=" << events);
 
     return KMError::NOERR;
 }
 
 KMError EPoll::unregisterFd(SOCKET_FD fd)
 {
-    int max_fd = int(poll_items_.size() - 1);
-    KUMA_INFOTRACE("EPoll::unregisterFd, fd="<<fd<<", max_fd="<<max_fd);
-    if (fd < 0 || fd > max_fd) {
-        KUMA_WARNTRACE("EPoll::unregisterFd, failed, max_fd=" << max_fd);
+    KUMA_INFOTRACE("EPoll::unregisterFd, fd="<<fd);
+    auto *item = getItem(fd);
+    if (!item) {
+        KUMA_WARNTRACE("EPoll::unregisterFd, failed, fd=" << fd << " is not registered");
         return KMError::INVALID_PARAM;
     }
     epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, NULL);
-    if(fd < max_fd) {
-        poll_items_[fd].reset();
-    } else if (fd == max_fd) {
-        poll_items_.pop_back();
-    }
+    fd_items_.erase(fd);
+    freeItem(item);
     return KMError::NOERR;
 }
 
 KMError EPoll::updateFd(SOCKET_FD fd, KMEvent events)
 {
-    if(fd < 0 || fd >= poll_items_.size() || INVALID_FD == poll_items_[fd].fd) {
+    auto *item = getItem(fd);
+    if(!item) {
         return KMError::FAILED;
     }
-    struct epoll_event evt = {0};
-    evt.data.ptr = (void*)(long)fd;
-    evt.events = get_events(events);
-    if(epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &evt) < 0) {
+    if(ctlItem(item, events, true) < 0) {
         KUMA_ERRTRACE("EPoll::updateFd error, fd="<<fd<<", errno="<<errno);
         return KMError::FAILED;
     }
-    poll_items_[fd].events = events;
+    item->events = events;
     return KMError::NOERR;
 }
 
 KMError EPoll::wait(uint32_t wait_ms)
 {
-    struct epoll_event events[MAX_EVENT_NUM];
-    int nfds = epoll_wait(epoll_fd_, events, MAX_EVENT_NUM , wait_ms);
+    auto *events = &events_[0];
+    int nfds = epoll_wait(epoll_fd_, events, static_cast<int>(events_.size()), wait_ms);
+    onWaitReturned(nfds);
     if (nfds < 0) {
         if(errno != EINTR) {
             KUMA_ERRTRACE("EPoll::wait, errno="<<errno);
         }
         KUMA_INFOTRACE("EPoll::wait, nfds="<<nfds<<", errno="<<errno);
     } else {
+        dispatching_ = true;
         for (int i=0; i<nfds; ++i) {
-            SOCKET_FD fd = (SOCKET_FD)(long)events[i].data.ptr;
-            if(fd < poll_items_.size()) {
-                auto revents = get_kuma_events(events[i].events);
-                revents &= poll_items_[fd].events;
-                if (revents) {
-                    auto &cb = poll_items_[fd].cb;
-                    if(cb) cb(revents, nullptr, 0);
-                }
+            auto *item = static_cast<EPollItem*>(events[i].data.ptr);
+            if (INVALID_FD == item->fd) {
+                continue; // unregistered by previous callback
+            }
+            auto revents = get_kuma_events(events[i].events);
+            revents &= item->events;
+            if (revents && item->cb) {
+                invokeCallback(item->cb, item->fd, revents, nullptr, 0);
             }
         }
+        dispatching_ = false;
+        if (!retired_items_.empty()) {
+            releaseRetiredItems();
+        }
+        adjustEventBatch(nfds);
     }
     return KMError::NOERR;
 }
 
+void EPoll::adjustEventBatch(int nfds)
+{
+    auto batch = events_.size();
+    auto count = static_cast<size_t>(nfds);
+    if (count == batch && batch < max_events_) {
+        // more events may be pending, fetch them in fewer waits
+        events_.resize(std::min(batch * 2, max_events_));
+        low_waits_ = 0;
+    } else if (count > 0 && count < batch / 4 && batch > min_events_) {
+        if (++low_waits_ >= EVENT_SHRINK_WAITS) {
+            std::vector<epoll_event> events(std::max(batch / 2, min_events_));
+            events_.swap(events);
+            low_waits_ = 0;
+        }
+    } else if (count > 0) {
+        low_waits_ = 0;
+    }
+}
+
+void EPoll::setEventBatch(uint32_t min_events, uint32_t max_events)
+{
+    min_events_ = min_events;
+    max_events_ = max_events;
+    low_waits_ = 0;
+    if (events_.size() < min_events_ || events_.size() > max_events_) {
+        std::vector<epoll_event> events(min_events_);
+        events_.swap(events);
+    }
+}
+
 void EPoll::notify()
 {
     notifier_->notify();
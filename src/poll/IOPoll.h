@@ -18,6 +18,7 @@
 
 #include "kmdefs.h"
 #include "evdefs.h"
+#include "LoopWatchdog.h"
 
 #ifdef KUMA_OS_WIN
 # include <Ws2tcpip.h>
@@ -68,6 +69,8 @@
 #include <map>
 #include <list>
 #include <vector>
+#include <chrono>
+#include <thread>
 
 KUMA_NS_BEGIN
 
@@ -84,7 +87,7 @@ struct PollItem
     int idx { -1 };
     KMEvent events { 0 }; // kuma events registered
     KMEvent revents { 0 }; // kuma events received
-    IOCallback cb;
+    PollCallback cb;
 };
 typedef std::vector<PollItem>   PollItemVector;
 
@@ -94,15 +97,59 @@ public:
     virtual ~IOPoll() {}
     
     virtual bool init() = 0;
-    virtual KMError registerFd(SOCKET_FD fd, KMEvent events, IOCallback cb) = 0;
+    virtual KMError registerFd(SOCKET_FD fd, KMEvent events, PollCallback cb) = 0;
     virtual KMError unregisterFd(SOCKET_FD fd) = 0;
     virtual KMError updateFd(SOCKET_FD fd, KMEvent events) = 0;
     virtual KMError wait(uint32_t wait_time_ms) = 0;
     virtual void notify() = 0;
     virtual PollType getType() const = 0;
     virtual bool isLevelTriggered() const = 0;
+    // the range of events fetched by one wait, for the poll that batches events
+    virtual void setEventBatch(uint32_t /*min_events*/, uint32_t /*max_events*/) {}
+    // for the poll shared by IO threads, they dispatch the IO events concurrently with wait
+    virtual KMError waitShared(uint32_t /*wait_time_ms*/) { return KMError::NOT_SUPPORTED; }
+    // wake up all the IO threads in waitShared, called on loop stop
+    virtual void wakeupShared() {}
+    // the thread still running the callback of the unregistered fd, empty id if none
+    virtual std::thread::id callbackThread(SOCKET_FD /*fd*/) { return std::thread::id(); }
+    // run task on loop thread exclusively with the callback of fd. the shared poll runs it
+    // after the callback on the thread running the callback if it is busy, and drops it if
+    // fd is unregistered in the meantime
+    virtual void runExclusive(SOCKET_FD /*fd*/, KMFunction<void(void)> task) { task(); }
+    
+    // the number of events returned by last wait
+    size_t lastEventCount() const { return last_event_count_; }
+    // the time that last wait returned from system, before the events are dispatched
+    std::chrono::steady_clock::time_point lastWaitReturned() const { return last_wait_returned_; }
+    
+    // IO callbacks are reported to tracker if watchdog is enabled
+    void setCallbackTracker(CallbackTracker *tracker) { tracker_ = tracker; }
+    
+    virtual size_t registeredFdCount() const {
+        size_t count = 0;
+        for (auto &item : poll_items_) {
+            if (item.fd != INVALID_FD) {
+                ++count;
+            }
+        }
+        return count;
+    }
     
 protected:
+    void invokeCallback(PollCallback &cb, SOCKET_FD fd, KMEvent events, void *ol, size_t io_size) {
+        if (tracker_) {
+            tracker_->enter(CallbackTracker::Type::IO, (intptr_t)fd);
+            cb(events, ol, io_size);
+            tracker_->leave();
+        } else {
+            cb(events, ol, io_size);
+        }
+    }
+    
+    void onWaitReturned(int event_count) {
+        last_event_count_ = event_count > 0 ? event_count : 0;
+        last_wait_returned_ = std::chrono::steady_clock::now();
+    }
     void resizePollItems(SOCKET_FD fd) {
         auto count = poll_items_.size();
         if (fd >= count) {
@@ -114,6 +161,9 @@ protected:
         }
     }
     PollItemVector  poll_items_;
+    size_t          last_event_count_ = 0;
+    std::chrono::steady_clock::time_point last_wait_returned_;
+    CallbackTracker* tracker_ = nullptr;
 };
 
 KUMA_NS_END
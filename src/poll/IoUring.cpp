@@ -0,0 +1,488 @@
+/* Copyright (c) 2014, Fengping Bao <jamol@live.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "IOPoll.h"
+#include "Notifier.h"
+#include "util/kmtrace.h"
+
+#if defined(KUMA_OS_LINUX) && defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#  include <linux/io_uring.h>
+#  if defined(IORING_POLL_ADD_MULTI) && defined(IORING_FEAT_EXT_ARG)
+#   define KUMA_HAS_IO_URING
+#  endif
+# endif
+#endif
+
+#ifdef KUMA_HAS_IO_URING
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+KUMA_NS_BEGIN
+
+#define IO_URING_ENTRIES    1024
+#define MAX_EVENT_NUM       500
+
+/**
+ * IoUring keeps the readiness contract of EPoll, every fd has a multishot poll request,
+ * its completions are reported to PollCallback like edge-triggered epoll events.
+ * the poll add/remove requests are queued in submission ring and submitted in batch
+ * by the io_uring_enter that waits for the completions, so no syscall per operation
+ */
+class IoUring : public IOPoll
+{
+public:
+    IoUring();
+    ~IoUring();
+    
+    static bool isSupported();
+    
+    bool init() override;
+    KMError registerFd(SOCKET_FD fd, KMEvent events, PollCallback cb) override;
+    KMError unregisterFd(SOCKET_FD fd) override;
+    KMError updateFd(SOCKET_FD fd, KMEvent events) override;
+    KMError wait(uint32_t wait_time_ms) override;
+    void notify() override;
+    PollType getType() const override { return PollType::IO_URING; }
+    bool isLevelTriggered() const override { return false; }
+    
+private:
+    uint32_t get_events(KMEvent kuma_events);
+    KMEvent get_kuma_events(uint32_t events);
+    
+    bool setupRing();
+    void cleanupRing();
+    io_uring_sqe* getSqe();
+    int enter(unsigned min_complete, uint32_t wait_ms);
+    bool addPoll(SOCKET_FD fd, KMEvent events);
+    void removePoll(SOCKET_FD fd);
+    
+    // user_data of poll request is poll id in high 32 bits and fd in low 32 bits
+    static uint64_t toUserData(uint32_t poll_id, SOCKET_FD fd) { return (uint64_t(poll_id) << 32) | uint32_t(fd); }
+    static const uint64_t kIgnoredUserData = ~0ULL;
+    
+private:
+    int                 ring_fd_ = INVALID_FD;
+    
+    void*               sq_ring_ = nullptr;
+    size_t              sq_ring_size_ = 0;
+    void*               cq_ring_ = nullptr;
+    size_t              cq_ring_size_ = 0;
+    io_uring_sqe*       sqes_ = nullptr;
+    size_t              sqes_size_ = 0;
+    
+    unsigned*           sq_head_ = nullptr;
+    unsigned*           sq_tail_ = nullptr;
+    unsigned*           sq_array_ = nullptr;
+    unsigned            sq_mask_ = 0;
+    unsigned            sq_entries_ = 0;
+    unsigned            sqe_tail_ = 0; // local tail, published to sq_tail_ before io_uring_enter
+    
+    unsigned*           cq_head_ = nullptr;
+    unsigned*           cq_tail_ = nullptr;
+    io_uring_cqe*       cqes_ = nullptr;
+    unsigned            cq_mask_ = 0;
+    
+    uint32_t            next_poll_id_ = 0;
+    std::vector<uint32_t> poll_ids_; // current poll id of fd, never shrinks
+    
+    NotifierPtr         notifier_ { Notifier::createNotifier() };
+};
+
+static int io_uring_setup(unsigned entries, io_uring_params *p)
+{
+    return (int)::syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+{
+    return (int)::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+IoUring::IoUring()
+{
+    
+}
+
+IoUring::~IoUring()
+{
+    cleanupRing();
+}
+
+bool IoUring::isSupported()
+{
+    static const bool supported = [] {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        int fd = io_uring_setup(2, &p);
+        if (fd < 0) {
+            return false;
+        }
+        ::close(fd);
+        // multishot poll is available since 5.13, which adds IORING_FEAT_RSRC_TAGS
+        uint32_t required = IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+#ifdef IORING_FEAT_RSRC_TAGS
+        required |= IORING_FEAT_RSRC_TAGS;
+#endif
+        return (p.features & required) == required;
+    }();
+    return supported;
+}
+
+bool IoUring::setupRing()
+{
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = IO_URING_ENTRIES * 8; // multishot polls may post more completions than submissions
+#ifdef IORING_SETUP_COOP_TASKRUN
+    p.flags |= IORING_SETUP_COOP_TASKRUN;
+#endif
+    ring_fd_ = io_uring_setup(IO_URING_ENTRIES, &p);
+    if (ring_fd_ < 0 && errno == EINVAL) {
+        p.flags &= ~IORING_SETUP_COOP_TASKRUN;
+        ring_fd_ = io_uring_setup(IO_URING_ENTRIES, &p);
+    }
+    if (ring_fd_ < 0) {
+        KUMA_ERRTRACE("IoUring::init, io_uring_setup failed, errno="<<errno);
+        ring_fd_ = INVALID_FD;
+        return false;
+    }
+    
+    sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sq_ring_ = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == sq_ring_) {
+        sq_ring_ = nullptr;
+        return false;
+    }
+    if (single_mmap) {
+        cq_ring_ = sq_ring_;
+    } else {
+        cq_ring_ = ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+        if (MAP_FAILED == cq_ring_) {
+            cq_ring_ = nullptr;
+            return false;
+        }
+    }
+    sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+    auto sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (MAP_FAILED == sqes) {
+        return false;
+    }
+    sqes_ = (io_uring_sqe*)sqes;
+    
+    auto *sq = (char*)sq_ring_;
+    sq_head_ = (unsigned*)(sq + p.sq_off.head);
+    sq_tail_ = (unsigned*)(sq + p.sq_off.tail);
+    sq_mask_ = *(unsigned*)(sq + p.sq_off.ring_mask);
+    sq_array_ = (unsigned*)(sq + p.sq_off.array);
+    sq_entries_ = p.sq_entries;
+    sqe_tail_ = *sq_tail_;
+    
+    auto *cq = (char*)cq_ring_;
+    cq_head_ = (unsigned*)(cq + p.cq_off.head);
+    cq_tail_ = (unsigned*)(cq + p.cq_off.tail);
+    cq_mask_ = *(unsigned*)(cq + p.cq_off.ring_mask);
+    cqes_ = (io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+void IoUring::cleanupRing()
+{
+    if (sqes_) {
+        ::munmap(sqes_, sqes_size_);
+        sqes_ = nullptr;
+    }
+    if (cq_ring_ && cq_ring_ != sq_ring_) {
+        ::munmap(cq_ring_, cq_ring_size_);
+    }
+    cq_ring_ = nullptr;
+    if (sq_ring_) {
+        ::munmap(sq_ring_, sq_ring_size_);
+        sq_ring_ = nullptr;
+    }
+    if (INVALID_FD != ring_fd_) {
+        ::close(ring_fd_);
+        ring_fd_ = INVALID_FD;
+    }
+}
+
+bool IoUring::init()
+{
+    if (INVALID_FD == ring_fd_ && !setupRing()) {
+        cleanupRing();
+        return false;
+    }
+    if (!notifier_->ready()) {
+        if(!notifier_->init()) {
+            return false;
+        }
+        PollCallback cb ([this](KMEvent ev, void*, size_t) { notifier_->onEvent(ev); });
+        registerFd(notifier_->getReadFD(), KUMA_EV_READ|KUMA_EV_ERROR, std::move(cb));
+    }
+    return true;
+}
+
+uint32_t IoUring::get_events(KMEvent kuma_events)
+{
+    uint32_t ev = 0;
+    if(kuma_events & KUMA_EV_READ) {
+        ev |= POLLIN;
+    }
+    if(kuma_events & KUMA_EV_WRITE) {
+        ev |= POLLOUT;
+    }
+    if(kuma_events & KUMA_EV_ERROR) {
+        ev |= POLLERR | POLLHUP;
+    }
+    return ev;
+}
+
+KMEvent IoUring::get_kuma_events(uint32_t events)
+{
+    KMEvent ev = 0;
+    if(events & POLLIN) {
+        ev |= KUMA_EV_READ;
+    }
+    if(events & POLLOUT) {
+        ev |= KUMA_EV_WRITE;
+    }
+    if(events & (POLLERR | POLLHUP)) {
+        ev |= KUMA_EV_ERROR;
+    }
+    return ev;
+}
+
+io_uring_sqe* IoUring::getSqe()
+{
+    if (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+        // submission ring is full, submit the queued requests now
+        enter(0, 0);
+        if (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+            return nullptr;
+        }
+    }
+    auto idx = sqe_tail_ & sq_mask_;
+    auto *sqe = &sqes_[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array_[idx] = idx;
+    ++sqe_tail_;
+    return sqe;
+}
+
+int IoUring::enter(unsigned min_complete, uint32_t wait_ms)
+{
+    __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+    unsigned to_submit = sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (0 == min_complete) {
+        if (0 == to_submit) {
+            return 0;
+        }
+        return io_uring_enter(ring_fd_, to_submit, 0, 0, nullptr, 0);
+    }
+    __kernel_timespec ts;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (wait_ms != (uint32_t)-1) {
+        ts.tv_sec = wait_ms / 1000;
+        ts.tv_nsec = (wait_ms % 1000) * 1000000LL;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+    return io_uring_enter(ring_fd_, to_submit, min_complete, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+bool IoUring::addPoll(SOCKET_FD fd, KMEvent events)
+{
+    auto *sqe = getSqe();
+    if (!sqe) {
+        KUMA_ERRTRACE("IoUring::addPoll, submission ring is full, fd="<<fd);
+        return false;
+    }
+    if (fd >= poll_ids_.size()) {
+        poll_ids_.resize(poll_items_.size());
+    }
+    auto poll_id = ++next_poll_id_;
+    poll_ids_[fd] = poll_id;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = get_events(events);
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = toUserData(poll_id, fd);
+    return true;
+}
+
+void IoUring::removePoll(SOCKET_FD fd)
+{
+    if (fd >= poll_ids_.size() || 0 == poll_ids_[fd]) {
+        return;
+    }
+    auto user_data = toUserData(poll_ids_[fd], fd);
+    poll_ids_[fd] = 0; // completions of the removed poll are dropped
+    auto *sqe = getSqe();
+    if (sqe) {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = user_data;
+        sqe->user_data = kIgnoredUserData;
+    }
+}
+
+KMError IoUring::registerFd(SOCKET_FD fd, KMEvent events, PollCallback cb)
+{
+    if (fd < 0) {
+        return KMError::INVALID_PARAM;
+    }
+    resizePollItems(fd);
+    if (INVALID_FD != poll_items_[fd].fd) {
+        removePoll(fd);
+    }
+    poll_items_[fd].fd = fd;
+    poll_items_[fd].events = events;
+    poll_items_[fd].cb = std::move(cb);
+    if (!addPoll(fd, events)) {
+        poll_items_[fd].reset();
+        return KMError::FAILED;
+    }
+    KUMA_INFOTRACE("IoUring::registerFd, fd=" << fd << ", ev=" << events);
+    
+    return KMError::NOERR;
+}
+
+KMError IoUring::unregisterFd(SOCKET_FD fd)
+{
+    int max_fd = int(poll_items_.size() - 1);
+    KUMA_INFOTRACE("IoUring::unregisterFd, fd="<<fd<<", max_fd="<<max_fd);
+    if (fd < 0 || fd > max_fd) {
+        KUMA_WARNTRACE("IoUring::unregisterFd, failed, max_fd=" << max_fd);
+        return KMError::INVALID_PARAM;
+    }
+    removePoll(fd);
+    if(fd < max_fd) {
+        poll_items_[fd].reset();
+    } else if (fd == max_fd) {
+        poll_items_.pop_back();
+    }
+    return KMError::NOERR;
+}
+
+KMError IoUring::updateFd(SOCKET_FD fd, KMEvent events)
+{
+    if(fd < 0 || fd >= poll_items_.size() || INVALID_FD == poll_items_[fd].fd) {
+        return KMError::FAILED;
+    }
+    if (poll_items_[fd].events == events) {
+        return KMError::NOERR;
+    }
+    removePoll(fd);
+    if (!addPoll(fd, events)) {
+        return KMError::FAILED;
+    }
+    poll_items_[fd].events = events;
+    return KMError::NOERR;
+}
+
+KMError IoUring::wait(uint32_t wait_ms)
+{
+    auto cq_head = *cq_head_;
+    if (cq_head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+        // submit the queued requests and wait for completions in one syscall
+        if (enter(1, wait_ms) < 0 && errno != ETIME && errno != EINTR) {
+            KUMA_ERRTRACE("IoUring::wait, errno="<<errno);
+        }
+    } else {
+        enter(0, 0);
+    }
+    
+    // copy out the completions, the callbacks may queue new requests
+    io_uring_cqe events[MAX_EVENT_NUM];
+    int nevents = 0;
+    auto cq_tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; cq_head != cq_tail && nevents < MAX_EVENT_NUM; ++cq_head) {
+        auto &cqe = cqes_[cq_head & cq_mask_];
+        if (cqe.user_data != kIgnoredUserData) {
+            events[nevents++] = cqe;
+        }
+    }
+    __atomic_store_n(cq_head_, cq_head, __ATOMIC_RELEASE);
+    onWaitReturned(nevents);
+    
+    for (int i = 0; i < nevents; ++i) {
+        auto &cqe = events[i];
+        SOCKET_FD fd = (SOCKET_FD)(cqe.user_data & 0xFFFFFFFF);
+        uint32_t poll_id = (uint32_t)(cqe.user_data >> 32);
+        if (fd >= poll_ids_.size() || poll_ids_[fd] != poll_id || fd >= poll_items_.size()) {
+            continue; // the poll was removed or replaced
+        }
+        KMEvent revents = 0;
+        if (cqe.res < 0) {
+            if (-ECANCELED == cqe.res) {
+                continue;
+            }
+            poll_ids_[fd] = 0;
+            revents = KUMA_EV_ERROR;
+        } else {
+            if (!(cqe.flags & IORING_CQE_F_MORE)) {
+                // multishot poll is terminated by kernel, e.g. completion ring overflow
+                addPoll(fd, poll_items_[fd].events);
+            }
+            revents = get_kuma_events(cqe.res);
+        }
+        revents &= poll_items_[fd].events;
+        if (revents) {
+            auto &cb = poll_items_[fd].cb;
+            if(cb) invokeCallback(cb, fd, revents, nullptr, 0);
+        }
+    }
+    return KMError::NOERR;
+}
+
+void IoUring::notify()
+{
+    notifier_->notify();
+}
+
+IOPoll* createIoUring() {
+    if (!IoUring::isSupported()) {
+        return nullptr;
+    }
+    return new IoUring();
+}
+
+KUMA_NS_END
+
+#else // KUMA_HAS_IO_URING
+
+KUMA_NS_BEGIN
+
+IOPoll* createIoUring() {
+    return nullptr;
+}
+
+KUMA_NS_END
+
+#endif // KUMA_HAS_IO_URING
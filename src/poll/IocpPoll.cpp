@@ -33,7 +33,7 @@ public:
     ~IocpPoll();
     
     bool init();
-    KMError registerFd(SOCKET_FD fd, KMEvent events, IOCallback cb);
+    KMError registerFd(SOCKET_FD fd, KMEvent events, PollCallback cb);
     KMError unregisterFd(SOCKET_FD fd);
     KMError updateFd(SOCKET_FD fd, KMEvent events);
     KMError wait(uint32_t wait_ms);
@@ -68,7 +68,7 @@ bool IocpPoll::init()
     return true;
 }
 
-KMError IocpPoll::registerFd(SOCKET_FD fd, KMEvent events, IOCallback cb)
+KMError IocpPoll::registerFd(SOCKET_FD fd, KMEvent events, PollCallback cb)
 {
     KUMA_INFOTRACE("IocpPoll::registerFd, fd=" << fd << ", events=" << events);
     if (CreateIoCompletionPort((HANDLE)fd, hCompPort_, (ULONG_PTR)fd, 0) == NULL) {
@@ -108,14 +108,15 @@ KMError IocpPoll::wait(uint32_t wait_ms)
     OVERLAPPED_ENTRY entries[128];
     ULONG count = 0;
     auto success = GetQueuedCompletionStatusEx(hCompPort_, entries, ARRAY_SIZE(entries), &count, wait_ms, FALSE);
+    onWaitReturned(success ? (int)count : 0);
     if (success) {
         for (ULONG i = 0; i < count; ++i) {
             if (entries[i].lpOverlapped) {
                 SOCKET_FD fd = (SOCKET_FD)entries[i].lpCompletionKey;
                 if (fd < poll_items_.size()) {
-                    IOCallback &cb = poll_items_[fd].cb;
+                    PollCallback &cb = poll_items_[fd].cb;
                     size_t io_size = entries[i].dwNumberOfBytesTransferred;
-                    if (cb) cb(0, entries[i].lpOverlapped, io_size);
+                    if (cb) invokeCallback(cb, fd, 0, entries[i].lpOverlapped, io_size);
                 }
             }
         }
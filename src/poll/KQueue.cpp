@@ -38,7 +38,7 @@ public:
     ~KQueue();
     
     bool init() override;
-    KMError registerFd(SOCKET_FD fd, KMEvent events, IOCallback cb) override;
+    KMError registerFd(SOCKET_FD fd, KMEvent events, PollCallback cb) override;
     KMError unregisterFd(SOCKET_FD fd) override;
     KMError updateFd(SOCKET_FD fd, KMEvent events) override;
     KMError wait(uint32_t wait_time_ms) override;
@@ -81,13 +81,13 @@ bool KQueue::init()
         if(!notifier_->init()) {
             return false;
         }
-        IOCallback cb ([this](KMEvent ev, void*, size_t) { notifier_->onEvent(ev); });
+        PollCallback cb ([this](KMEvent ev, void*, size_t) { notifier_->onEvent(ev); });
         registerFd(notifier_->getReadFD(), KUMA_EV_READ|KUMA_EV_ERROR, std::move(cb));
     }
     return true;
 }
 
-KMError KQueue::registerFd(SOCKET_FD fd, KMEvent events, IOCallback cb)
+KMError KQueue::registerFd(SOCKET_FD fd, KMEvent events, PollCallback cb)
 {
     if (fd < 0) {
         return KMError::INVALID_PARAM;
@@ -210,6 +210,7 @@ KMError KQueue::wait(uint32_t wait_ms)
     }
     struct kevent kevents[MAX_EVENT_NUM];
     int nevents = kevent(kqueue_fd_, 0, 0, kevents, MAX_EVENT_NUM, wait_ms == -1 ? NULL : &tval);
+    onWaitReturned(nevents);
     if (nevents < 0) {
         if(errno != EINTR) {
             KUMA_ERRTRACE("KQueue::wait, errno="<<errno);
@@ -249,7 +250,7 @@ KMError KQueue::wait(uint32_t wait_ms)
                 revents &= poll_items_[fd].events;
                 if (revents) {
                     auto &cb = poll_items_[fd].cb;
-                    if(cb) cb(revents, nullptr, 0);
+                    if(cb) invokeCallback(cb, fd, revents, nullptr, 0);
                 }
             }
         }
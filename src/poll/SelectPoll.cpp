@@ -34,7 +34,7 @@ public:
     ~SelectPoll();
     
     bool init() override;
-    KMError registerFd(SOCKET_FD fd, KMEvent events, IOCallback cb) override;
+    KMError registerFd(SOCKET_FD fd, KMEvent events, PollCallback cb) override;
     KMError unregisterFd(SOCKET_FD fd) override;
     KMError updateFd(SOCKET_FD fd, KMEvent events) override;
     KMError wait(uint32_t wait_time_ms) override;
@@ -82,13 +82,13 @@ bool SelectPoll::init()
         if (!notifier_->init()) {
             return false;
         }
-        IOCallback cb([this](KMEvent ev, void*, size_t) { notifier_->onEvent(ev); });
+        PollCallback cb([this](KMEvent ev, void*, size_t) { notifier_->onEvent(ev); });
         registerFd(notifier_->getReadFD(), KUMA_EV_READ | KUMA_EV_ERROR, std::move(cb));
     }
     return true;
 }
 
-KMError SelectPoll::registerFd(SOCKET_FD fd, KMEvent events, IOCallback cb)
+KMError SelectPoll::registerFd(SOCKET_FD fd, KMEvent events, PollCallback cb)
 {
     if (fd < 0) {
         return KMError::INVALID_PARAM;
@@ -206,6 +206,7 @@ KMError SelectPoll::wait(uint32_t wait_ms)
         tval.tv_usec = (wait_ms - tval.tv_sec*1000)*1000;
     }
     int nready = ::select(max_fd_ + 1, &readfds, &writefds, &exceptfds, wait_ms == -1 ? NULL : &tval);
+    onWaitReturned(nready);
     if (nready <= 0) {
         return KMError::NOERR;
     }
@@ -231,7 +232,7 @@ KMError SelectPoll::wait(uint32_t wait_ms)
             revents &= poll_items_[fd].events;
             if (revents) {
                 auto &cb = poll_items_[fd].cb;
-                if (cb) cb(revents, nullptr, 0);
+                if (cb) invokeCallback(cb, fd, revents, nullptr, 0);
             }
         }
     }
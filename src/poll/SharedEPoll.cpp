@@ -0,0 +1,432 @@
+/* Copyright (c) 2014, Fengping Bao <jamol@live.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "IOPoll.h"
+#include "Notifier.h"
+#include "util/kmtrace.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <algorithm>
+
+KUMA_NS_BEGIN
+
+// epoll_event.data of the fds that are not registered by user
+static const uint64_t kNotifierData = ~0ULL;
+static const uint64_t kSharedData = ~0ULL - 1;
+static const uint64_t kStopData = ~0ULL - 2;
+
+struct SharedItem
+{
+    PollCallback  cb;
+    KMEvent     events { 0 };
+    uint32_t    gen { 0 };
+    SOCKET_FD   fd { INVALID_FD };
+    std::thread::id owner;          // the thread running the callback
+    bool        busy { false };     // the callback or an exclusive task is running
+    bool        retired { false };  // unregistered while busy, deleted after the callback
+    bool        deferred { false }; // armed after busy or the retired callback of same fd ends
+    std::deque<KMFunction<void(void)>> tasks; // the exclusive tasks posted while busy
+};
+
+/**
+ * SharedEPoll lets the loop thread and the IO threads wait on one epoll set. the fds are
+ * registered with EPOLLONESHOT and re-armed after the callback returns, so the callbacks of
+ * one fd never run concurrently, and an idle thread picks up the next ready fd.
+ * the loop thread waits on a private epoll that holds the notifier and the shared set.
+ * epoll_event.data carries fd and registration generation, so the stale event of an fd
+ * that is unregistered or registered again is dropped
+ */
+class SharedEPoll : public IOPoll
+{
+public:
+    SharedEPoll();
+    ~SharedEPoll();
+
+    bool init();
+    KMError registerFd(SOCKET_FD fd, KMEvent events, PollCallback cb);
+    KMError unregisterFd(SOCKET_FD fd);
+    KMError updateFd(SOCKET_FD fd, KMEvent events);
+    KMError wait(uint32_t wait_time_ms);
+    KMError waitShared(uint32_t wait_time_ms);
+    void wakeupShared();
+    std::thread::id callbackThread(SOCKET_FD fd);
+    void runExclusive(SOCKET_FD fd, KMFunction<void(void)> task);
+    void notify();
+    PollType getType() const { return PollType::EPOLL; }
+    bool isLevelTriggered() const { return false; }
+    size_t registeredFdCount() const { return item_count_; }
+
+private:
+    uint32_t get_events(KMEvent kuma_events);
+    KMEvent get_kuma_events(uint32_t events);
+    int dispatchShared(uint32_t wait_ms);
+    void releaseItem(std::unique_lock<std::mutex> &lock, SOCKET_FD fd, SharedItem *item, bool consumed);
+    // the following are called with mutex_ locked
+    int ctlItem(int op, SOCKET_FD fd, SharedItem *item);
+    void retireItem(SOCKET_FD fd);
+    bool hasRetired(SOCKET_FD fd) const;
+
+private:
+    int             epoll_fd_ { INVALID_FD };   // the notifier and shared_fd_, loop thread only
+    int             shared_fd_ { INVALID_FD };  // the registered fds, waited by all the threads
+    int             stop_fd_ { INVALID_FD };
+    NotifierPtr     notifier_ { std::move(Notifier::createNotifier()) };
+    
+    std::mutex      mutex_;
+    std::vector<std::unique_ptr<SharedItem>> fd_items_; // indexed by fd
+    std::vector<SharedItem*> retired_items_; // retired while the callback is running
+    uint32_t        next_gen_ = 0;
+    std::atomic<size_t> item_count_ { 0 };
+};
+
+SharedEPoll::SharedEPoll()
+{
+
+}
+
+SharedEPoll::~SharedEPoll()
+{
+    for (auto fd : {epoll_fd_, shared_fd_, stop_fd_}) {
+        if (INVALID_FD != fd) {
+            close(fd);
+        }
+    }
+}
+
+bool SharedEPoll::init()
+{
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    shared_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    stop_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (INVALID_FD == epoll_fd_ || INVALID_FD == shared_fd_ || INVALID_FD == stop_fd_) {
+        KUMA_ERRTRACE("SharedEPoll::init, failed, errno=" << errno);
+        return false;
+    }
+    if (!notifier_->ready() && !notifier_->init()) {
+        return false;
+    }
+    struct epoll_event evt = {0};
+    evt.events = EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLET;
+    evt.data.u64 = kNotifierData;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, notifier_->getReadFD(), &evt) < 0) {
+        return false;
+    }
+    // level-triggered, the loop thread is woken up until the ready fds are picked up
+    evt.events = EPOLLIN;
+    evt.data.u64 = kSharedData;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, shared_fd_, &evt) < 0) {
+        return false;
+    }
+    // it is never read after written, all the waiting threads are woken up
+    evt.events = EPOLLIN;
+    evt.data.u64 = kStopData;
+    if (epoll_ctl(shared_fd_, EPOLL_CTL_ADD, stop_fd_, &evt) < 0) {
+        return false;
+    }
+    return true;
+}
+
+uint32_t SharedEPoll::get_events(KMEvent kuma_events)
+{
+    uint32_t ev = EPOLLET | EPOLLONESHOT;
+    if(kuma_events & KUMA_EV_READ) {
+        ev |= EPOLLIN;
+    }
+    if(kuma_events & KUMA_EV_WRITE) {
+        ev |= EPOLLOUT;
+    }
+    if(kuma_events & KUMA_EV_ERROR) {
+        ev |= EPOLLERR | EPOLLHUP;
+    }
+    return ev;
+}
+
+KMEvent SharedEPoll::get_kuma_events(uint32_t events)
+{
+    KMEvent ev = 0;
+    if(events & EPOLLIN) {
+        ev |= KUMA_EV_READ;
+    }
+    if(events & EPOLLOUT) {
+        ev |= KUMA_EV_WRITE;
+    }
+    if(events & (EPOLLERR | EPOLLHUP)) {
+        ev |= KUMA_EV_ERROR;
+    }
+    return ev;
+}
+
+int SharedEPoll::ctlItem(int op, SOCKET_FD fd, SharedItem *item)
+{
+    struct epoll_event evt = {0};
+    evt.events = get_events(item->events);
+    evt.data.u64 = (uint64_t(item->gen) << 32) | uint32_t(fd);
+    return epoll_ctl(shared_fd_, op, fd, &evt);
+}
+
+void SharedEPoll::retireItem(SOCKET_FD fd)
+{
+    auto &item = fd_items_[fd];
+    if (item->busy) {
+        // the running callback is destroyed by the thread running it
+        item->retired = true;
+        retired_items_.push_back(item.release());
+    } else {
+        item.reset();
+    }
+}
+
+bool SharedEPoll::hasRetired(SOCKET_FD fd) const
+{
+    return std::any_of(retired_items_.begin(), retired_items_.end(), [fd] (const SharedItem *item) {
+        return item->fd == fd;
+    });
+}
+
+KMError SharedEPoll::registerFd(SOCKET_FD fd, KMEvent events, PollCallback cb)
+{
+    if (fd < 0) {
+        return KMError::INVALID_PARAM;
+    }
+    std::lock_guard<std::mutex> g(mutex_);
+    if (fd >= fd_items_.size()) {
+        fd_items_.resize(fd + 1024);
+    }
+    int op = EPOLL_CTL_ADD;
+    if (fd_items_[fd]) {
+        op = EPOLL_CTL_MOD;
+        retireItem(fd);
+    }
+    std::unique_ptr<SharedItem> item(new SharedItem());
+    item->cb = std::move(cb);
+    item->events = events;
+    item->fd = fd;
+    item->gen = ++next_gen_;
+    // the callbacks of one fd never run concurrently, the new registration is armed
+    // after the running callback returns. an added fd is gated in dispatchShared
+    item->deferred = hasRetired(fd);
+    if ((EPOLL_CTL_ADD == op || !item->deferred) && ctlItem(op, fd, item.get()) < 0) {
+        KUMA_ERRTRACE("SharedEPoll::registerFd error, fd=" << fd << ", ev=" << events << ", errno=" << errno);
+        if (EPOLL_CTL_MOD == op) {
+            epoll_ctl(shared_fd_, EPOLL_CTL_DEL, fd, NULL);
+            --item_count_;
+        }
+        return KMError::FAILED;
+    }
+    fd_items_[fd] = std::move(item);
+    if (EPOLL_CTL_ADD == op) {
+        ++item_count_;
+    }
+    KUMA_INFOTRACE("SharedEPoll::registerFd, fd=" << fd << ", ev=" << events);
+    return KMError::NOERR;
+}
+
+KMError SharedEPoll::unregisterFd(SOCKET_FD fd)
+{
+    KUMA_INFOTRACE("SharedEPoll::unregisterFd, fd="<<fd);
+    std::lock_guard<std::mutex> g(mutex_);
+    if (fd < 0 || fd >= fd_items_.size() || !fd_items_[fd]) {
+        KUMA_WARNTRACE("SharedEPoll::unregisterFd, failed, fd=" << fd << " is not registered");
+        return KMError::INVALID_PARAM;
+    }
+    epoll_ctl(shared_fd_, EPOLL_CTL_DEL, fd, NULL);
+    retireItem(fd);
+    --item_count_;
+    return KMError::NOERR;
+}
+
+KMError SharedEPoll::updateFd(SOCKET_FD fd, KMEvent events)
+{
+    std::lock_guard<std::mutex> g(mutex_);
+    if (fd < 0 || fd >= fd_items_.size() || !fd_items_[fd]) {
+        return KMError::FAILED;
+    }
+    auto &item = fd_items_[fd];
+    item->events = events;
+    if (item->busy) {
+        // re-armed with new events after the callback or the exclusive task
+        item->deferred = true;
+    } else if (!item->deferred && ctlItem(EPOLL_CTL_MOD, fd, item.get()) < 0) {
+        KUMA_ERRTRACE("SharedEPoll::updateFd error, fd="<<fd<<", errno="<<errno);
+        return KMError::FAILED;
+    }
+    return KMError::NOERR;
+}
+
+int SharedEPoll::dispatchShared(uint32_t wait_ms)
+{
+    // one event per wait, the other ready fds are left to the idle threads
+    struct epoll_event evt;
+    int nfds = epoll_wait(shared_fd_, &evt, 1, wait_ms);
+    if (nfds <= 0 || kStopData == evt.data.u64) {
+        return nfds;
+    }
+    auto fd = static_cast<SOCKET_FD>(evt.data.u64 & 0xFFFFFFFF);
+    auto gen = static_cast<uint32_t>(evt.data.u64 >> 32);
+    SharedItem *item = nullptr;
+    KMEvent revents = 0;
+    {
+        std::lock_guard<std::mutex> g(mutex_);
+        if (fd >= fd_items_.size() || !fd_items_[fd] || fd_items_[fd]->gen != gen) {
+            return 0; // unregistered or registered again
+        }
+        item = fd_items_[fd].get();
+        if (item->busy || hasRetired(fd)) {
+            // an exclusive task or the callback of previous registration is running,
+            // re-armed after it returns
+            item->deferred = true;
+            return 0;
+        }
+        item->busy = true;
+        item->owner = std::this_thread::get_id();
+        revents = get_kuma_events(evt.events) & item->events;
+    }
+    if (revents && item->cb) {
+        item->cb(revents, nullptr, 0);
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    releaseItem(lock, fd, item, true);
+    return nfds;
+}
+
+void SharedEPoll::releaseItem(std::unique_lock<std::mutex> &lock, SOCKET_FD fd, SharedItem *item, bool consumed)
+{
+    while (true) {
+        // the exclusive tasks posted while the item is busy
+        while (!item->retired && !item->tasks.empty()) {
+            auto task = std::move(item->tasks.front());
+            item->tasks.pop_front();
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+        item->busy = false;
+        if (!item->retired) {
+            // re-armed if the one-shot event is consumed, or it is held while busy
+            if (consumed || item->deferred) {
+                item->deferred = false;
+                if (ctlItem(EPOLL_CTL_MOD, fd, item) < 0) {
+                    KUMA_ERRTRACE("SharedEPoll::releaseItem, failed to rearm, fd="<<fd<<", errno="<<errno);
+                }
+            }
+            return;
+        }
+        retired_items_.erase(std::find(retired_items_.begin(), retired_items_.end(), item));
+        delete item;
+        // the registration that is deferred by the retired callback, its tasks are run here
+        if (fd >= fd_items_.size() || !fd_items_[fd] || !fd_items_[fd]->deferred || hasRetired(fd)) {
+            return;
+        }
+        item = fd_items_[fd].get();
+        item->busy = true;
+        item->owner = std::this_thread::get_id();
+        consumed = true;
+    }
+}
+
+void SharedEPoll::runExclusive(SOCKET_FD fd, KMFunction<void(void)> task)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (fd < 0 || fd >= fd_items_.size() || !fd_items_[fd]) {
+        lock.unlock();
+        task();
+        return;
+    }
+    auto *item = fd_items_[fd].get();
+    if (item->busy || hasRetired(fd)) {
+        // run by the thread that releases the item
+        item->tasks.push_back(std::move(task));
+        return;
+    }
+    item->busy = true;
+    item->owner = std::this_thread::get_id();
+    lock.unlock();
+    task();
+    lock.lock();
+    releaseItem(lock, fd, item, false);
+}
+
+KMError SharedEPoll::wait(uint32_t wait_ms)
+{
+    struct epoll_event events[2];
+    int nfds = epoll_wait(epoll_fd_, events, 2, wait_ms);
+    onWaitReturned(nfds);
+    if (nfds < 0) {
+        if(errno != EINTR) {
+            KUMA_ERRTRACE("SharedEPoll::wait, errno="<<errno);
+        }
+        return KMError::NOERR;
+    }
+    for (int i = 0; i < nfds; ++i) {
+        if (kNotifierData == events[i].data.u64) {
+            notifier_->onEvent(get_kuma_events(events[i].events));
+        } else {
+            dispatchShared(0);
+        }
+    }
+    return KMError::NOERR;
+}
+
+KMError SharedEPoll::waitShared(uint32_t wait_ms)
+{
+    if (dispatchShared(wait_ms) < 0 && errno != EINTR) {
+        KUMA_ERRTRACE("SharedEPoll::waitShared, errno="<<errno);
+        return KMError::FAILED;
+    }
+    return KMError::NOERR;
+}
+
+void SharedEPoll::wakeupShared()
+{
+    uint64_t count = 1;
+    if (write(stop_fd_, &count, sizeof(count)) < 0) {
+        KUMA_WARNTRACE("SharedEPoll::wakeupShared, errno="<<errno);
+    }
+}
+
+std::thread::id SharedEPoll::callbackThread(SOCKET_FD fd)
+{
+    std::lock_guard<std::mutex> g(mutex_);
+    for (auto *item : retired_items_) {
+        if (item->fd == fd) {
+            return item->owner;
+        }
+    }
+    return std::thread::id();
+}
+
+void SharedEPoll::notify()
+{
+    notifier_->notify();
+}
+
+IOPoll* createSharedEPoll() {
+    return new SharedEPoll();
+}
+
+KUMA_NS_END
@@ -38,7 +38,7 @@ public:
     ~VPoll();
     
     bool init() override;
-    KMError registerFd(SOCKET_FD fd, KMEvent events, IOCallback cb) override;
+    KMError registerFd(SOCKET_FD fd, KMEvent events, PollCallback cb) override;
     KMError unregisterFd(SOCKET_FD fd) override;
     KMError updateFd(SOCKET_FD fd, KMEvent events) override;
     KMError wait(uint32_t wait_ms) override;
@@ -73,7 +73,7 @@ bool VPoll::init()
         if (!notifier_->init()) {
             return false;
         }
-        IOCallback cb([this](KMEvent ev, void*, size_t) { notifier_->onEvent(ev); });
+        PollCallback cb([this](KMEvent ev, void*, size_t) { notifier_->onEvent(ev); });
         registerFd(notifier_->getReadFD(), KUMA_EV_READ | KUMA_EV_ERROR, std::move(cb));
     }
     return true;
@@ -117,7 +117,7 @@ KMEvent VPoll::get_kuma_events(uint32_t events)
     return ev;
 }
 
-KMError VPoll::registerFd(SOCKET_FD fd, KMEvent events, IOCallback cb)
+KMError VPoll::registerFd(SOCKET_FD fd, KMEvent events, PollCallback cb)
 {
     if (fd < 0) {
         return KMError::INVALID_PARAM;
@@ -199,6 +199,7 @@ KMError VPoll::wait(uint32_t wait_ms)
 #else
     int num_revts = poll(&poll_fds_[0], (nfds_t)poll_fds_.size(), wait_ms);
 #endif
+    onWaitReturned(num_revts);
     if (-1 == num_revts) {
         if(EINTR == errno) {
             errno = 0;
@@ -221,7 +222,7 @@ KMError VPoll::wait(uint32_t wait_ms)
                 auto revents = get_kuma_events(poll_fds[idx].revents);
                 revents &= item.events;
                 if (revents && item.cb) {
-                    item.cb(revents, nullptr, 0);
+                    invokeCallback(item.cb, poll_fds[idx].fd, revents, nullptr, 0);
                 }
             }
         }
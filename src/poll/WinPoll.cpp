@@ -37,7 +37,7 @@ public:
     ~WinPoll();
     
     bool init();
-    KMError registerFd(SOCKET_FD fd, uint32_t events, IOCallback cb);
+    KMError registerFd(SOCKET_FD fd, uint32_t events, PollCallback cb);
     KMError unregisterFd(SOCKET_FD fd);
     KMError updateFd(SOCKET_FD fd, uint32_t events);
     KMError wait(uint32_t wait_ms);
@@ -131,7 +131,7 @@ void WinPoll::resizePollItems(SOCKET_FD fd)
     }
 }
 
-KMError WinPoll::registerFd(SOCKET_FD fd, uint32_t events, IOCallback cb)
+KMError WinPoll::registerFd(SOCKET_FD fd, uint32_t events, PollCallback cb)
 {
     KUMA_INFOTRACE("WinPoll::registerFd, fd=" << fd << ", events=" << events);
     resizePollItems(fd);
@@ -176,7 +176,9 @@ KMError WinPoll::updateFd(SOCKET_FD fd, uint32_t events)
 KMError WinPoll::wait(uint32_t wait_ms)
 {
     MSG msg;
-    if (GetMessage(&msg, NULL, 0, 0)) {
+    auto ret = GetMessage(&msg, NULL, 0, 0);
+    onWaitReturned(ret ? 1 : 0);
+    if (ret) {
         TranslateMessage(&msg);
         DispatchMessage(&msg);
     }
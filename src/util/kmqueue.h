@@ -19,6 +19,7 @@
 #include "kmdefs.h"
 #include <type_traits>
 #include <memory>
+#include <atomic>
 
 KUMA_NS_BEGIN
 
@@ -334,6 +335,92 @@ protected:
     NodePtr head_;
     NodePtr tail_;
 };
+
+///
+// intrusive multi-producer/single-consumer queue (Dmitry Vyukov's algorithm)
+// E must derive from MPSCNode. enqueue is wait-free and can be called on any thread,
+// dequeue must be called on the consumer thread only
+///
+class MPSCNode
+{
+public:
+    std::atomic<MPSCNode*> mpsc_next_{ nullptr };
+};
+
+template <class E>
+class MPSCQueue final
+{
+public:
+    MPSCQueue()
+    : head_(&stub_), tail_(&stub_)
+    {
+        static_assert(std::is_base_of<MPSCNode, E>::value, "E must derive from MPSCNode");
+    }
+    MPSCQueue(const MPSCQueue &) = delete;
+    MPSCQueue& operator=(const MPSCQueue &) = delete;
+    
+    void enqueue(E *node)
+    {
+        enqueue(node, node);
+    }
+    
+    // enqueue a chain of nodes linked by mpsc_next_ at once
+    void enqueue(E *first, E *last)
+    {
+        last->mpsc_next_.store(nullptr, std::memory_order_relaxed);
+        MPSCNode *prev = head_.exchange(last, std::memory_order_acq_rel);
+        prev->mpsc_next_.store(first, std::memory_order_release);
+    }
+    
+    /* dequeue a node, return nullptr if queue is empty or a producer is in the
+     * middle of enqueue, the node will be visible after that producer completes
+     */
+    E* dequeue()
+    {
+        MPSCNode *tail = tail_;
+        MPSCNode *next = tail->mpsc_next_.load(std::memory_order_acquire);
+        if (tail == &stub_) {
+            if (!next) {
+                return nullptr;
+            }
+            tail_ = next;
+            tail = next;
+            next = next->mpsc_next_.load(std::memory_order_acquire);
+        }
+        if (next) {
+            tail_ = next;
+            return static_cast<E*>(tail);
+        }
+        if (tail != head_.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        push_stub();
+        next = tail->mpsc_next_.load(std::memory_order_acquire);
+        if (next) {
+            tail_ = next;
+            return static_cast<E*>(tail);
+        }
+        return nullptr;
+    }
+    
+    bool empty() const
+    {// correct on consumer side, a node in the middle of enqueue is counted
+        return tail_ == &stub_ && head_.load(std::memory_order_acquire) == &stub_;
+    }
+    
+private:
+    void push_stub()
+    {
+        stub_.mpsc_next_.store(nullptr, std::memory_order_relaxed);
+        MPSCNode *prev = head_.exchange(&stub_, std::memory_order_acq_rel);
+        prev->mpsc_next_.store(&stub_, std::memory_order_release);
+    }
+    
+private:
+    std::atomic<MPSCNode*>  head_; // producers side
+    MPSCNode*               tail_; // consumer side
+    MPSCNode                stub_;
+};
     
 KUMA_NS_END
 
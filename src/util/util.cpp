@@ -29,6 +29,7 @@
 # include <MSWSock.h>
 # include <Ws2tcpip.h>
 # include <windows.h>
+# include <io.h>
 #else
 # include <string.h>
 # include <netdb.h>
@@ -40,6 +41,10 @@
 # include <dlfcn.h>
 # include <unistd.h>
 # include <netinet/tcp.h>
+# include <pthread.h>
+# ifdef KUMA_OS_LINUX
+#  include <sched.h>
+# endif
 # ifdef KUMA_OS_MAC
 #  include "CoreFoundation/CoreFoundation.h"
 #  include <mach-o/dyld.h>
@@ -499,7 +504,9 @@ int set_nonblocking(SOCKET_FD fd) {
     ::ioctlsocket(fd, FIONBIO, (ULONG*)&mode);
 #else
     int flag = ::fcntl(fd, F_GETFL, 0);
-    ::fcntl(fd, F_SETFL, flag | O_NONBLOCK | O_ASYNC);
+    if (!(flag & O_NONBLOCK)) { // the accepted fd may be already nonblocking
+        ::fcntl(fd, F_SETFL, flag | O_NONBLOCK | O_ASYNC);
+    }
 #endif
     return 0;
 }
@@ -509,6 +516,22 @@ int set_tcpnodelay(SOCKET_FD fd) {
     return ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char*)&opt_val, sizeof(int));
 }
 
+int read_file(int fd, void *buf, size_t len, int64_t offset)
+{
+#ifdef KUMA_OS_WIN
+    if (_lseeki64(fd, offset, SEEK_SET) < 0) {
+        return -1;
+    }
+    return _read(fd, buf, static_cast<unsigned int>(len));
+#else
+    ssize_t ret = 0;
+    do {
+        ret = ::pread(fd, buf, len, offset);
+    } while (ret < 0 && EINTR == errno);
+    return static_cast<int>(ret);
+#endif
+}
+
 int find_first_set(uint32_t b)
 {
     if(0 == b) {
@@ -774,6 +797,30 @@ std::string getCurrentModulePath()
     return str_path;
 }
 
+bool set_thread_affinity(int cpu)
+{
+    if (cpu < 0) {
+        return false;
+    }
+#if defined(KUMA_OS_WIN)
+    if (cpu >= (int)sizeof(DWORD_PTR) * 8) {
+        return false;
+    }
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#elif defined(KUMA_OS_LINUX)
+    if (cpu >= CPU_SETSIZE) {
+        return false;
+    }
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+#else
+    // macOS only supports affinity tags as a scheduling hint
+    return false;
+#endif
+}
+
 #ifndef KUMA_OS_MAC
 /**
  * strlcpy - Copy a C-string into a sized buffer
@@ -85,6 +85,8 @@ char(&ArraySizeHelper(const T(&array)[N]))[N];
 
 int set_nonblocking(SOCKET_FD fd);
 int set_tcpnodelay(SOCKET_FD fd);
+// read the file at offset without moving the file position on POSIX, return the bytes read or -1
+int read_file(int fd, void *buf, size_t len, int64_t offset);
 int find_first_set(uint32_t b);
 int find_first_set(uint64_t b);
 TICK_COUNT_TYPE get_tick_count_ms();
@@ -107,6 +109,9 @@ std::string& trim_right(std::string& str);
 std::string getExecutablePath();
 std::string getCurrentModulePath();
 
+// pin the calling thread to the cpu core, return false if failed or not supported
+bool set_thread_affinity(int cpu);
+
 template<typename LAMBDA> // (std::string &token) -> bool
 void for_each_token(const std::string &tokens, char delim, LAMBDA &&func)
 {
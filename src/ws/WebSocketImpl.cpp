@@ -213,6 +213,14 @@ int WebSocket::Impl::send(const KMBuffer &buf, bool is_text, bool is_fin, uint32
     return ret == KMError::NOERR ? static_cast<int>(chainSize) : -1;
 }
 
+KMError WebSocket::Impl::migrate(const EventLoopPtr &loop)
+{
+    if (getState() != State::OPEN) {
+        return KMError::INVALID_STATE;
+    }
+    return TcpConnection::migrate(loop);
+}
+
 KMError WebSocket::Impl::close()
 {
     KUMA_INFOXTRACE("close");
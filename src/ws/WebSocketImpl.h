@@ -61,6 +61,7 @@ public:
     KMError connect(const std::string& ws_url, HandshakeCallback cb);
     KMError attachFd(SOCKET_FD fd, const KMBuffer *init_buf, HandshakeCallback cb);
     KMError attachSocket(TcpSocket::Impl&& tcp, HttpParser::Impl&& parser, const KMBuffer *init_buf, HandshakeCallback cb);
+    KMError migrate(const EventLoopPtr &loop);
     int send(const void* data, size_t len, bool is_text, bool is_fin, uint32_t flags);
     int send(const KMBuffer &buf, bool is_text, bool is_fin, uint32_t flags);
     KMError close();
@@ -0,0 +1,1235 @@
+#include "LoopBench.h"
+#include "kmapi.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <cmath>
+#ifndef KUMA_OS_WIN
+# include <unistd.h>
+# include <fcntl.h>
+# include <time.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+#endif
+
+using namespace kuma;
+
+namespace {
+
+/* N producer threads post tasks to one loop, measure the throughput
+ * of EventLoop::post under contention
+ */
+void benchPost(int producers, int tasks_per_producer)
+{
+    EventLoop loop;
+    std::promise<void> ready;
+    std::thread loop_thread([&] {
+        loop.init();
+        ready.set_value();
+        loop.loop();
+    });
+    ready.get_future().wait();
+    
+    const long total = long(producers) * tasks_per_producer;
+    long count = 0; // accessed on loop thread only
+    std::promise<void> done;
+    std::atomic<bool> start{false};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < producers; ++i) {
+        threads.emplace_back([&] {
+            while (!start) {
+                std::this_thread::yield();
+            }
+            for (int j = 0; j < tasks_per_producer; ++j) {
+                loop.post([&] {
+                    if (++count == total) {
+                        done.set_value();
+                    }
+                });
+            }
+        });
+    }
+    auto start_time = std::chrono::steady_clock::now();
+    start = true;
+    done.get_future().wait();
+    auto diff = std::chrono::steady_clock::now() - start_time;
+    for (auto &t : threads) {
+        t.join();
+    }
+    EventLoop::Stats stats;
+    loop.sync([&] { stats = loop.getStats(); });
+    loop.stop();
+    loop_thread.join();
+    
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(diff).count();
+    printf("post: producers=%2d, tasks=%ld, elapsed=%lldms, %.0f tasks/s, notify issued=%llu, elided=%llu\n",
+           producers, total, (long long)ms, ms > 0 ? total * 1000.0 / ms : 0.0,
+           (unsigned long long)stats.notify_issued, (unsigned long long)stats.notify_elided);
+}
+
+/* N producer threads post tasks to one loop in batches of batch_size
+ */
+void benchBatch(int producers, int tasks_per_producer, int batch_size)
+{
+    EventLoop loop;
+    std::promise<void> ready;
+    std::thread loop_thread([&] {
+        loop.init();
+        ready.set_value();
+        loop.loop();
+    });
+    ready.get_future().wait();
+    
+    const long total = long(producers) * tasks_per_producer;
+    long count = 0; // accessed on loop thread only
+    std::promise<void> done;
+    std::atomic<bool> start{false};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < producers; ++i) {
+        threads.emplace_back([&] {
+            while (!start) {
+                std::this_thread::yield();
+            }
+            std::vector<EventLoop::MoveTask> tasks;
+            for (int j = 0; j < tasks_per_producer; ++j) {
+                tasks.emplace_back([&] {
+                    if (++count == total) {
+                        done.set_value();
+                    }
+                });
+                if (tasks.size() >= size_t(batch_size) || j + 1 == tasks_per_producer) {
+                    loop.post(std::move(tasks));
+                }
+            }
+        });
+    }
+    auto start_time = std::chrono::steady_clock::now();
+    start = true;
+    done.get_future().wait();
+    auto diff = std::chrono::steady_clock::now() - start_time;
+    for (auto &t : threads) {
+        t.join();
+    }
+    EventLoop::Stats stats;
+    loop.sync([&] { stats = loop.getStats(); });
+    loop.stop();
+    loop_thread.join();
+    
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(diff).count();
+    printf("batch: producers=%2d, batch=%d, tasks=%ld, elapsed=%lldms, %.0f tasks/s, notify issued=%llu, elided=%llu\n",
+           producers, batch_size, total, (long long)ms, ms > 0 ? total * 1000.0 / ms : 0.0,
+           (unsigned long long)stats.notify_issued, (unsigned long long)stats.notify_elided);
+}
+
+/* one thread posts a task to the loop and waits for it to be executed, then
+ * sleeps a while to let the loop go idle. measure the wakeup latency with and
+ * without busy poll
+ */
+void benchBusyPoll(uint32_t spin_us, int rounds)
+{
+    EventLoop loop;
+    std::promise<void> ready;
+    std::thread loop_thread([&] {
+        loop.init();
+        loop.setBusyPoll(spin_us);
+        ready.set_value();
+        loop.loop();
+    });
+    ready.get_future().wait();
+    
+    std::vector<long long> latencies;
+    std::atomic<bool> executed{false};
+    for (int i = 0; i < rounds; ++i) {
+        executed = false;
+        auto start_time = std::chrono::steady_clock::now();
+        loop.post([&] { executed = true; });
+        while (!executed) {
+            std::this_thread::yield();
+        }
+        auto diff = std::chrono::steady_clock::now() - start_time;
+        latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(diff).count());
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    EventLoop::Stats stats;
+    loop.sync([&] { stats = loop.getStats(); });
+    loop.stop();
+    loop_thread.join();
+    
+    std::sort(latencies.begin(), latencies.end());
+    long long sum = 0;
+    for (auto l : latencies) {
+        sum += l;
+    }
+    printf("busypoll: spin=%uus, rounds=%d, avg=%lldns, p50=%lldns, p99=%lldns, "
+           "spins=%llu, hits=%llu, spin/sleep time=%llu/%lluus\n",
+           spin_us, rounds, sum / rounds, latencies[rounds / 2], latencies[rounds * 99 / 100],
+           (unsigned long long)stats.spin_count, (unsigned long long)stats.spin_hits,
+           (unsigned long long)stats.spin_time_ns / 1000, (unsigned long long)stats.sleep_time_ns / 1000);
+}
+
+/* a feeder thread floods the loop with background tasks of flood_lane, each task
+ * burns about 2us. one thread posts a probe task every 200us and measures the
+ * latency until it is executed
+ */
+void benchPriority(TaskPriority flood_lane, TaskPriority probe_lane, int rounds)
+{
+    EventLoop loop;
+    std::promise<void> ready;
+    std::thread loop_thread([&] {
+        loop.init();
+        ready.set_value();
+        loop.loop();
+    });
+    ready.get_future().wait();
+    
+    const long max_inflight = 4000;
+    std::atomic<long> inflight{0};
+    std::atomic<bool> stop_flood{false};
+    std::thread feeder([&] {
+        while (!stop_flood) {
+            if (inflight >= max_inflight) {
+                std::this_thread::yield();
+                continue;
+            }
+            for (int i = 0; i < 256; ++i) {
+                ++inflight;
+                loop.post([&] {
+                    auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(2);
+                    while (std::chrono::steady_clock::now() < end) {}
+                    --inflight;
+                }, nullptr, flood_lane);
+            }
+        }
+    });
+    
+    std::vector<long long> latencies;
+    std::atomic<bool> executed{false};
+    for (int i = 0; i < rounds; ++i) {
+        executed = false;
+        auto start_time = std::chrono::steady_clock::now();
+        loop.post([&] { executed = true; }, nullptr, probe_lane);
+        while (!executed) {
+            std::this_thread::yield();
+        }
+        auto diff = std::chrono::steady_clock::now() - start_time;
+        latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(diff).count());
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    stop_flood = true;
+    feeder.join();
+    loop.stop();
+    loop_thread.join();
+    
+    static const char* lane_names[] = {"urgent", "normal", "idle"};
+    std::sort(latencies.begin(), latencies.end());
+    printf("priority: flood=%-6s probe=%-6s rounds=%d, p50=%lldus, p99=%lldus, p999=%lldus, max=%lldus\n",
+           lane_names[static_cast<int>(flood_lane)], lane_names[static_cast<int>(probe_lane)], rounds,
+           latencies[rounds / 2] / 1000, latencies[rounds * 99 / 100] / 1000,
+           latencies[rounds * 999 / 1000] / 1000, latencies.back() / 1000);
+}
+
+/* schedule timer_count idle timers, then reschedule all of them rounds times,
+ * on loop thread and from another thread. the delay alternates so that each
+ * call really moves the timer
+ */
+void benchTimer(int timer_count, int rounds)
+{
+    EventLoop loop;
+    std::promise<void> ready;
+    std::thread loop_thread([&] {
+        loop.init();
+        ready.set_value();
+        loop.loop();
+    });
+    ready.get_future().wait();
+    
+    std::vector<std::unique_ptr<Timer>> timers;
+    auto reschedule = [&] {
+        auto start_time = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; ++r) {
+            for (auto &timer : timers) {
+                timer->schedule(30000 + (r & 1), TimerMode::ONE_SHOT, [] {});
+            }
+        }
+        return std::chrono::steady_clock::now() - start_time;
+    };
+    std::chrono::steady_clock::duration loop_diff, cross_diff;
+    loop.sync([&] {
+        for (int i = 0; i < timer_count; ++i) {
+            timers.emplace_back(new Timer(&loop));
+            timers.back()->schedule(30000, TimerMode::ONE_SHOT, [] {});
+        }
+        loop_diff = reschedule();
+    });
+    auto start_time = std::chrono::steady_clock::now();
+    reschedule();
+    loop.sync([] {}); // wait for the loop to apply the reschedules from this thread
+    cross_diff = std::chrono::steady_clock::now() - start_time;
+    loop.sync([&] { timers.clear(); });
+    loop.stop();
+    loop_thread.join();
+    
+    const long total = long(timer_count) * rounds;
+    auto loop_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(loop_diff).count();
+    auto cross_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(cross_diff).count();
+    printf("timer: timers=%d, reschedules=%ld, loop thread=%.1fns/op, other thread=%.1fns/op\n",
+           timer_count, total, double(loop_ns) / total, double(cross_ns) / total);
+}
+
+/* idle timeout pattern, timer_count timers are rescheduled every 20ms with their
+ * own delay in 1~2s like packets are received on each connection, then wait all
+ * of them to fire. measure the reschedule cost, loop wakeups and timer time with slack
+ */
+void benchSlack(int timer_count, uint32_t slack_ms)
+{
+    EventLoop loop;
+    std::promise<void> ready;
+    std::thread loop_thread([&] {
+        loop.init();
+        ready.set_value();
+        loop.loop();
+    });
+    ready.get_future().wait();
+    
+    const int rounds = 10;
+    std::vector<std::unique_ptr<Timer>> timers;
+    int fired = 0; // accessed on loop thread only
+    std::promise<void> done;
+    auto on_timer = [&] {
+        if (++fired == timer_count) {
+            done.set_value();
+        }
+    };
+    EventLoop::Stats stats_start, stats_end;
+    std::chrono::steady_clock::duration diff{0};
+    loop.sync([&] {
+        for (int i = 0; i < timer_count; ++i) {
+            timers.emplace_back(new Timer(&loop));
+        }
+    });
+    for (int r = 0; r < rounds; ++r) {
+        loop.sync([&] {
+            auto start_time = std::chrono::steady_clock::now();
+            for (int i = 0; i < timer_count; ++i) {
+                // the delay changes a little, otherwise the timer without slack is not moved
+                timers[i]->schedule(1000 + i % 1000 + (r & 1), slack_ms, TimerMode::ONE_SHOT, on_timer);
+            }
+            diff += std::chrono::steady_clock::now() - start_time;
+            stats_start = loop.getStats();
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    done.get_future().wait();
+    loop.sync([&] {
+        stats_end = loop.getStats();
+        timers.clear();
+    });
+    loop.stop();
+    loop_thread.join();
+    
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(diff).count();
+    printf("slack: timers=%d, slack=%4ums, reschedule=%.1fns/op, wakeups=%llu, timer time=%llums\n",
+           timer_count, slack_ms, double(ns) / (long(timer_count) * rounds),
+           (unsigned long long)(stats_end.iterations - stats_start.iterations),
+           (unsigned long long)(stats_end.timer_time_ns - stats_start.timer_time_ns) / 1000000);
+}
+
+/* schedule a one-shot timer samples times in a row on loop thread and measure how late
+ * it fires against the requested delay. Timer rounds delay_us up to milliseconds
+ */
+void benchHighRes(bool high_res, uint32_t delay_us, int samples)
+{
+    EventLoop loop;
+    std::promise<void> ready;
+    std::thread loop_thread([&] {
+        loop.init();
+        ready.set_value();
+        loop.loop();
+    });
+    ready.get_future().wait();
+    
+    std::unique_ptr<Timer> timer;
+    std::unique_ptr<HighResTimer> hr_timer;
+    std::vector<long> lateness; // in microseconds, accessed on loop thread only
+    lateness.reserve(samples);
+    std::promise<void> done;
+    std::chrono::steady_clock::time_point deadline;
+    std::function<void(void)> on_timer;
+    auto schedule = [&] {
+        deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(delay_us);
+        if (high_res) {
+            hr_timer->schedule(delay_us, TimerMode::ONE_SHOT, on_timer);
+        } else {
+            timer->schedule((delay_us + 999) / 1000, TimerMode::ONE_SHOT, on_timer);
+        }
+    };
+    on_timer = [&] {
+        auto diff = std::chrono::steady_clock::now() - deadline;
+        lateness.push_back(long(std::chrono::duration_cast<std::chrono::microseconds>(diff).count()));
+        if (lateness.size() == size_t(samples)) {
+            done.set_value();
+        } else {
+            schedule();
+        }
+    };
+    loop.sync([&] {
+        timer.reset(new Timer(&loop));
+        hr_timer.reset(new HighResTimer(&loop));
+        schedule();
+    });
+    done.get_future().wait();
+    loop.sync([&] {
+        timer.reset();
+        hr_timer.reset();
+    });
+    loop.stop();
+    loop_thread.join();
+    
+    double sum = 0, sq_sum = 0;
+    for (auto v : lateness) {
+        sum += v;
+        sq_sum += double(v) * v;
+    }
+    double mean = sum / samples;
+    double stddev = std::sqrt(std::max(0.0, sq_sum / samples - mean * mean));
+    std::sort(lateness.begin(), lateness.end());
+    printf("hrtimer: %-12s delay=%4uus, late p50=%ldus, p99=%ldus, max=%ldus, jitter=%.1fus\n",
+           high_res ? "HighResTimer" : "Timer", delay_us, lateness[samples / 2],
+           lateness[samples * 99 / 100], lateness.back(), stddev);
+}
+
+/* echo round trips over loopback, the echo server and the clients run on two loops
+ * with the same poll type, each connection keeps one message in flight
+ */
+void benchEcho(PollType poll_type, int conns, size_t msg_size, int duration_ms)
+{
+    const uint16_t port = 52329;
+    EventLoop server_loop(poll_type);
+    EventLoop client_loop(poll_type);
+    std::promise<void> server_ready, client_ready;
+    std::thread server_thread([&] {
+        server_loop.init();
+        server_ready.set_value();
+        server_loop.loop();
+    });
+    std::thread client_thread([&] {
+        client_loop.init();
+        client_ready.set_value();
+        client_loop.loop();
+    });
+    server_ready.get_future().wait();
+    client_ready.get_future().wait();
+    
+    std::unique_ptr<TcpListener> listener;
+    std::vector<std::unique_ptr<TcpSocket>> server_sockets; // accessed on server loop only
+    server_loop.sync([&] {
+        listener.reset(new TcpListener(&server_loop));
+        listener->setAcceptCallback([&] (SOCKET_FD fd, const char*, uint16_t) {
+            auto *socket = new TcpSocket(&server_loop);
+            server_sockets.emplace_back(socket);
+            socket->setReadCallback([socket] (KMError) {
+                char buf[4096];
+                int bytes_read = 0;
+                while ((bytes_read = socket->receive(buf, sizeof(buf))) > 0) {
+                    socket->send(buf, bytes_read);
+                }
+            });
+            socket->attachFd(fd, ATTACH_FLAG_ACCEPTED);
+            return true;
+        });
+        listener->startListen("127.0.0.1", port);
+    });
+    
+    struct Client {
+        std::unique_ptr<TcpSocket> socket;
+        size_t received = 0;
+    };
+    std::vector<Client> clients(conns);
+    std::string message(msg_size, 'k');
+    bool running = true;
+    long round_trips = 0; // accessed on client loop only
+    client_loop.sync([&] {
+        for (auto &c : clients) {
+            auto *client = &c;
+            client->socket.reset(new TcpSocket(&client_loop));
+            client->socket->setReadCallback([&, client] (KMError) {
+                char buf[4096];
+                int bytes_read = 0;
+                while ((bytes_read = client->socket->receive(buf, sizeof(buf))) > 0) {
+                    client->received += bytes_read;
+                }
+                while (client->received >= msg_size) {
+                    client->received -= msg_size;
+                    ++round_trips;
+                    if (running) {
+                        client->socket->send(message.data(), msg_size);
+                    }
+                }
+            });
+            client->socket->connect("127.0.0.1", port, [&, client] (KMError err) {
+                if (err == KMError::NOERR) {
+                    client->socket->send(message.data(), msg_size);
+                }
+            });
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    
+    long start_trips = 0, end_trips = 0;
+    EventLoop::Stats start_stats, end_stats;
+    client_loop.sync([&] {
+        start_trips = round_trips;
+        start_stats = client_loop.getStats();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(duration_ms));
+    client_loop.sync([&] {
+        end_trips = round_trips;
+        end_stats = client_loop.getStats();
+        running = false;
+        for (auto &c : clients) {
+            c.socket->close();
+        }
+        clients.clear();
+    });
+    server_loop.sync([&] {
+        listener->close();
+        listener.reset();
+        for (auto &socket : server_sockets) {
+            socket->close();
+        }
+        server_sockets.clear();
+    });
+    auto actual_type = client_loop.getPollType();
+    client_loop.stop();
+    server_loop.stop();
+    client_thread.join();
+    server_thread.join();
+    
+    auto seconds = duration_ms / 1000.0;
+    auto iterations = end_stats.iterations - start_stats.iterations;
+    printf("echo: poll=%s, conns=%d, msg=%zu, round trips=%.0f/s, client loop iterations=%.0f/s, trips/iteration=%.1f\n",
+           actual_type == PollType::IO_URING ? "io_uring" : (actual_type == PollType::EPOLL ? "epoll" : "other"),
+           conns, msg_size, (end_trips - start_trips) / seconds, iterations / seconds,
+           iterations ? double(end_trips - start_trips) / iterations : 0.0);
+}
+
+/* the server loop echoes for ping clients and drains one bulk sender, measure the
+ * round trip latency of the ping clients with the read budget of server loop
+ */
+void benchFairness(uint32_t read_budget, int clients, int duration_ms)
+{
+    const uint16_t echo_port = 52331, sink_port = 52332;
+    EventLoop server_loop, client_loop, bulk_loop;
+    std::vector<std::thread> threads;
+    for (auto *loop : {&server_loop, &client_loop, &bulk_loop}) {
+        std::promise<void> ready;
+        threads.emplace_back([loop, &ready] {
+            loop->init();
+            ready.set_value();
+            loop->loop();
+        });
+        ready.get_future().wait();
+    }
+    
+    std::unique_ptr<TcpListener> echo_listener, sink_listener;
+    std::vector<std::unique_ptr<TcpSocket>> server_sockets; // accessed on server loop only
+    std::vector<char> server_buf(128*1024);
+    uint64_t sink_bytes = 0;
+    server_loop.sync([&] {
+        server_loop.setReadBudget(read_budget);
+        echo_listener.reset(new TcpListener(&server_loop));
+        echo_listener->setAcceptCallback([&] (SOCKET_FD fd, const char*, uint16_t) {
+            auto *socket = new TcpSocket(&server_loop);
+            server_sockets.emplace_back(socket);
+            socket->setReadCallback([&, socket] (KMError) {
+                int bytes_read = 0;
+                while ((bytes_read = socket->receive(&server_buf[0], server_buf.size())) > 0) {
+                    socket->send(&server_buf[0], bytes_read);
+                }
+            });
+            socket->attachFd(fd, ATTACH_FLAG_ACCEPTED);
+            return true;
+        });
+        echo_listener->startListen("127.0.0.1", echo_port);
+        sink_listener.reset(new TcpListener(&server_loop));
+        sink_listener->setAcceptCallback([&] (SOCKET_FD fd, const char*, uint16_t) {
+            auto *socket = new TcpSocket(&server_loop);
+            server_sockets.emplace_back(socket);
+            socket->setReadCallback([&, socket] (KMError) {
+                int bytes_read = 0;
+                while ((bytes_read = socket->receive(&server_buf[0], server_buf.size())) > 0) {
+                    sink_bytes += bytes_read;
+                }
+            });
+            socket->attachFd(fd, ATTACH_FLAG_ACCEPTED);
+            return true;
+        });
+        sink_listener->startListen("127.0.0.1", sink_port);
+    });
+    
+    // the bulk sender keeps the socket buffer full
+    std::unique_ptr<TcpSocket> bulk;
+    std::vector<char> bulk_data(64*1024, 'b');
+    bool bulk_running = true;
+    bulk_loop.sync([&] {
+        bulk.reset(new TcpSocket(&bulk_loop));
+        auto send_bulk = [&] (KMError) {
+            while (bulk_running && bulk->send(&bulk_data[0], bulk_data.size()) > 0) {}
+        };
+        bulk->setWriteCallback(send_bulk);
+        bulk->connect("127.0.0.1", sink_port, send_bulk);
+    });
+    
+    struct Client {
+        std::unique_ptr<TcpSocket> socket;
+        std::chrono::steady_clock::time_point send_time;
+        size_t received = 0;
+    };
+    const size_t msg_size = 64;
+    std::vector<Client> pingers(clients);
+    std::string message(msg_size, 'p');
+    bool running = true, measuring = false;
+    std::vector<long long> latencies; // accessed on client loop only
+    client_loop.sync([&] {
+        for (auto &c : pingers) {
+            auto *client = &c;
+            client->socket.reset(new TcpSocket(&client_loop));
+            client->socket->setReadCallback([&, client] (KMError) {
+                char buf[4096];
+                int bytes_read = 0;
+                while ((bytes_read = client->socket->receive(buf, sizeof(buf))) > 0) {
+                    client->received += bytes_read;
+                }
+                if (client->received >= msg_size) {
+                    client->received -= msg_size;
+                    auto now = std::chrono::steady_clock::now();
+                    if (measuring) {
+                        auto diff = now - client->send_time;
+                        latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(diff).count());
+                    }
+                    if (running) {
+                        client->send_time = now;
+                        client->socket->send(message.data(), msg_size);
+                    }
+                }
+            });
+            client->socket->connect("127.0.0.1", echo_port, [&, client] (KMError err) {
+                if (err == KMError::NOERR) {
+                    client->send_time = std::chrono::steady_clock::now();
+                    client->socket->send(message.data(), msg_size);
+                }
+            });
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    
+    uint64_t start_bytes = 0, end_bytes = 0;
+    server_loop.sync([&] { start_bytes = sink_bytes; });
+    client_loop.sync([&] { measuring = true; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(duration_ms));
+    client_loop.sync([&] {
+        measuring = false;
+        running = false;
+        for (auto &c : pingers) {
+            c.socket->close();
+        }
+        pingers.clear();
+    });
+    bulk_loop.sync([&] {
+        bulk_running = false;
+        bulk->close();
+        bulk.reset();
+    });
+    server_loop.sync([&] {
+        end_bytes = sink_bytes;
+        echo_listener->close();
+        sink_listener->close();
+        for (auto &socket : server_sockets) {
+            socket->close();
+        }
+        server_sockets.clear();
+    });
+    for (auto *loop : {&server_loop, &client_loop, &bulk_loop}) {
+        loop->stop();
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    
+    std::sort(latencies.begin(), latencies.end());
+    auto count = latencies.size();
+    if (0 == count) {
+        printf("fairness: budget=%u, no round trip\n", read_budget);
+        return;
+    }
+    printf("fairness: budget=%6u, clients=%d, round trips=%zu, p50=%lldus, p99=%lldus, max=%lldus, bulk=%.0fMB/s\n",
+           read_budget, clients, count, latencies[count / 2], latencies[count * 99 / 100], latencies.back(),
+           (end_bytes - start_bytes) / 1048576.0 / (duration_ms / 1000.0));
+}
+
+/* the server spins 20ms for 2% of the requests. the server runs threads loops with one
+ * listen socket each, or one loop with threads - 1 IO threads sharing its poll.
+ * measure the round trip latency of the light requests
+ */
+void benchSkew(bool shared, int threads, int clients, int duration_ms)
+{
+    const uint16_t port = 52333;
+    const size_t msg_size = 64;
+    std::unique_ptr<EventLoopGroup> group;
+    std::unique_ptr<EventLoop> shared_loop;
+    std::thread shared_thread;
+    std::vector<EventLoop*> server_loops;
+    if (shared) {
+        shared_loop.reset(new EventLoop(PollType::EPOLL));
+        if (shared_loop->setIOThreads(threads - 1) != KMError::NOERR) {
+            printf("skew: IO threads are not supported\n");
+            return;
+        }
+        std::promise<void> ready;
+        shared_thread = std::thread([&] {
+            shared_loop->init();
+            ready.set_value();
+            shared_loop->loop();
+        });
+        ready.get_future().wait();
+        server_loops.push_back(shared_loop.get());
+    } else {
+        group.reset(new EventLoopGroup(PollType::EPOLL));
+        group->init(threads);
+        for (int i = 0; i < group->size(); ++i) {
+            server_loops.push_back(group->getLoop(i));
+        }
+    }
+    
+    struct ServerConn {
+        EventLoop *loop;
+        std::unique_ptr<TcpSocket> socket;
+        size_t received = 0;
+    };
+    std::mutex conn_mutex;
+    std::vector<std::unique_ptr<ServerConn>> server_conns;
+    std::unique_ptr<TcpListener> listener;
+    auto accept_cb = [&] (SOCKET_FD fd, const char*, uint16_t) {
+        auto *loop = server_loops[0];
+        for (auto *l : server_loops) {
+            if (l->inSameThread()) {
+                loop = l;
+            }
+        }
+        auto *conn = new ServerConn();
+        conn->loop = loop;
+        conn->socket.reset(new TcpSocket(loop));
+        conn->socket->setReadCallback([conn] (KMError) {
+            char buf[4096];
+            int bytes_read = 0;
+            while ((bytes_read = conn->socket->receive(buf, sizeof(buf))) > 0) {
+                conn->received += bytes_read;
+                if ('H' == buf[0]) {
+                    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+                    while (std::chrono::steady_clock::now() < end) {}
+                }
+                while (conn->received >= msg_size) {
+                    conn->received -= msg_size;
+                    conn->socket->send(buf, msg_size);
+                }
+            }
+        });
+        conn->socket->attachFd(fd, ATTACH_FLAG_ACCEPTED);
+        std::lock_guard<std::mutex> g(conn_mutex);
+        server_conns.emplace_back(conn);
+        return true;
+    };
+    if (shared) {
+        shared_loop->sync([&] {
+            listener.reset(new TcpListener(shared_loop.get()));
+            listener->setAcceptCallback(accept_cb);
+            listener->startListen("127.0.0.1", port);
+        });
+    } else {
+        listener.reset(new TcpListener(group.get()));
+        listener->setAcceptCallback(accept_cb);
+        listener->startListen("127.0.0.1", port);
+    }
+    
+    EventLoop client_loop;
+    std::promise<void> client_ready;
+    std::thread client_thread([&] {
+        client_loop.init();
+        client_ready.set_value();
+        client_loop.loop();
+    });
+    client_ready.get_future().wait();
+    struct Client {
+        std::unique_ptr<TcpSocket> socket;
+        std::chrono::steady_clock::time_point send_time;
+        bool heavy = false;
+        size_t received = 0;
+    };
+    std::vector<Client> pingers(clients);
+    bool running = true, measuring = false;
+    long requests = 0, heavy_count = 0;
+    std::vector<long long> latencies; // light requests, accessed on client loop only
+    auto send_request = [&] (Client *client) {
+        char msg[msg_size];
+        client->heavy = (++requests % 50 == 0);
+        memset(msg, client->heavy ? 'H' : 'L', sizeof(msg));
+        client->send_time = std::chrono::steady_clock::now();
+        client->socket->send(msg, sizeof(msg));
+    };
+    client_loop.sync([&] {
+        for (auto &c : pingers) {
+            auto *client = &c;
+            client->socket.reset(new TcpSocket(&client_loop));
+            client->socket->setReadCallback([&, client] (KMError) {
+                char buf[4096];
+                int bytes_read = 0;
+                while ((bytes_read = client->socket->receive(buf, sizeof(buf))) > 0) {
+                    client->received += bytes_read;
+                }
+                if (client->received >= msg_size) {
+                    client->received -= msg_size;
+                    if (measuring) {
+                        if (client->heavy) {
+                            ++heavy_count;
+                        } else {
+                            auto diff = std::chrono::steady_clock::now() - client->send_time;
+                            latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(diff).count());
+                        }
+                    }
+                    if (running) {
+                        send_request(client);
+                    }
+                }
+            });
+            client->socket->connect("127.0.0.1", port, [&, client] (KMError err) {
+                if (err == KMError::NOERR) {
+                    send_request(client);
+                }
+            });
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    client_loop.sync([&] { measuring = true; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(duration_ms));
+    client_loop.sync([&] {
+        measuring = false;
+        running = false;
+    });
+    // let the requests in flight complete, so no server callback is running on close
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    for (auto *loop : server_loops) {
+        loop->sync([&, loop] {
+            if (loop == server_loops[0]) {
+                listener->close();
+            }
+            std::lock_guard<std::mutex> g(conn_mutex);
+            for (auto &conn : server_conns) {
+                if (conn->loop == loop) {
+                    conn->socket->close();
+                }
+            }
+        });
+    }
+    client_loop.sync([&] {
+        for (auto &c : pingers) {
+            c.socket->close();
+        }
+        pingers.clear();
+    });
+    client_loop.stop();
+    client_thread.join();
+    if (shared) {
+        shared_loop->stop();
+        shared_thread.join();
+    } else {
+        group->stop();
+    }
+    listener.reset();
+    server_conns.clear();
+    
+    std::sort(latencies.begin(), latencies.end());
+    auto count = latencies.size();
+    if (0 == count) {
+        printf("skew: no round trip\n");
+        return;
+    }
+    printf("skew: %-15s threads=%d, clients=%d, light=%zu, heavy=%ld, p50=%lldus, p99=%lldus, p999=%lldus, max=%lldus\n",
+           shared ? "shared poll" : "loop per thread", threads, clients, count, heavy_count,
+           latencies[count / 2], latencies[count * 99 / 100], latencies[count * 999 / 1000], latencies.back());
+}
+
+#ifndef KUMA_OS_WIN
+/* pipe_count pipes are registered, active of them spread over the fd range are written
+ * in each round, measure the IO wait and dispatch cost per ready fd of loopOnce
+ */
+void benchDispatch(int pipe_count, int active, int rounds)
+{
+    EventLoop loop;
+    loop.init();
+    std::vector<int> read_fds, write_fds;
+    long events = 0;
+    for (int i = 0; i < pipe_count; ++i) {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            printf("dispatch: failed to create pipe, count=%d\n", i);
+            break;
+        }
+        fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+        read_fds.push_back(fds[0]);
+        write_fds.push_back(fds[1]);
+        // the pipe is not drained, every write triggers an edge on edge-triggered poll
+        loop.registerFd(fds[0], KUMA_EV_READ, [&events] (KMEvent, void*, size_t) {
+            ++events;
+        });
+    }
+    int count = int(read_fds.size());
+    int step = count / active;
+    std::chrono::steady_clock::duration diff{0};
+    for (int r = 0; r < rounds && step > 0; ++r) {
+        for (int i = 0; i < active; ++i) {
+            int idx = (i * step + r) % count;
+            if (write(write_fds[idx], "k", 1) != 1) {
+                break;
+            }
+        }
+        auto start_time = std::chrono::steady_clock::now();
+        loop.loopOnce(0);
+        diff += std::chrono::steady_clock::now() - start_time;
+    }
+    for (int i = 0; i < count; ++i) {
+        loop.unregisterFd(read_fds[i], true);
+        close(write_fds[i]);
+    }
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(diff).count();
+    printf("dispatch: fds=%d, active=%d, events=%ld, %.1fns/event\n",
+           count, active, events, events ? double(ns) / events : 0.0);
+}
+
+/* active pipes are written in each round and the loop is run until all of them are
+ * dispatched, measure the waits per round and cost per event of the poll batch range
+ */
+void benchPollBatch(int pipe_count, int active, int rounds, uint32_t min_events, uint32_t max_events)
+{
+    EventLoop loop;
+    loop.init();
+    loop.setPollBatch(min_events, max_events);
+    std::vector<int> read_fds, write_fds;
+    long events = 0;
+    for (int i = 0; i < pipe_count; ++i) {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            printf("pollbatch: failed to create pipe, count=%d\n", i);
+            break;
+        }
+        fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+        read_fds.push_back(fds[0]);
+        write_fds.push_back(fds[1]);
+        loop.registerFd(fds[0], KUMA_EV_READ, [&events] (KMEvent, void*, size_t) {
+            ++events;
+        });
+    }
+    int count = int(read_fds.size());
+    active = std::min(active, count);
+    long waits = 0;
+    std::chrono::steady_clock::duration diff{0};
+    for (int r = 0; r < rounds && active > 0; ++r) {
+        for (int i = 0; i < active; ++i) {
+            if (write(write_fds[(i + r) % count], "k", 1) != 1) {
+                break;
+            }
+        }
+        auto target = events + active;
+        auto start_time = std::chrono::steady_clock::now();
+        while (events < target) {
+            loop.loopOnce(0);
+            ++waits;
+        }
+        diff += std::chrono::steady_clock::now() - start_time;
+    }
+    for (int i = 0; i < count; ++i) {
+        loop.unregisterFd(read_fds[i], true);
+        close(write_fds[i]);
+    }
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(diff).count();
+    printf("pollbatch: batch=%u~%u, fds=%d, active=%d, waits/round=%.1f, %.1fns/event\n",
+           min_events, max_events, count, active, rounds ? double(waits) / rounds : 0.0,
+           events ? double(ns) / events : 0.0);
+}
+
+static uint64_t threadCpuNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+/* a WebSocket client sends burst small messages in each loop iteration to a sink
+ * server, measure the message rate and the client loop CPU time per message
+ * with and without write coalescing
+ */
+void benchCoalesce(bool coalescing, int burst, int duration_ms)
+{
+    const uint16_t port = 52334;
+    EventLoop server_loop, client_loop;
+    std::vector<std::thread> threads;
+    for (auto *loop : {&server_loop, &client_loop}) {
+        std::promise<void> ready;
+        threads.emplace_back([loop, &ready] {
+            loop->init();
+            ready.set_value();
+            loop->loop();
+        });
+        ready.get_future().wait();
+    }
+    
+    std::unique_ptr<TcpListener> listener;
+    std::unique_ptr<WebSocket> server;
+    uint64_t server_msgs = 0;
+    server_loop.sync([&] {
+        listener.reset(new TcpListener(&server_loop));
+        listener->setAcceptCallback([&] (SOCKET_FD fd, const char*, uint16_t) {
+            server.reset(new WebSocket(&server_loop));
+            server->setDataCallback([&] (KMBuffer &, bool, bool) { ++server_msgs; });
+            return server->attachFd(fd, nullptr, [] (KMError) { return true; }) == KMError::NOERR;
+        });
+        listener->startListen("127.0.0.1", port);
+    });
+    
+    std::unique_ptr<WebSocket> client;
+    std::string message(64, 'c');
+    bool running = true, blocked = false;
+    EventLoop::Token token = client_loop.createToken();
+    std::function<void()> pump = [&] {
+        // one burst per iteration, the write callback resumes the blocked client
+        for (int i = 0; i < burst && running; ++i) {
+            if (client->send(message.data(), message.size(), false) <= 0) {
+                blocked = true;
+                return;
+            }
+        }
+        if (running) {
+            client_loop.post([&] { pump(); }, &token);
+        }
+    };
+    client_loop.sync([&] {
+        client_loop.setWriteCoalescing(coalescing);
+        client.reset(new WebSocket(&client_loop));
+        client->setWriteCallback([&] (KMError) {
+            if (blocked) {
+                blocked = false;
+                pump();
+            }
+        });
+        client->connect(("ws://127.0.0.1:" + std::to_string(port)).c_str(), [&] (KMError err) {
+            if (err == KMError::NOERR) {
+                client_loop.post([&] { pump(); }, &token);
+            }
+            return true;
+        });
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    
+    uint64_t start_msgs = 0, end_msgs = 0, start_cpu = 0, end_cpu = 0, start_flush = 0, end_flush = 0;
+    server_loop.sync([&] { start_msgs = server_msgs; });
+    client_loop.sync([&] {
+        start_cpu = threadCpuNs();
+        start_flush = client_loop.getStats().flush_count;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(duration_ms));
+    client_loop.sync([&] {
+        end_cpu = threadCpuNs();
+        end_flush = client_loop.getStats().flush_count;
+    });
+    server_loop.sync([&] { end_msgs = server_msgs; });
+    
+    client_loop.sync([&] {
+        running = false;
+        token.reset();
+        client->close();
+        client.reset();
+    });
+    server_loop.sync([&] {
+        listener->close();
+        if (server) {
+            server->close();
+            server.reset();
+        }
+    });
+    for (auto *loop : {&server_loop, &client_loop}) {
+        loop->stop();
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    
+    auto msgs = end_msgs - start_msgs;
+    printf("coalesce: %s, burst=%2d, msgs=%.0fk/s, client cpu=%.0fns/msg, msgs/flush=%.1f\n",
+           coalescing ? "on " : "off", burst, msgs / 1000.0 / (duration_ms / 1000.0),
+           msgs ? double(end_cpu - start_cpu) / msgs : 0.0,
+           end_flush > start_flush ? double(msgs) / (end_flush - start_flush) : 1.0);
+}
+
+/* a client thread connects and resets conns connections to a listener in turn,
+ * measure the accept rate and the server loop CPU time per connection with the
+ * string and the sockaddr accept callbacks
+ */
+void benchAccept(bool addr_cb, uint32_t accept_batch, int conns)
+{
+    const uint16_t port = 52335;
+    EventLoop loop;
+    std::promise<void> ready;
+    std::thread thr([&] {
+        loop.init();
+        ready.set_value();
+        loop.loop();
+    });
+    ready.get_future().wait();
+    
+    std::atomic<int> accepted{0};
+    TcpListener listener(&loop);
+    listener.setBacklog(1024);
+    listener.setAcceptBatch(accept_batch);
+    if (addr_cb) {
+        listener.setAcceptAddrCallback([&] (SOCKET_FD, const sockaddr*, socklen_t) {
+            ++accepted;
+            return false; // fd will be closed by listener
+        });
+    } else {
+        listener.setAcceptCallback([&] (SOCKET_FD, const char*, uint16_t) {
+            ++accepted;
+            return false;
+        });
+    }
+    loop.sync([&] { listener.startListen("127.0.0.1", port); });
+    
+    sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    uint64_t start_cpu = 0, end_cpu = 0;
+    loop.sync([&] { start_cpu = threadCpuNs(); });
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < conns; ++i) {
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            break;
+        }
+        // close with RST, the ephemeral ports are not left in TIME_WAIT
+        linger lg = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+        ::connect(fd, (const sockaddr*)&addr, sizeof(addr));
+        ::close(fd);
+    }
+    while (accepted < conns && std::chrono::steady_clock::now() - start < std::chrono::seconds(10)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    auto diff = std::chrono::steady_clock::now() - start;
+    loop.sync([&] { end_cpu = threadCpuNs(); });
+    
+    loop.sync([&] { listener.close(); });
+    loop.stop();
+    thr.join();
+    
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(diff).count();
+    int count = accepted;
+    printf("accept: callback=%s, batch=%2u, conns=%d, %.1fk/s, server cpu=%.0fns/conn\n",
+           addr_cb ? "addr  " : "string", accept_batch, count, ms ? count / double(ms) : 0.0,
+           count ? double(end_cpu - start_cpu) / count : 0.0);
+}
+#endif
+
+} // namespace
+
+int runLoopBench(const std::string &name)
+{
+    if (name == "post") {
+        for (int producers : {1, 2, 4, 8, 16}) {
+            benchPost(producers, 2000000 / producers);
+        }
+        return 0;
+    } else if (name == "batch") {
+        for (int producers : {1, 4, 16}) {
+            benchBatch(producers, 2000000 / producers, 64);
+        }
+        return 0;
+    } else if (name == "busypoll") {
+        for (uint32_t spin_us : {0, 50, 200, 1000}) {
+            benchBusyPoll(spin_us, 5000);
+        }
+        return 0;
+    } else if (name == "priority") {
+        benchPriority(TaskPriority::NORMAL, TaskPriority::NORMAL, 1000);
+        benchPriority(TaskPriority::NORMAL, TaskPriority::URGENT, 1000);
+        benchPriority(TaskPriority::IDLE, TaskPriority::NORMAL, 1000);
+        return 0;
+    } else if (name == "timer") {
+        for (int timer_count : {10000, 100000, 200000}) {
+            benchTimer(timer_count, 1000000 / timer_count);
+        }
+        return 0;
+    } else if (name == "slack") {
+        for (uint32_t slack_ms : {0, 10, 100, 1000}) {
+            benchSlack(200000, slack_ms);
+        }
+        return 0;
+    } else if (name == "hrtimer") {
+        for (uint32_t delay_us : {100, 250, 500, 1000}) {
+            benchHighRes(false, delay_us, 1000);
+            benchHighRes(true, delay_us, 1000);
+        }
+        return 0;
+    } else if (name == "echo") {
+        for (int conns : {1, 16, 256}) {
+            benchEcho(PollType::EPOLL, conns, 64, 2000);
+            benchEcho(PollType::IO_URING, conns, 64, 2000);
+        }
+        return 0;
+    } else if (name == "skew") {
+        for (bool shared : {false, true}) {
+            benchSkew(shared, 4, 32, 3000);
+        }
+        return 0;
+    } else if (name == "fairness") {
+        for (uint32_t budget : {0, 256*1024, 64*1024, 16*1024}) {
+            benchFairness(budget, 64, 2000);
+        }
+        return 0;
+#ifndef KUMA_OS_WIN
+    } else if (name == "dispatch") {
+        for (int active : {10, 100, 400}) {
+            benchDispatch(8000, active, 2000);
+        }
+        return 0;
+    } else if (name == "pollbatch") {
+        for (int active : {100, 1000, 4000}) {
+            benchPollBatch(8000, active, 500, 500, 500);
+            benchPollBatch(8000, active, 500, 64, 4096);
+        }
+        return 0;
+    } else if (name == "coalesce") {
+        for (int burst : {1, 16, 64}) {
+            benchCoalesce(false, burst, 2000);
+            benchCoalesce(true, burst, 2000);
+        }
+        return 0;
+    } else if (name == "accept") {
+        benchAccept(false, 0, 20000);
+        benchAccept(true, 0, 20000);
+        benchAccept(true, 16, 20000);
+        return 0;
+#endif
+    }
+    printf("unknown benchmark: %s\n", name.c_str());
+    return -1;
+}
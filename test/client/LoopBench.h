@@ -0,0 +1,13 @@
+#ifndef __LoopBench_H__
+#define __LoopBench_H__
+
+#include <string>
+
+/* micro benchmarks of EventLoop, run without network
+ *
+ * @param name benchmark name, "post", "batch"
+ * @return 0 on success
+ */
+int runLoopBench(const std::string &name);
+
+#endif
@@ -6,12 +6,22 @@
 # include <arpa/inet.h>
 #endif
 
+#include <algorithm>
+#include <string.h>
+
+namespace {
+    // datagrams in flight, they are sent and received in batches
+    const int kWindowSize = 64;
+    const size_t kDatagramSize = 1024;
+}
+
 UdpClient::UdpClient(TestLoop* loop, long conn_id)
 : loop_(loop)
 , udp_(loop->eventLoop())
 , conn_id_(conn_id)
 , index_(0)
-, max_send_count_(200000)
+, recv_count_(0)
+, max_send_count_(1000000)
 {
     
 }
@@ -31,43 +41,66 @@ int UdpClient::close()
 
 void UdpClient::startSend(const std::string &host, uint16_t port)
 {
-    host_ = host;
+    char ip[128] = {0};
+    if (km_resolve_2_ip(host.c_str(), ip, sizeof(ip)) != 0) {
+        printf("UdpClient::startSend, failed to resolve host %s\n", host.c_str());
+        return;
+    }
+    host_ = ip;
     port_ = port;
     start_point_ = std::chrono::steady_clock::now();
-    sendData();
+    sendData(kWindowSize);
 }
 
-void UdpClient::sendData()
+void UdpClient::sendData(int count)
 {
-    uint8_t buf[1024];
-    *(uint32_t*)buf = htonl(++index_);
-    udp_.send(buf, sizeof(buf), host_.c_str(), port_);
+    uint8_t bufs[kWindowSize][kDatagramSize];
+    UdpDatagram dgrams[kWindowSize];
+    count = std::min<int>(count, kWindowSize);
+    count = std::min<int>(count, max_send_count_ - index_);
+    for (int i = 0; i < count; ++i) {
+        *(uint32_t*)bufs[i] = htonl(++index_);
+        dgrams[i].data = bufs[i];
+        dgrams[i].length = kDatagramSize;
+        strncpy(dgrams[i].ip, host_.c_str(), sizeof(dgrams[i].ip) - 1);
+        dgrams[i].port = port_;
+    }
+    if (count > 0) {
+        udp_.send(dgrams, count);
+    }
 }
 
 void UdpClient::onReceive(KMError err)
 {
-    char buf[4096] = {0};
-    char ip[128];
-    uint16_t port = 0;
+    uint8_t bufs[kWindowSize][kDatagramSize];
+    UdpDatagram dgrams[kWindowSize];
+    for (int i = 0; i < kWindowSize; ++i) {
+        dgrams[i].data = bufs[i];
+        dgrams[i].size = kDatagramSize;
+    }
     do {
-        int bytes_read = udp_.receive((uint8_t*)buf, sizeof(buf), ip, sizeof(ip), port);
-        if(bytes_read > 0) {
-            uint32_t index = 0;
-            if(bytes_read >= 4) {
-                index = ntohl(*(uint32_t*)buf);
-            }
-            if(index % 10000 == 0) {
-                printf("UdpClient::onReceive, bytes_read=%d, index=%d\n", bytes_read, index);
+        int count = udp_.receive(dgrams, kWindowSize);
+        if(count > 0) {
+            for (int i = 0; i < count; ++i) {
+                uint32_t index = 0;
+                if(dgrams[i].length >= 4) {
+                    index = ntohl(*(uint32_t*)dgrams[i].data);
+                }
+                if(index % 100000 == 0) {
+                    printf("UdpClient::onReceive, bytes_read=%d, index=%d\n", (int)dgrams[i].length, index);
+                }
             }
-            if(index < max_send_count_) {
-                sendData();
+            recv_count_ += count;
+            if(recv_count_ < max_send_count_) {
+                sendData(count);
             } else {
                 std::chrono::steady_clock::time_point end_point = std::chrono::steady_clock::now();
                 std::chrono::milliseconds diff_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end_point - start_point_);
-                printf("spent %lld ms to echo %u packets\n", diff_ms.count(), max_send_count_);
+                printf("spent %lld ms to echo %u packets, %lld pps\n", diff_ms.count(), max_send_count_,
+                       max_send_count_ * 1000LL / std::max<long long>(diff_ms.count(), 1));
                 break;
             }
-        } else if (0 == bytes_read) {
+        } else if (0 == count) {
             break;
         } else {
             printf("UdpClient::onReceive, err=%d\n", getLastError());
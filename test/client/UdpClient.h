@@ -24,7 +24,7 @@ public:
     void onClose(KMError err);
     
 private:
-    void sendData();
+    void sendData(int count);
     
 private:
     TestLoop*   loop_;
@@ -36,6 +36,7 @@ private:
     long        conn_id_;
     
     uint32_t    index_;
+    uint32_t    recv_count_;
     uint32_t    max_send_count_;
     std::chrono::steady_clock::time_point   start_point_;
 };
@@ -1,6 +1,7 @@
 #include "kmapi.h"
 #include "util/util.h"
 #include "LoopPool.h"
+#include "LoopBench.h"
 #include "util/defer.h"
 
 #include <stdio.h>
@@ -54,6 +55,7 @@ static const std::string g_usage =
 "   -t ms           send interval\n"
 "   -v              print version\n"
 "   --http2         test http2\n"
+"   --bench name    run EventLoop benchmark: post, batch, busypoll, priority, timer, slack, hrtimer, echo, fairness, skew, dispatch, pollbatch, coalesce, accept\n"
 ;
 
 std::vector<std::thread> event_threads;
@@ -125,6 +127,15 @@ int main(int argc, char *argv[])
                     }
                     break;
                 case '-':
+                    if (strcmp(argv[i] + 2, "bench") == 0) {
+                        if(++i < argc) {
+                            kuma::init();
+                            DEFER([]{ kuma::fini(); });
+                            return runLoopBench(argv[i]);
+                        }
+                        printUsage();
+                        return -1;
+                    }
                     g_test_http2 = strcmp(argv[i] + 2, "http2") == 0;
                     break;
                 default:
@@ -5,6 +5,13 @@
 #include <string.h> // strcasecmp
 #include <string>
 #include <stdio.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef KUMA_OS_WIN
+# include <io.h>
+#else
+# include <unistd.h>
+#endif
 
 extern std::string www_path;
 
@@ -49,6 +56,7 @@ KMError HttpTest::attachStream(H2Connection* conn, uint32_t streamId)
 int HttpTest::close()
 {
     http_.close();
+    closeFile();
     return 0;
 }
 
@@ -65,6 +73,7 @@ void HttpTest::onClose(KMError err)
 {
     printf("HttpTest_%ld::onClose, err=%d\n", conn_id_, err);
     http_.close();
+    closeFile();
     obj_mgr_->removeObject(conn_id_);
 }
 
@@ -121,18 +130,19 @@ void HttpTest::onRequestComplete()
             state_ = State::SENDING_FILE;
         }
         if (State::SENDING_FILE == state_) {
-            if (fileExist(file)) {
+            if (fileExist(file) && openFile(file)) {
                 file_name_ = std::move(file);
                 std::string path, name, ext;
                 splitPath(file_name_, path, name, ext);
                 http_.addHeader("Content-Type", getMime(ext).c_str());
+                http_.addHeader("Content-Length", std::to_string(file_size_).c_str());
             } else {
                 file_name_.clear();
                 status = 404;
                 desc = "Not Found";
                 http_.addHeader("Content-Type", "text/html");
+                http_.addHeader("Transfer-Encoding", "chunked");
             }
-            http_.addHeader("Transfer-Encoding", "chunked");
         }
     }
     http_.sendResponse(status, desc.c_str());
@@ -141,21 +151,45 @@ void HttpTest::onRequestComplete()
 void HttpTest::onResponseComplete()
 {
     printf("HttpTest_%ld::onResponseComplete\n", conn_id_);
+    closeFile();
     http_.reset();
 }
 
-void HttpTest::sendTestFile()
+bool HttpTest::openFile(const std::string &file_name)
 {
-    FILE *fp = nullptr;
+    closeFile();
 #ifdef KUMA_OS_WIN
-    auto err = fopen_s(&fp, file_name_.c_str(), "rb");
+    file_fd_ = _open(file_name.c_str(), _O_RDONLY | _O_BINARY);
+    struct _stat64 st;
+    if (file_fd_ < 0 || _fstati64(file_fd_, &st) != 0) {
 #else
-    fp = fopen(file_name_.c_str(), "rb");
+    file_fd_ = open(file_name.c_str(), O_RDONLY);
+    struct stat st;
+    if (file_fd_ < 0 || fstat(file_fd_, &st) != 0) {
 #endif
-    if (!fp) {
-        printf("failed to open file %s\n", file_name_.c_str());
-        file_name_.clear();
+        printf("failed to open file %s\n", file_name.c_str());
+        closeFile();
+        return false;
     }
+    file_size_ = st.st_size;
+    file_offset_ = 0;
+    return true;
+}
+
+void HttpTest::closeFile()
+{
+    if (file_fd_ >= 0) {
+#ifdef KUMA_OS_WIN
+        _close(file_fd_);
+#else
+        ::close(file_fd_);
+#endif
+        file_fd_ = -1;
+    }
+}
+
+void HttpTest::sendTestFile()
+{
     if (file_name_.empty()) {
         static const std::string not_found("<html><body>404 Not Found!</body></html>");
         //http_.sendData((const uint8_t*)(not_found.c_str()), not_found.size());
@@ -166,24 +200,14 @@ void HttpTest::sendTestFile()
         http_.sendData(buf);
         return;
     }
-    //uint8_t buf[4096];
-    //auto nread = fread(buf, 1, sizeof(buf), fp);
-    KMBuffer buf(4096);
-    auto nread = fread(buf.writePtr(), 1, buf.space(), fp);
-    buf.bytesWritten(nread);
-    fclose(fp);
-    if (nread > 0) {
-        //int ret = http_.sendData(buf, nread);
-        int ret = http_.sendData(buf);
-        if (ret < 0) {
-            return;
-        } else if (ret < nread) {
-            // should buffer remain data
+    // sent by sendfile, or read in blocks for HTTP/2
+    while (file_fd_ >= 0 && file_offset_ < file_size_) {
+        int ret = http_.sendFile(file_fd_, file_offset_, size_t(file_size_ - file_offset_));
+        if (ret <= 0) {
+            // the rest is sent in write callback
             return;
-        } else {
-            // end response
-            http_.sendData(nullptr, 0);
         }
+        file_offset_ += ret;
     }
 }
 
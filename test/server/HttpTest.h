@@ -36,6 +36,8 @@ private:
     };
     void setupCallbacks();
     void cleanup();
+    bool openFile(const std::string &file_name);
+    void closeFile();
     void sendTestFile();
     void sendTestData();
     void sendNormal();
@@ -48,6 +50,9 @@ private:
     bool            is_options_ = false;
     size_t          total_bytes_read_ = 0;
     std::string     file_name_;
+    int             file_fd_ = -1;
+    int64_t         file_size_ = 0;
+    int64_t         file_offset_ = 0;
 };
 
 #endif
@@ -22,6 +22,25 @@ TestLoop* LoopPool::getNextLoop()
     return loop;
 }
 
+TestLoop* LoopPool::getCurrentLoop()
+{
+    for (auto loop : loops_) {
+        if(loop->eventLoop()->inSameThread()) {
+            return loop;
+        }
+    }
+    return nullptr;
+}
+
+bool LoopPool::init(EventLoopGroup* group)
+{
+    for (int i=0; i < group->size(); ++i) {
+        TestLoop* l = new TestLoop(this, group->getLoop(i));
+        loops_.push_back(l);
+    }
+    return true;
+}
+
 bool LoopPool::init(int count, PollType poll_type)
 {
     for (int i=0; i < count; ++i) {
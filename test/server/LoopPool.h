@@ -17,10 +17,12 @@ public:
     LoopPool();
 
     bool init(int count, PollType poll_type = PollType::NONE);
+    bool init(EventLoopGroup* group);
     void stop();
     
     long getConnId() { return ++id_seed_; }
     TestLoop* getNextLoop();
+    TestLoop* getCurrentLoop();
     
 private:
     void cleanup();
@@ -40,7 +40,7 @@ KMError ProtoDemuxer::attachFd(SOCKET_FD fd, uint32_t ssl_flags)
     tcp_.setReadCallback([this] (KMError err) { onReceive(err); });
     tcp_.setErrorCallback([this] (KMError err) { onClose(err); });
     tcp_.setSslFlags(ssl_flags);
-    return tcp_.attachFd(fd);
+    return tcp_.attachFd(fd, ATTACH_FLAG_ACCEPTED);
 }
 
 int ProtoDemuxer::close()
@@ -4,12 +4,13 @@
 #include <iostream>
 #include <sstream>
 
-TcpServer::TcpServer(EventLoop* loop, int count)
+TcpServer::TcpServer(EventLoop* loop, int count, bool reuse_port)
 : loop_(loop)
-, server_(loop_)
 , proto_(PROTO_TCP)
 , thr_count_(count)
 , loop_pool_()
+, reuse_port_(reuse_port)
+, loop_group_(loop->getPollType())
 {
     
 }
@@ -41,16 +42,28 @@ KMError TcpServer::startListen(const std::string &proto, const std::string &host
     } else if(proto == "autos") {
         proto_ = PROTO_AUTOS;
     }
-    loop_pool_.init(thr_count_, loop_->getPollType());
-    server_.setAcceptCallback([this] (SOCKET_FD fd, const char* ip, uint16_t port) -> bool { return onAccept(fd, ip, port); });
-    server_.setErrorCallback([this] (KMError err) { onError(err); });
-    return server_.startListen(host.c_str(), port);
+    if(reuse_port_) {
+        if(!loop_group_.init(thr_count_)) {
+            return KMError::FAILED;
+        }
+        loop_pool_.init(&loop_group_);
+        server_.reset(new TcpListener(&loop_group_));
+    } else {
+        loop_pool_.init(thr_count_, loop_->getPollType());
+        server_.reset(new TcpListener(loop_));
+    }
+    server_->setAcceptCallback([this] (SOCKET_FD fd, const char* ip, uint16_t port) -> bool { return onAccept(fd, ip, port); });
+    server_->setErrorCallback([this] (KMError err) { onError(err); });
+    return server_->startListen(host.c_str(), port);
 }
 
 KMError TcpServer::stopListen()
 {
-    server_.stopListen(nullptr, 0);
+    if(server_) {
+        server_->stopListen(nullptr, 0);
+    }
     loop_pool_.stop();
+    loop_group_.stop();
     return KMError::NOERR;
 }
 
@@ -59,7 +72,11 @@ bool TcpServer::onAccept(SOCKET_FD fd, const std::string &ip, uint16_t port)
     std::stringstream ss;
     ss << "TcpServer::onAccept, fd=" << fd << ", ip=" << ip << ", port=" << port << ", proto=" << proto_ << std::endl;
     std::cout << ss.str();
-    TestLoop* test_loop = loop_pool_.getNextLoop();
+    // the accept callback is called on the serving loop with SO_REUSEPORT listeners
+    TestLoop* test_loop = reuse_port_ ? loop_pool_.getCurrentLoop() : loop_pool_.getNextLoop();
+    if(!test_loop) {
+        return false;
+    }
     test_loop->addFd(fd, proto_);
     return true;
 }
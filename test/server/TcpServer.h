@@ -8,13 +8,14 @@
 #include <map>
 #include <vector>
 #include <atomic>
+#include <memory>
 
 using namespace kuma;
 
 class TcpServer
 {
 public:
-    TcpServer(EventLoop* loop, int count);
+    TcpServer(EventLoop* loop, int count, bool reuse_port = false);
     ~TcpServer();
     
     KMError startListen(const std::string &proto, const std::string &host, uint16_t port);
@@ -28,10 +29,14 @@ private:
     
 private:
     EventLoop*      loop_;
-    TcpListener     server_;
+    std::unique_ptr<TcpListener> server_;
     Proto           proto_;
     int             thr_count_;
     LoopPool        loop_pool_;
+    
+    // accept and serve connections on the same loop with SO_REUSEPORT listeners
+    bool            reuse_port_;
+    EventLoopGroup  loop_group_;
 };
 
 #endif
@@ -15,7 +15,7 @@ KMError TcpTest::attachFd(SOCKET_FD fd)
     tcp_.setWriteCallback([this] (KMError err) { onSend(err); });
     tcp_.setErrorCallback([this] (KMError err) { onClose(err); });
     
-    return tcp_.attachFd(fd);
+    return tcp_.attachFd(fd, ATTACH_FLAG_ACCEPTED);
 }
 
 int TcpTest::close()
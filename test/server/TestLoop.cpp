@@ -9,7 +9,16 @@
 #include <string.h>
 
 TestLoop::TestLoop(LoopPool* loopPool, PollType poll_type)
-: loop_(new EventLoop(poll_type))
+: own_loop_(new EventLoop(poll_type))
+, loop_(own_loop_.get())
+, loopPool_(loopPool)
+, thread_()
+{
+    
+}
+
+TestLoop::TestLoop(LoopPool* loopPool, EventLoop* loop)
+: loop_(loop)
 , loopPool_(loopPool)
 , thread_()
 {
@@ -28,6 +37,9 @@ void TestLoop::cleanup()
 
 bool TestLoop::init()
 {
+    if(!own_loop_) {
+        return true;
+    }
     try {
         thread_ = std::thread([this] {
             run();
@@ -43,6 +55,10 @@ bool TestLoop::init()
 void TestLoop::stop()
 {
     //cleanup();
+    if(!own_loop_) {
+        loop_->sync([this] { cleanup(); });
+        return;
+    }
     if(loop_) {
         loop_->async([this] { cleanup(); });
         loop_->stop();
@@ -43,6 +43,7 @@ class TestLoop : public ObjectManager
 {
 public:
     TestLoop(LoopPool* loopPool, PollType poll_type = PollType::NONE);
+    TestLoop(LoopPool* loopPool, EventLoop* loop); // loop is run by caller
 
     bool init();
     void stop();
@@ -57,7 +58,7 @@ public:
     void addObject(long conn_id, TestObject* obj) override;
     void removeObject(long conn_id) override;
     
-    EventLoop* eventLoop() override { return loop_.get(); }
+    EventLoop* eventLoop() override { return loop_; }
     
 private:
     void cleanup();
@@ -66,7 +67,8 @@ private:
 private:
     typedef std::map<long, TestObject*> ObjectMap;
     
-    std::unique_ptr<EventLoop>  loop_;
+    std::unique_ptr<EventLoop>  own_loop_;
+    EventLoop*      loop_;
     LoopPool*       loopPool_;
     
     std::mutex      obj_mutex_;
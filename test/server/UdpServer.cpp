@@ -22,20 +22,26 @@ int UdpServer::close()
 
 void UdpServer::onReceive(KMError err)
 {
-    char buf[4096] = {0};
-    char ip[128];
-    uint16_t port = 0;
+    // echo in batches, the source address of received datagram is the destination to send
+    const int kBatchCount = 16;
+    char bufs[kBatchCount][4096];
+    UdpDatagram dgrams[kBatchCount];
+    for (int i = 0; i < kBatchCount; ++i) {
+        dgrams[i].data = bufs[i];
+        dgrams[i].size = sizeof(bufs[i]);
+    }
     do {
-        int bytes_read = udp_.receive((uint8_t*)buf, sizeof(buf), ip, sizeof(ip), port);
-        if(bytes_read < 0) {
+        int count = udp_.receive(dgrams, kBatchCount);
+        if(count < 0) {
             udp_.close();
             return ;
-        } else if(0 == bytes_read) {
+        } else if(0 == count) {
             break;
         }
-        int ret = udp_.send((uint8_t*)buf, bytes_read, ip, port);
+        int ret = udp_.send(dgrams, count);
         if(ret < 0) {
             udp_.close();
+            return ;
         }
     } while(true);
 }
@@ -50,6 +50,7 @@ static const std::string g_usage =
 "   server [option] ws://0.0.0.0:8443\n"
 "   server [option] udp://0.0.0.0:52328\n"
 "   server [option] auto://0.0.0.0:8443\n"
+"   -r              one SO_REUSEPORT listener per loop thread, tcp based protocols only\n"
 "   -v              print version\n"
 ;
 
@@ -88,6 +89,7 @@ int main(int argc, char *argv[])
     www_path += "test/www";
     
     std::string listen_addr;
+    bool reuse_port = false;
     
     for (int i=1; i<argc; ++i) {
         if(argv[i][0] == '-') {
@@ -95,6 +97,9 @@ int main(int argc, char *argv[])
                 case 'v':
                     printf("kuma test server v1.0\n");
                     return 0;
+                case 'r':
+                    reuse_port = true;
+                    break;
                 default:
                     printUsage();
                     return -1;
@@ -129,7 +134,7 @@ int main(int argc, char *argv[])
         main_loop.loop();
         udp_server.close();
     } else {
-        TcpServer tcp_server(&main_loop, THREAD_COUNT);
+        TcpServer tcp_server(&main_loop, THREAD_COUNT, reuse_port);
         tcp_server.startListen(proto, host, port);
         main_loop.loop();
         tcp_server.stopListen();
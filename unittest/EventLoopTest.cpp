@@ -0,0 +1,1227 @@
+#include <gtest/gtest.h>
+#include "kmapi.h"
+
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <future>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <algorithm>
+#include <set>
+#include <string.h>
+#ifndef KUMA_OS_WIN
+# include <unistd.h>
+# include <fcntl.h>
+# include <netinet/in.h>
+#endif
+
+using namespace kuma;
+
+TEST(EventLoopTest, postOrder)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    std::vector<int> seq;
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_EQ(KMError::NOERR, loop.post([&seq, i] { seq.push_back(i); }));
+    }
+    loop.loopOnce(0);
+    ASSERT_EQ(100U, seq.size());
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_EQ(i, seq[i]);
+    }
+}
+
+TEST(EventLoopTest, postFromTask)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    int count = 0;
+    loop.post([&] {
+        ++count;
+        loop.post([&] { ++count; });
+    });
+    loop.loopOnce(0);
+    EXPECT_EQ(1, count); // the task posted by running task is executed in next round
+    loop.loopOnce(0);
+    EXPECT_EQ(2, count);
+}
+
+TEST(EventLoopTest, priorityLanes)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    loop.setTaskBudget(TaskPriority::IDLE, 2);
+    std::vector<int> seq;
+    for (int i = 0; i < 5; ++i) {
+        loop.post([&seq, i] { seq.push_back(200 + i); }, nullptr, TaskPriority::IDLE);
+    }
+    loop.post([&] {
+        seq.push_back(100);
+        loop.post([&] { seq.push_back(1); }, nullptr, TaskPriority::URGENT);
+    });
+    loop.post([&seq] { seq.push_back(101); });
+    loop.post([&seq] { seq.push_back(0); }, nullptr, TaskPriority::URGENT);
+    loop.loopOnce(0);
+    // the urgent task posted by normal task runs before the next normal task
+    EXPECT_EQ(std::vector<int>({0, 100, 1, 101, 200, 201}), seq);
+    loop.loopOnce(0);
+    EXPECT_EQ(8U, seq.size());
+    loop.loopOnce(0);
+    ASSERT_EQ(9U, seq.size());
+    EXPECT_EQ(204, seq.back());
+}
+
+TEST(EventLoopTest, cachedClock)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    std::chrono::steady_clock::time_point t1, t2;
+    loop.post([&] {
+        t1 = loop.now();
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        t2 = loop.now();
+    });
+    loop.loopOnce(0);
+    EXPECT_TRUE(t1 == t2); // the clock is not read again inside the task
+    // out of loop iteration or on other threads, it is the current time
+    EXPECT_TRUE(loop.now() > t1 + std::chrono::milliseconds(2));
+    std::chrono::steady_clock::time_point t3;
+    std::thread t([&] { t3 = loop.now(); });
+    t.join();
+    EXPECT_TRUE(t3 > t1 + std::chrono::milliseconds(2));
+}
+
+TEST(EventLoopTest, timerThreads)
+{
+    EventLoop loop;
+    std::promise<void> ready;
+    std::thread loop_thread([&] {
+        loop.init();
+        ready.set_value();
+        loop.loop();
+    });
+    ready.get_future().wait();
+    
+    // schedule and cancel from other thread
+    std::atomic<int> fired{0};
+    std::unique_ptr<Timer> t1(new Timer(&loop));
+    std::unique_ptr<Timer> t2(new Timer(&loop));
+    t1->schedule(1, TimerMode::ONE_SHOT, [&] { fired += 1; });
+    t2->schedule(20, TimerMode::ONE_SHOT, [&] { fired += 100; });
+    t2->cancel();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(1, fired);
+    
+    // reschedule on loop thread and destroy the repeating timer in its callback
+    int count = 0;
+    std::promise<void> done;
+    loop.sync([&] {
+        t1->schedule(1, TimerMode::REPEATING, [&] {
+            if (++count == 3) {
+                t1.reset();
+                done.set_value();
+            }
+        });
+        t2->schedule(1, TimerMode::ONE_SHOT, [&] { fired += 100; });
+        t2->schedule(10000, TimerMode::ONE_SHOT, [&] { fired += 100; });
+    });
+    done.get_future().wait();
+    loop.sync([&] { t2.reset(); });
+    EXPECT_EQ(1, fired);
+    EXPECT_EQ(3, count);
+    loop.stop();
+    loop_thread.join();
+}
+
+TEST(EventLoopTest, slackTimer)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    std::vector<std::unique_ptr<Timer>> timers;
+    int fired = 0;
+    for (int i = 0; i < 20; ++i) {
+        timers.emplace_back(new Timer(&loop));
+        timers.back()->schedule(5 + i, 32, TimerMode::ONE_SHOT, [&] { ++fired; });
+    }
+    timers[0]->schedule(6, 32, TimerMode::ONE_SHOT, [&] { ++fired; }); // same window
+    timers[1]->cancel();
+    timers[2]->schedule(10, 32, TimerMode::REPEATING, [&] { fired += 100; timers[2]->cancel(); });
+    auto start = std::chrono::steady_clock::now();
+    while (fired < 118 && std::chrono::steady_clock::now() - start < std::chrono::seconds(1)) {
+        loop.loopOnce(10);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    EXPECT_EQ(118, fired);
+    EXPECT_GE(elapsed, std::chrono::milliseconds(5));
+    loop.loopOnce(50);
+    EXPECT_EQ(118, fired);
+}
+
+TEST(EventLoopTest, highResTimer)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    HighResTimer timer(&loop);
+    int fired = 0;
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_TRUE(timer.schedule(500, TimerMode::REPEATING, [&] {
+        if (++fired == 3) {
+            timer.cancel();
+        }
+    }));
+    while (fired < 3 && std::chrono::steady_clock::now() - start < std::chrono::seconds(1)) {
+        loop.loopOnce(10);
+    }
+    EXPECT_EQ(3, fired);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::microseconds(1500));
+    
+    // reschedule from callback, and cancel before fired
+    ASSERT_TRUE(timer.schedule(100, TimerMode::ONE_SHOT, [&] {
+        timer.schedule(100, TimerMode::ONE_SHOT, [&] { fired += 10; });
+    }));
+    start = std::chrono::steady_clock::now();
+    while (fired < 13 && std::chrono::steady_clock::now() - start < std::chrono::seconds(1)) {
+        loop.loopOnce(10);
+    }
+    EXPECT_EQ(13, fired);
+    timer.schedule(1000, TimerMode::ONE_SHOT, [&] { fired += 100; });
+    timer.cancel();
+    loop.loopOnce(20);
+    EXPECT_EQ(13, fired);
+}
+
+TEST(EventLoopTest, ioUringPoll)
+{
+    EventLoop loop(PollType::IO_URING);
+    ASSERT_TRUE(loop.init());
+    if (loop.getPollType() != PollType::IO_URING) {
+        return; // not supported by kernel
+    }
+    bool posted = false;
+    std::thread thr([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        loop.post([&] { posted = true; });
+    });
+    auto start = std::chrono::steady_clock::now();
+    loop.loopOnce(1000); // woken up by the notifier
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(500));
+    thr.join();
+    loop.loopOnce(0);
+    EXPECT_TRUE(posted);
+    
+    // timerfd readiness is reported through the multishot poll
+    int fired = 0;
+    std::unique_ptr<HighResTimer> timer(new HighResTimer(&loop));
+    timer->schedule(1000, TimerMode::REPEATING, [&] { ++fired; });
+    while (fired < 3 && std::chrono::steady_clock::now() - start < std::chrono::seconds(2)) {
+        loop.loopOnce(100);
+    }
+    EXPECT_EQ(3, fired);
+    timer.reset();
+    loop.loopOnce(5);
+    EXPECT_EQ(3, fired);
+}
+
+#ifndef KUMA_OS_WIN
+TEST(EventLoopTest, unregisterInCallback)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    int fds1[2], fds2[2];
+    ASSERT_EQ(0, pipe(fds1));
+    ASSERT_EQ(0, pipe(fds2));
+    int called = 0;
+    // the first callback unregisters both fds, the pending event of the other is dropped.
+    // the same IOCallback is registered twice, it's copied
+    IOCallback cb = [&] (KMEvent, void*, size_t) {
+        ++called;
+        loop.unregisterFd(fds1[0], true);
+        loop.unregisterFd(fds2[0], true);
+    };
+    auto fd_count = loop.getStats().fd_count;
+    loop.registerFd(fds1[0], KUMA_EV_READ, cb);
+    loop.registerFd(fds2[0], KUMA_EV_READ, cb);
+    EXPECT_EQ(fd_count + 2, loop.getStats().fd_count);
+    ASSERT_EQ(1, write(fds1[1], "k", 1));
+    ASSERT_EQ(1, write(fds2[1], "k", 1));
+    loop.loopOnce(100);
+    EXPECT_EQ(1, called);
+    EXPECT_EQ(fd_count, loop.getStats().fd_count);
+    close(fds1[1]);
+    close(fds2[1]);
+}
+#endif
+
+TEST(EventLoopTest, cancelToken)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    auto token = loop.createToken();
+    int count = 0;
+    for (int i = 0; i < 10; ++i) {
+        loop.post([&count] { ++count; }, &token);
+    }
+    loop.post([&count] { count += 100; });
+    loop.cancel(&token);
+    loop.loopOnce(0);
+    EXPECT_EQ(100, count);
+    
+    loop.post([&count] { ++count; }, &token);
+    token.reset();
+    loop.loopOnce(0);
+    EXPECT_EQ(100, count);
+    
+    // the captures are released on cancel, not when the loop dequeues the task
+    auto token2 = loop.createToken();
+    auto obj = std::make_shared<int>(0);
+    loop.post([obj] { ++*obj; }, &token2);
+    EXPECT_EQ(2, obj.use_count());
+    loop.cancel(&token2);
+    EXPECT_EQ(1, obj.use_count());
+    loop.loopOnce(0);
+    EXPECT_EQ(0, *obj);
+}
+
+TEST(EventLoopTest, multiProducer)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    const int kThreads = 8;
+    const int kTasks = 10000;
+    int count = 0;
+    std::vector<std::thread> producers;
+    for (int i = 0; i < kThreads; ++i) {
+        producers.emplace_back([&] {
+            for (int j = 0; j < kTasks; ++j) {
+                loop.post([&count] { ++count; });
+            }
+        });
+    }
+    for (int i = 0; i < 10000 && count < kThreads * kTasks; ++i) {
+        loop.loopOnce(10);
+    }
+    for (auto &t : producers) {
+        t.join();
+    }
+    loop.loopOnce(0);
+    EXPECT_EQ(kThreads * kTasks, count);
+}
+
+TEST(EventLoopTest, notifyCoalescing)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    int count = 0;
+    std::thread producer([&] {
+        // the loop is awake, no wakeup is needed
+        for (int i = 0; i < 100; ++i) {
+            loop.post([&count] { ++count; });
+        }
+    });
+    producer.join();
+    auto stats = loop.getStats();
+    EXPECT_EQ(0U, stats.notify_issued);
+    EXPECT_EQ(100U, stats.notify_elided);
+    loop.loopOnce(0);
+    EXPECT_EQ(100, count);
+}
+
+TEST(EventLoopTest, wakeupSleepingLoop)
+{
+    EventLoop loop;
+    std::promise<void> ready;
+    std::thread loop_thread([&] {
+        loop.init();
+        ready.set_value();
+        loop.loop();
+    });
+    ready.get_future().wait();
+    for (int i = 0; i < 10; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        std::promise<void> done;
+        loop.post([&done] { done.set_value(); });
+        auto status = done.get_future().wait_for(std::chrono::seconds(5));
+        EXPECT_EQ(std::future_status::ready, status);
+    }
+    EventLoop::Stats stats;
+    loop.sync([&] { stats = loop.getStats(); });
+    EXPECT_LE(1U, stats.notify_issued);
+    loop.stop();
+    loop_thread.join();
+}
+
+TEST(EventLoopTest, postBatch)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    auto token = loop.createToken();
+    std::vector<int> seq;
+    std::vector<EventLoop::Task> tasks;
+    for (int i = 0; i < 10; ++i) {
+        tasks.emplace_back([&seq, i] { seq.push_back(i); });
+    }
+    loop.post([&seq] { seq.push_back(-1); });
+    EXPECT_EQ(KMError::NOERR, loop.post(std::move(tasks)));
+    EXPECT_TRUE(tasks.empty());
+    loop.loopOnce(0);
+    ASSERT_EQ(11U, seq.size());
+    for (int i = 0; i < 11; ++i) {
+        EXPECT_EQ(i - 1, seq[i]);
+    }
+    
+    for (int i = 0; i < 10; ++i) {
+        tasks.emplace_back([&seq, i] { seq.push_back(i); });
+    }
+    EXPECT_EQ(KMError::NOERR, loop.post(std::move(tasks), &token));
+    loop.cancel(&token);
+    loop.loopOnce(0);
+    EXPECT_EQ(11U, seq.size());
+}
+
+TEST(EventLoopTest, moveOnlyTask)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    int value = 0;
+    std::unique_ptr<int> ptr(new int(10));
+    char buf[64] = {0};
+    KMBuffer kmb(buf, sizeof(buf));
+    kmb.bytesWritten(sizeof(buf));
+    auto sp = std::make_shared<int>(5);
+    // captures a shared_ptr and a KMBuffer, it should be stored inline
+    loop.post([&value, sp, kmb = std::move(kmb), ptr = std::move(ptr)] {
+        value = *ptr + *sp + int(kmb.size());
+    });
+    loop.loopOnce(0);
+    EXPECT_EQ(10 + 5 + 64, value);
+    EXPECT_EQ(1, sp.use_count());
+}
+
+TEST(EventLoopTest, taskType)
+{
+    int count = 0;
+    EventLoop::MoveTask t1([&count] { ++count; });
+    EXPECT_TRUE(bool(t1));
+    EventLoop::MoveTask t2(std::move(t1));
+    EXPECT_FALSE(bool(t1));
+    t2();
+    EXPECT_EQ(1, count);
+    
+    // large callable is allocated on heap
+    char big[256] = {0};
+    EventLoop::MoveTask t3([&count, big] { count += big[0] + 1; });
+    t3();
+    EXPECT_EQ(2, count);
+    t1 = std::move(t3);
+    t1();
+    EXPECT_EQ(3, count);
+    
+    std::function<void()> f;
+    EventLoop::MoveTask t4(f);
+    EXPECT_FALSE(bool(t4));
+    f = [&count] { ++count; };
+    t4 = f;
+    t4();
+    EXPECT_EQ(4, count);
+    t4 = nullptr;
+    EXPECT_FALSE(bool(t4));
+    
+    // Task is still std::function, it can be posted more than once
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    EventLoop::Task t5 = [&count] { ++count; };
+    loop.post(t5);
+    loop.post(t5);
+    loop.post(EventLoop::MoveTask([&count] { ++count; }));
+    loop.loopOnce(0);
+    EXPECT_EQ(7, count);
+}
+
+TEST(EventLoopTest, groupListen)
+{
+    EventLoopGroup group;
+    ASSERT_TRUE(group.init(2));
+    ASSERT_EQ(2, group.size());
+    EXPECT_NE(group.getNextLoop(), group.getNextLoop());
+    
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    for (bool shared : {false, true}) {
+        std::atomic<int> accepted{0};
+        std::atomic<bool> on_group_loop{true};
+        TcpListener listener(&group);
+        if (listener.setSharedListenSocket(shared) != KMError::NOERR) {
+            continue; // shared listen socket is not supported
+        }
+        listener.setAcceptCallback([&] (SOCKET_FD, const char*, uint16_t) {
+            if (!group.getLoop(0)->inSameThread() && !group.getLoop(1)->inSameThread()) {
+                on_group_loop = false;
+            }
+            ++accepted;
+            return false; // fd will be closed by listener
+        });
+        uint16_t port = shared ? 52391 : 52390;
+        ASSERT_EQ(KMError::NOERR, listener.startListen("127.0.0.1", port));
+        EXPECT_EQ(KMError::INVALID_STATE, listener.setSharedListenSocket(!shared));
+        
+        std::vector<std::unique_ptr<TcpSocket>> sockets;
+        for (int i = 0; i < 8; ++i) {
+            std::unique_ptr<TcpSocket> tcp(new TcpSocket(&loop));
+            EXPECT_EQ(KMError::NOERR, tcp->connect("127.0.0.1", port, [] (KMError) {}));
+            sockets.emplace_back(std::move(tcp));
+        }
+        auto start = std::chrono::steady_clock::now();
+        while (accepted < 8 && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+            loop.loopOnce(10);
+        }
+        EXPECT_EQ(8, accepted);
+        EXPECT_TRUE(on_group_loop);
+        
+        for (auto &tcp : sockets) {
+            tcp->close();
+        }
+        listener.close();
+    }
+    group.stop();
+    EXPECT_EQ(0, group.size());
+}
+
+TEST(EventLoopTest, acceptBatch)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    
+    int accepted = 0;
+    bool addr_ok = true, nonblocking = true;
+    TcpListener listener(&loop);
+    EXPECT_EQ(KMError::NOERR, listener.setBacklog(256));
+    listener.setAcceptBatch(2);
+    listener.setAcceptAddrCallback([&] (SOCKET_FD fd, const sockaddr *addr, socklen_t addr_len) {
+        if (addr_len < sizeof(sockaddr_in) || addr->sa_family != AF_INET) {
+            addr_ok = false;
+        }
+#ifdef KUMA_OS_LINUX
+        if (!(fcntl(fd, F_GETFL, 0) & O_NONBLOCK)) {
+            nonblocking = false;
+        }
+#endif
+        ++accepted;
+        return false; // fd will be closed by listener
+    });
+    ASSERT_EQ(KMError::NOERR, listener.startListen("127.0.0.1", 52396));
+    EXPECT_EQ(KMError::INVALID_STATE, listener.setBacklog(128));
+    
+    std::vector<std::unique_ptr<TcpSocket>> sockets;
+    for (int i = 0; i < 8; ++i) {
+        std::unique_ptr<TcpSocket> tcp(new TcpSocket(&loop));
+        EXPECT_EQ(KMError::NOERR, tcp->connect("127.0.0.1", 52396, [] (KMError) {}));
+        sockets.emplace_back(std::move(tcp));
+    }
+    auto start = std::chrono::steady_clock::now();
+    while (accepted < 8 && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+        loop.loopOnce(10);
+    }
+    EXPECT_EQ(8, accepted);
+    EXPECT_TRUE(addr_ok);
+    EXPECT_TRUE(nonblocking);
+    EXPECT_GT(loop.getStats().read_deferred, 0U);
+    
+    for (auto &tcp : sockets) {
+        tcp->close();
+    }
+    listener.close();
+}
+
+TEST(EventLoopTest, readBudget)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    loop.setReadBudget(16*1024);
+    
+    std::unique_ptr<TcpSocket> server;
+    size_t received = 0, max_per_callback = 0;
+    TcpListener listener(&loop);
+    listener.setAcceptCallback([&] (SOCKET_FD fd, const char*, uint16_t) {
+        server.reset(new TcpSocket(&loop));
+        server->setReadCallback([&] (KMError) {
+            char buf[4096];
+            size_t bytes = 0;
+            int ret = 0;
+            while ((ret = server->receive(buf, sizeof(buf))) > 0) {
+                bytes += ret;
+            }
+            received += bytes;
+            max_per_callback = std::max(max_per_callback, bytes);
+        });
+        return server->attachFd(fd) == KMError::NOERR;
+    });
+    ASSERT_EQ(KMError::NOERR, listener.startListen("127.0.0.1", 52392));
+    
+    const size_t total = 256*1024;
+    std::string data(total, 'k');
+    size_t sent = 0;
+    TcpSocket client(&loop);
+    auto send_data = [&] (KMError) {
+        while (sent < total) {
+            int ret = client.send(data.data() + sent, total - sent);
+            if (ret <= 0) {
+                break;
+            }
+            sent += ret;
+        }
+    };
+    client.setWriteCallback(send_data);
+    EXPECT_EQ(KMError::NOERR, client.connect("127.0.0.1", 52392, send_data));
+    auto start = std::chrono::steady_clock::now();
+    while (received < total && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+        loop.loopOnce(10);
+    }
+    EXPECT_EQ(total, received);
+    EXPECT_LE(max_per_callback, 16*1024 + 4096U);
+    EXPECT_GT(loop.getStats().read_deferred, 0U);
+    
+    client.close();
+    if (server) {
+        server->close();
+    }
+    listener.close();
+}
+
+TEST(EventLoopTest, zeroCopySend)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    
+    std::unique_ptr<TcpSocket> server;
+    std::string received;
+    TcpListener listener(&loop);
+    listener.setAcceptCallback([&] (SOCKET_FD fd, const char*, uint16_t) {
+        server.reset(new TcpSocket(&loop));
+        server->setReadCallback([&] (KMError) {
+            char buf[16*1024];
+            int ret = 0;
+            while ((ret = server->receive(buf, sizeof(buf))) > 0) {
+                received.append(buf, ret);
+            }
+        });
+        return server->attachFd(fd) == KMError::NOERR;
+    });
+    ASSERT_EQ(KMError::NOERR, listener.startListen("127.0.0.1", 52397));
+    
+    const size_t total = 4*1024*1024;
+    KMBuffer payload(total);
+    for (size_t i = 0; i < total; ++i) {
+        static_cast<char*>(payload.writePtr())[i] = char('a' + i % 26);
+    }
+    payload.bytesWritten(total);
+    std::string expected(static_cast<const char*>(payload.readPtr()), total);
+    
+    TcpSocket client(&loop);
+#ifdef KUMA_OS_LINUX
+    EXPECT_EQ(KMError::NOERR, client.setZeroCopy(64*1024));
+#endif
+    bool closed = false;
+    client.setErrorCallback([&] (KMError) { closed = true; });
+    auto send_data = [&] (KMError) {
+        // the payload is released as soon as it's sent, the socket keeps the storage
+        while (!payload.empty()) {
+            int ret = client.send(payload);
+            if (ret <= 0) {
+                break;
+            }
+            payload.bytesRead(ret);
+        }
+    };
+    client.setWriteCallback(send_data);
+    EXPECT_EQ(KMError::NOERR, client.connect("127.0.0.1", 52397, send_data));
+    auto start = std::chrono::steady_clock::now();
+    while (received.size() < total && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+        loop.loopOnce(10);
+    }
+    EXPECT_FALSE(closed);
+    EXPECT_EQ(total, received.size());
+    EXPECT_TRUE(received == expected);
+    
+    client.close();
+    if (server) {
+        server->close();
+    }
+    listener.close();
+}
+
+#ifndef KUMA_OS_WIN
+TEST(EventLoopTest, sendFile)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    
+    char file_name[] = "/tmp/kuma_sendfile_XXXXXX";
+    int file_fd = mkstemp(file_name);
+    ASSERT_GE(file_fd, 0);
+    unlink(file_name);
+    const size_t total = 1024*1024 + 123;
+    std::string expected(total, 0);
+    for (size_t i = 0; i < total; ++i) {
+        expected[i] = char('a' + i % 26);
+    }
+    ASSERT_EQ(ssize_t(total), write(file_fd, expected.data(), total));
+    
+    std::unique_ptr<TcpSocket> server;
+    std::string received;
+    TcpListener listener(&loop);
+    listener.setAcceptCallback([&] (SOCKET_FD fd, const char*, uint16_t) {
+        server.reset(new TcpSocket(&loop));
+        server->setReadCallback([&] (KMError) {
+            char buf[16*1024];
+            int ret = 0;
+            while ((ret = server->receive(buf, sizeof(buf))) > 0) {
+                received.append(buf, ret);
+            }
+        });
+        return server->attachFd(fd) == KMError::NOERR;
+    });
+    ASSERT_EQ(KMError::NOERR, listener.startListen("127.0.0.1", 52398));
+    
+    TcpSocket client(&loop);
+    bool closed = false;
+    int64_t offset = 0;
+    client.setErrorCallback([&] (KMError) { closed = true; });
+    auto send_file = [&] (KMError) {
+        while (offset < int64_t(total)) {
+            int ret = client.sendFile(file_fd, offset, size_t(total - offset));
+            if (ret <= 0) {
+                break;
+            }
+            offset += ret;
+        }
+    };
+    client.setWriteCallback(send_file);
+    EXPECT_EQ(KMError::NOERR, client.connect("127.0.0.1", 52398, send_file));
+    auto start = std::chrono::steady_clock::now();
+    while (received.size() < total && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+        loop.loopOnce(10);
+    }
+    EXPECT_FALSE(closed);
+    EXPECT_EQ(total, received.size());
+    EXPECT_TRUE(received == expected);
+    // the file offset is not moved by sendFile
+    EXPECT_EQ(off_t(total), lseek(file_fd, 0, SEEK_CUR));
+    // the range beyond the file fails without closing the socket
+    EXPECT_EQ(-1, client.sendFile(file_fd, int64_t(total), 100));
+    // so does the invalid file fd
+    int closed_fd = dup(file_fd);
+    close(closed_fd);
+    EXPECT_EQ(-1, client.sendFile(closed_fd, 0, 100));
+    EXPECT_EQ(3, client.send("end", 3));
+    
+    client.close();
+    if (server) {
+        server->close();
+    }
+    listener.close();
+    close(file_fd);
+}
+#endif
+
+TEST(EventLoopTest, udpBatch)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    
+    const int total = 200;
+    std::vector<std::string> received;
+    std::set<uint16_t> source_ports;
+    UdpSocket receiver(&loop);
+    receiver.setReadCallback([&] (KMError) {
+        char bufs[16][256];
+        UdpDatagram dgrams[16];
+        for (int i = 0; i < 16; ++i) {
+            dgrams[i].data = bufs[i];
+            dgrams[i].size = sizeof(bufs[i]);
+        }
+        int ret = 0;
+        while ((ret = receiver.receive(dgrams, 16)) > 0) {
+            for (int i = 0; i < ret; ++i) {
+                received.emplace_back((const char*)dgrams[i].data, dgrams[i].length);
+                EXPECT_STREQ("127.0.0.1", dgrams[i].ip);
+                source_ports.insert(dgrams[i].port);
+            }
+        }
+    });
+    ASSERT_EQ(KMError::NOERR, receiver.bind("127.0.0.1", 52399));
+    
+    UdpSocket sender(&loop);
+    ASSERT_EQ(KMError::NOERR, sender.bind("127.0.0.1", 52400));
+    std::vector<std::string> payloads;
+    for (int i = 0; i < total; ++i) {
+        payloads.push_back("datagram " + std::to_string(i) + std::string(i % 100, 'x'));
+    }
+    std::vector<UdpDatagram> dgrams(total);
+    for (int i = 0; i < total; ++i) {
+        dgrams[i].data = &payloads[i][0];
+        dgrams[i].length = payloads[i].size();
+        strcpy(dgrams[i].ip, "127.0.0.1");
+        dgrams[i].port = 52399;
+    }
+    int sent = 0;
+    while (sent < total) {
+        // at most 64 datagrams are sent per call
+        int ret = sender.send(&dgrams[sent], total - sent);
+        ASSERT_GT(ret, 0);
+        EXPECT_LE(ret, 64);
+        sent += ret;
+        loop.loopOnce(0);
+    }
+    auto start = std::chrono::steady_clock::now();
+    while (received.size() < size_t(total) && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+        loop.loopOnce(10);
+    }
+    EXPECT_TRUE(received == payloads);
+    EXPECT_EQ(1U, source_ports.size());
+    EXPECT_EQ(1U, source_ports.count(52400));
+    
+    sender.close();
+    receiver.close();
+}
+
+TEST(EventLoopTest, udpSegments)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    
+    const size_t segment_size = 1200;
+    // more than 64KB, it takes two sends with UDP_SEGMENT
+    const size_t total = 60*segment_size + 300;
+    std::string payload(total, 0);
+    for (size_t i = 0; i < total; ++i) {
+        payload[i] = char('a' + (i / segment_size) % 26);
+    }
+    std::vector<std::string> received;
+    UdpSocket receiver(&loop);
+    receiver.setReadCallback([&] (KMError) {
+        char bufs[8][2048];
+        UdpDatagram dgrams[8];
+        for (int i = 0; i < 8; ++i) {
+            dgrams[i].data = bufs[i];
+            dgrams[i].size = sizeof(bufs[i]);
+        }
+        int ret = 0;
+        while ((ret = receiver.receive(dgrams, 8)) > 0) {
+            for (int i = 0; i < ret; ++i) {
+                received.emplace_back((const char*)dgrams[i].data, dgrams[i].length);
+                EXPECT_EQ(52402, dgrams[i].port);
+            }
+        }
+    });
+    // coalesced datagrams are split back to the segments
+    ASSERT_EQ(KMError::NOERR, receiver.bind("127.0.0.1", 52401, UDP_FLAG_GRO));
+    
+    UdpSocket sender(&loop);
+    ASSERT_EQ(KMError::NOERR, sender.bind("127.0.0.1", 52402));
+    EXPECT_EQ(int(total), sender.sendSegments(payload.data(), total, segment_size, "127.0.0.1", 52401));
+    
+    const size_t segments = (total + segment_size - 1) / segment_size;
+    auto start = std::chrono::steady_clock::now();
+    while (received.size() < segments && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+        loop.loopOnce(10);
+    }
+    ASSERT_EQ(segments, received.size());
+    for (size_t i = 0; i < segments; ++i) {
+        EXPECT_EQ(payload.substr(i * segment_size, segment_size), received[i]);
+    }
+    
+    sender.close();
+    receiver.close();
+}
+
+TEST(EventLoopTest, migrate)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    loop.setReadBudget(16*1024); // leave the input in socket when migrating
+    EventLoopGroup group;
+    ASSERT_TRUE(group.init(2));
+    auto *target = group.getLeastLoadedLoop();
+    ASSERT_NE(nullptr, target);
+    EXPECT_LE(target->getLoad(), 1000U);
+    std::thread::id target_tid;
+    target->sync([&] { target_tid = std::this_thread::get_id(); });
+    
+    const size_t total = 256*1024;
+    std::unique_ptr<TcpSocket> server;
+    std::atomic<size_t> received{0};
+    std::atomic<bool> read_on_target{false};
+    KMError migrate_result = KMError::FAILED;
+    TcpListener listener(&loop);
+    listener.setAcceptCallback([&] (SOCKET_FD fd, const char*, uint16_t) {
+        server.reset(new TcpSocket(&loop));
+        server->setReadCallback([&] (KMError) {
+            char buf[4096];
+            int ret = 0;
+            while ((ret = server->receive(buf, sizeof(buf))) > 0) {
+                received += ret;
+            }
+            if (std::this_thread::get_id() == target_tid) {
+                read_on_target = true;
+                if (received == total) {
+                    server->send("ok", 2);
+                }
+            } else if (migrate_result == KMError::FAILED) {
+                migrate_result = server->migrate(target);
+            }
+        });
+        return server->attachFd(fd) == KMError::NOERR;
+    });
+    ASSERT_EQ(KMError::NOERR, listener.startListen("127.0.0.1", 52394));
+    
+    std::string data(total, 'm');
+    size_t sent = 0;
+    std::atomic<bool> done{false};
+    TcpSocket client(&loop);
+    auto send_data = [&] (KMError) {
+        while (sent < total) {
+            int ret = client.send(data.data() + sent, total - sent);
+            if (ret <= 0) {
+                break;
+            }
+            sent += ret;
+        }
+    };
+    client.setWriteCallback(send_data);
+    client.setReadCallback([&] (KMError) {
+        char buf[16];
+        if (client.receive(buf, sizeof(buf)) == 2) {
+            done = true;
+        }
+    });
+    EXPECT_EQ(KMError::NOERR, client.connect("127.0.0.1", 52394, send_data));
+    auto start = std::chrono::steady_clock::now();
+    while (!done && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+        loop.loopOnce(10);
+    }
+    EXPECT_EQ(KMError::NOERR, migrate_result);
+    EXPECT_TRUE(read_on_target);
+    EXPECT_EQ(total, received);
+    EXPECT_TRUE(done);
+    
+    if (server) {
+        server->close();
+    }
+    client.close();
+    listener.close();
+    group.stop();
+}
+
+TEST(EventLoopTest, writeCoalescing)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    loop.setWriteCoalescing(true);
+    
+    std::unique_ptr<WebSocket> server;
+    std::vector<std::string> messages;
+    TcpListener listener(&loop);
+    listener.setAcceptCallback([&] (SOCKET_FD fd, const char*, uint16_t) {
+        server.reset(new WebSocket(&loop));
+        server->setDataCallback([&] (KMBuffer &buf, bool, bool) {
+            std::string msg(buf.chainLength(), '\0');
+            buf.readChained(&msg[0], msg.size());
+            messages.emplace_back(std::move(msg));
+        });
+        return server->attachFd(fd, nullptr, [] (KMError) { return true; }) == KMError::NOERR;
+    });
+    ASSERT_EQ(KMError::NOERR, listener.startListen("127.0.0.1", 52395));
+    
+    bool opened = false;
+    WebSocket client(&loop);
+    EXPECT_EQ(KMError::NOERR, client.connect("ws://127.0.0.1:52395", [&] (KMError err) {
+        opened = err == KMError::NOERR;
+        return true;
+    }));
+    auto start = std::chrono::steady_clock::now();
+    while (!opened && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+        loop.loopOnce(10);
+    }
+    ASSERT_TRUE(opened);
+    
+    // the messages sent in one iteration go out with one write at the end of it
+    const int count = 100;
+    auto flush_count = loop.getStats().flush_count;
+    for (int i = 0; i < count; ++i) {
+        auto msg = "message " + std::to_string(i);
+        EXPECT_EQ(int(msg.size()), client.send(msg.data(), msg.size(), true));
+    }
+    start = std::chrono::steady_clock::now();
+    while (messages.size() < count && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+        loop.loopOnce(10);
+    }
+    ASSERT_EQ(size_t(count), messages.size());
+    for (int i = 0; i < count; ++i) {
+        EXPECT_EQ("message " + std::to_string(i), messages[i]);
+    }
+    EXPECT_EQ(flush_count + 1, loop.getStats().flush_count);
+    
+    client.close();
+    if (server) {
+        server->close();
+    }
+    listener.close();
+}
+
+TEST(EventLoopTest, ioThreads)
+{
+    EventLoop server_loop;
+    if (server_loop.setIOThreads(2) != KMError::NOERR) {
+        return; // not supported
+    }
+    std::promise<bool> ready;
+    std::thread server_thread([&] {
+        ready.set_value(server_loop.init());
+        server_loop.loop();
+    });
+    ASSERT_TRUE(ready.get_future().get());
+    EXPECT_EQ(KMError::INVALID_STATE, server_loop.setIOThreads(1));
+    
+    struct Conn {
+        std::unique_ptr<TcpSocket> socket;
+        std::atomic<int> running{0};
+    };
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Conn>> conns;
+    std::set<std::thread::id> thread_ids;
+    std::atomic<bool> overlapped{false};
+    TcpListener listener(&server_loop);
+    listener.setAcceptCallback([&] (SOCKET_FD fd, const char*, uint16_t) {
+        auto *conn = new Conn();
+        conn->socket.reset(new TcpSocket(&server_loop));
+        conn->socket->setReadCallback([&, conn] (KMError) {
+            if (++conn->running > 1) {
+                overlapped = true;
+            }
+            {
+                std::lock_guard<std::mutex> g(mutex);
+                thread_ids.insert(std::this_thread::get_id());
+            }
+            char buf[256];
+            int ret = 0;
+            while ((ret = conn->socket->receive(buf, sizeof(buf))) > 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20)); // slow request
+                conn->socket->send(buf, ret);
+            }
+            --conn->running;
+        });
+        conn->socket->attachFd(fd);
+        std::lock_guard<std::mutex> g(mutex);
+        conns.emplace_back(conn);
+        return true;
+    });
+    server_loop.sync([&] {
+        EXPECT_EQ(KMError::NOERR, listener.startListen("127.0.0.1", 52393));
+    });
+    
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    int replied = 0;
+    std::vector<std::unique_ptr<TcpSocket>> clients;
+    for (int i = 0; i < 4; ++i) {
+        std::unique_ptr<TcpSocket> tcp(new TcpSocket(&loop));
+        auto *client = tcp.get();
+        client->setReadCallback([&, client] (KMError) {
+            char buf[256];
+            while (client->receive(buf, sizeof(buf)) > 0) {
+                ++replied;
+            }
+        });
+        client->connect("127.0.0.1", 52393, [client] (KMError err) {
+            if (err == KMError::NOERR) {
+                client->send("ping", 4);
+            }
+        });
+        clients.emplace_back(std::move(tcp));
+    }
+    auto start = std::chrono::steady_clock::now();
+    while (replied < 4 && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+        loop.loopOnce(10);
+    }
+    EXPECT_EQ(4, replied);
+    EXPECT_FALSE(overlapped);
+    {
+        std::lock_guard<std::mutex> g(mutex);
+        EXPECT_GT(thread_ids.size(), 1U);
+    }
+    
+    // close the server sockets when no callback is running, then the clients
+    server_loop.sync([&] {
+        listener.close();
+        std::vector<Conn*> accepted;
+        {
+            std::lock_guard<std::mutex> g(mutex);
+            for (auto &conn : conns) {
+                accepted.push_back(conn.get());
+            }
+        }
+        for (auto *conn : accepted) {
+            while (conn->running > 0) {
+                std::this_thread::yield();
+            }
+            conn->socket->close();
+        }
+    });
+    for (auto &tcp : clients) {
+        tcp->close();
+    }
+    server_loop.stop();
+    server_thread.join();
+}
+
+TEST(EventLoopTest, ioThreadsReadBudget)
+{
+    EventLoop server_loop;
+    if (server_loop.setIOThreads(1) != KMError::NOERR) {
+        return; // not supported
+    }
+    // the input and the connections left by the budgets are reported again after re-arming
+    server_loop.setReadBudget(4);
+    std::promise<bool> ready;
+    std::thread server_thread([&] {
+        ready.set_value(server_loop.init());
+        server_loop.loop();
+    });
+    ASSERT_TRUE(ready.get_future().get());
+    
+    const int conn_count = 3;
+    const size_t msg_size = 64;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<TcpSocket>> server_sockets;
+    std::atomic<size_t> received{0};
+    TcpListener listener(&server_loop);
+    listener.setAcceptBatch(1);
+    listener.setAcceptCallback([&] (SOCKET_FD fd, const char*, uint16_t) {
+        auto *socket = new TcpSocket(&server_loop);
+        socket->setReadCallback([&, socket] (KMError) {
+            char buf[2];
+            int ret = 0;
+            while ((ret = socket->receive(buf, sizeof(buf))) > 0) {
+                received += ret;
+            }
+        });
+        socket->attachFd(fd, ATTACH_FLAG_ACCEPTED);
+        std::lock_guard<std::mutex> g(mutex);
+        server_sockets.emplace_back(socket);
+        return true;
+    });
+    server_loop.sync([&] {
+        EXPECT_EQ(KMError::NOERR, listener.startListen("127.0.0.1", 52394));
+    });
+    
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    std::string message(msg_size, 'k');
+    std::vector<std::unique_ptr<TcpSocket>> clients;
+    for (int i = 0; i < conn_count; ++i) {
+        std::unique_ptr<TcpSocket> tcp(new TcpSocket(&loop));
+        auto *client = tcp.get();
+        client->connect("127.0.0.1", 52394, [&, client] (KMError err) {
+            if (err == KMError::NOERR) {
+                client->send(message.data(), message.size());
+            }
+        });
+        clients.emplace_back(std::move(tcp));
+    }
+    auto start = std::chrono::steady_clock::now();
+    while (received < conn_count * msg_size && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+        loop.loopOnce(10);
+    }
+    EXPECT_EQ(conn_count * msg_size, received.load());
+    
+    server_loop.sync([&] {
+        listener.close();
+        std::lock_guard<std::mutex> g(mutex);
+        for (auto &socket : server_sockets) {
+            socket->close();
+        }
+    });
+    for (auto &tcp : clients) {
+        tcp->close();
+    }
+    server_loop.stop();
+    server_thread.join();
+}
+
+TEST(EventLoopTest, stats)
+{
+    EventLoop loop;
+    ASSERT_TRUE(loop.init());
+    auto fd_count = loop.getStats().fd_count;
+    UdpSocket udp(&loop);
+    ASSERT_EQ(KMError::NOERR, udp.bind("127.0.0.1", 0));
+    
+    for (int i = 0; i < 10; ++i) {
+        loop.post([] {});
+    }
+    loop.loopOnce(0);
+    for (int i = 0; i < 3; ++i) {
+        loop.post([] {});
+    }
+    loop.loopOnce(0);
+    auto stats = loop.getStats();
+    EXPECT_EQ(2U, stats.iterations);
+    EXPECT_EQ(10U, stats.max_tasks_per_iteration);
+    EXPECT_EQ(2U, stats.iteration_latency.total);
+    EXPECT_EQ(fd_count + 1, stats.fd_count);
+    udp.close();
+    EXPECT_EQ(fd_count, loop.getStats().fd_count);
+}
+
+TEST(EventLoopTest, histogram)
+{
+    for (uint64_t v = 0; v < (1ULL << 36); v = v * 3 / 2 + 1) {
+        auto upper = EventLoop::Histogram::bucketUpperBound(EventLoop::Histogram::bucketIndex(v));
+        EXPECT_LE(v, upper);
+        EXPECT_LE(upper - v, v / 8);
+    }
+    EventLoop::Histogram h;
+    for (uint64_t v = 1; v <= 1000; ++v) {
+        h.record(v);
+    }
+    EXPECT_EQ(1000U, h.total);
+    EXPECT_EQ(1000U, h.max);
+    EXPECT_EQ(1000U, h.percentile(100));
+    auto p50 = h.percentile(50);
+    EXPECT_LE(500U, p50);
+    EXPECT_GE(500U + 500 / 8, p50);
+}
+
+TEST(EventLoopTest, watchdog)
+{
+    std::mutex msg_mutex;
+    std::vector<std::string> msgs;
+    setTraceFunc([&] (int, const char *msg) {
+        std::lock_guard<std::mutex> g(msg_mutex);
+        msgs.push_back(msg);
+    });
+    {
+        EventLoop loop;
+        ASSERT_TRUE(loop.init());
+        loop.setWatchdog(20);
+        loop.post([] { std::this_thread::sleep_for(std::chrono::milliseconds(100)); });
+        loop.post([] {});
+        loop.loopOnce(0);
+        loop.setWatchdog(0);
+    }
+    setTraceFunc(nullptr);
+    int slow = 0, blocking = 0;
+    for (auto &msg : msgs) {
+        if (msg.find("slow callback, task") != std::string::npos) {
+            ++slow;
+        } else if (msg.find("callback is blocking the loop, task") != std::string::npos) {
+            ++blocking;
+        }
+    }
+    EXPECT_EQ(1, slow);
+    EXPECT_EQ(1, blocking);
+}